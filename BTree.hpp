@@ -0,0 +1,1456 @@
+#ifndef BTREE_HPP
+#define BTREE_HPP
+/* BTree.hpp
+ *
+ * An ordered container of unique elements stored in a B-tree.
+ *
+ * Each node holds up to max_slots elements in one contiguous array, and an
+ * internal node holds one more child pointer than it has elements. Nodes
+ * are sized to span a few cache lines, so a lookup touches a handful of
+ * lines per level instead of one node (and one cache miss) per comparison
+ * as in BinarySearchTree. Every node also records the number of elements
+ * in its subtree, which gives O(log n) nth_element and rank.
+ *
+ * The interface follows BinarySearchTree, so a BTree can stand in as the
+ * storage of a Map (see BTreeStorage in Map.hpp). Unlike BinarySearchTree,
+ * elements move between slots as the tree changes shape: inserting or
+ * erasing an element invalidates all iterators and references.
+ *
+ * Example:
+ *   BTree<int> tree;
+ *   tree.try_insert(3);
+ *   cout << *tree.find(3) << endl; // prints 3
+ */
+
+#include "FrozenTree.hpp"
+#include "IteratorRange.hpp"
+#include "KeySearch.hpp"
+#include <algorithm> //adjacent_find
+#include <cassert>  //assert
+#include <cstddef>  //size_t
+#include <functional> //less
+#include <iterator> //iterator_traits
+#include <memory>   //allocator, allocator_traits
+#include <new>      //launder
+#include <type_traits>
+#include <utility>  //pair, move, forward
+
+// EFFECTS: Describes the arithmetic key that a BTree<T, Compare> can search
+//          its nodes by with count_keys_less (see KeySearch.hpp) instead of
+//          calling Compare. 'enabled' is false when there is none.
+template <typename T, typename Compare, typename = void>
+struct btree_search_key {
+  static const bool enabled = false;
+  using type = T;
+};
+
+// Vector keys ordered by < are their own search keys.
+template <typename T>
+struct btree_identity_key {
+  static const bool enabled = true;
+  using type = T;
+  static T get(const T &item) {
+    return item;
+  }
+};
+
+template <typename T>
+struct btree_search_key<T, std::less<T>,
+                        std::enable_if_t<is_vector_key<T>::value>>
+  : btree_identity_key<T> { };
+
+template <typename T>
+struct btree_search_key<T, std::less<>,
+                        std::enable_if_t<is_vector_key<T>::value>>
+  : btree_identity_key<T> { };
+
+// A comparator that orders elements by the built-in < on a key within
+// them declares the type of that key as search_key_type, along with a
+// static member function search_key(const T &) that extracts it (see
+// PairComp in Map.hpp).
+template <typename T, typename Compare>
+struct btree_search_key<T, Compare,
+                        std::void_t<typename Compare::search_key_type>> {
+  static const bool enabled =
+    is_vector_key<typename Compare::search_key_type>::value;
+  using type = typename Compare::search_key_type;
+  static type get(const T &item) {
+    return Compare::search_key(item);
+  }
+};
+
+// The copies of the search keys that a BTree node keeps next to its
+// elements when the elements are not keys themselves.
+template <typename Key, size_t N, bool shadow>
+struct btree_node_keys { };
+
+template <typename Key, size_t N>
+struct btree_node_keys<Key, N, true> {
+  Key keys[N];
+};
+
+template <typename T,
+          typename Compare=std::less<T>,
+          typename Allocator=std::allocator<T>
+         >
+class BTree {
+
+  // OVERVIEW: A B-tree of minimum degree t holds between t - 1 and
+  //           2t - 1 elements in every node except the root, and all of
+  //           its leaves are at the same depth. The elements of each node
+  //           are sorted, and the subtree at child i of an internal node
+  //           holds exactly the elements between its elements i - 1 and i.
+  //
+  // REQUIRES: T's move constructor does not throw, since elements are
+  //           moved between slots as nodes split and merge.
+
+private:
+  struct Internal_node;
+
+  // The fields at the start of every node.
+  struct Node_header {
+    // The parent of this node, or a null pointer for the root
+    Internal_node *parent;
+    // The number of elements in the subtree rooted at this node
+    size_t size;
+    // The number of elements in this node
+    unsigned short count;
+    // The index of this node among the children of its parent
+    unsigned short position;
+    bool leaf;
+  };
+
+  using Search_key = btree_search_key<T, Compare>;
+  using Key = typename Search_key::type;
+
+  // Whether each node keeps the search keys of its elements in an array
+  // of their own, so that they are contiguous for count_keys_less
+  static constexpr bool shadow_keys =
+    Search_key::enabled && !std::is_same<T, Key>::value;
+
+  // Nodes are sized to fill four 64-byte cache lines.
+  static constexpr size_t node_bytes = 256;
+  static constexpr size_t slot_bytes =
+    sizeof(T) + (shadow_keys ? sizeof(Key) : 0);
+  static constexpr size_t fitting_slots =
+    sizeof(Node_header) + slot_bytes <= node_bytes
+      ? (node_bytes - sizeof(Node_header)) / slot_bytes : 1;
+  static constexpr size_t min_degree =
+    fitting_slots < 3 ? 2 : (fitting_slots + 1) / 2;
+
+public:
+  // The most elements a node can hold
+  static constexpr size_t max_slots = 2 * min_degree - 1;
+
+private:
+  // The fewest elements a node other than the root can hold
+  static constexpr size_t min_slots = min_degree - 1;
+
+  struct Node : Node_header, btree_node_keys<Key, max_slots, shadow_keys> {
+    alignas(T) unsigned char bytes[max_slots * sizeof(T)];
+
+    // EFFECTS: Returns the address of slot i, which need not hold an
+    //          element yet.
+    T *address(size_t i) {
+      return reinterpret_cast<T *>(bytes) + i;
+    }
+
+    // REQUIRES: slot i holds an element
+    T &slot(size_t i) {
+      return *std::launder(address(i));
+    }
+
+    const T &slot(size_t i) const {
+      return *std::launder(reinterpret_cast<const T *>(bytes) + i);
+    }
+  };
+
+  struct Internal_node : Node {
+    Node *children[max_slots + 1];
+  };
+
+  using Alloc_traits = std::allocator_traits<Allocator>;
+  using Leaf_allocator =
+    typename Alloc_traits::template rebind_alloc<Node>;
+  using Internal_allocator =
+    typename Alloc_traits::template rebind_alloc<Internal_node>;
+
+public:
+
+  // Default constructor
+  BTree()
+    : root(nullptr) { }
+
+  // Constructs an empty tree whose nodes and elements come from alloc_in
+  explicit BTree(const Allocator &alloc_in)
+    : root(nullptr), alloc(alloc_in) { }
+
+  // Range constructor
+  // (Note elements equivalent to an earlier one are skipped.)
+  template <typename Iter,
+            typename = typename std::iterator_traits<Iter>::iterator_category>
+  BTree(Iter first, Iter last, const Allocator &alloc_in = Allocator())
+    : root(nullptr), alloc(alloc_in) {
+    try {
+      for (; first != last; ++first) {
+        try_insert(*first);
+      }
+    }
+    catch (...) {
+      destroy_nodes_impl(root, alloc);
+      throw;
+    }
+  }
+
+  // Copy constructor
+  BTree(const BTree &other)
+    : root(nullptr),
+      alloc(Alloc_traits::select_on_container_copy_construction(other.alloc)) {
+    root = copy_nodes_impl(other.root, alloc);
+  }
+
+  // Move constructor
+  BTree(BTree &&other) noexcept
+    : root(other.root), alloc(other.alloc) {
+    other.root = nullptr;
+  }
+
+  // Assignment operator
+  BTree &operator=(const BTree &rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    Node *copy = copy_nodes_impl(rhs.root, alloc);
+    destroy_nodes_impl(root, alloc);
+    root = copy;
+    return *this;
+  }
+
+  // Move assignment operator
+  // (Note the nodes of rhs are taken over when both trees can free each
+  // other's nodes; otherwise they are copied with this tree's allocator.
+  // rhs is left empty either way.)
+  BTree &operator=(BTree &&rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    destroy_nodes_impl(root, alloc);
+    root = nullptr;
+    if (Alloc_traits::propagate_on_container_move_assignment::value) {
+      alloc = rhs.alloc;
+    }
+    if (alloc == rhs.alloc) {
+      std::swap(root, rhs.root);
+    }
+    else {
+      root = copy_nodes_impl(rhs.root, alloc);
+      destroy_nodes_impl(rhs.root, rhs.alloc);
+      rhs.root = nullptr;
+    }
+    return *this;
+  }
+
+  // Destructor
+  ~BTree() {
+    destroy_nodes_impl(root, alloc);
+  }
+
+  // EFFECTS: Returns a copy of the allocator used by this tree.
+  Allocator get_allocator() const {
+    return alloc;
+  }
+
+  // EFFECTS: Returns whether this BTree is empty.
+  bool empty() const {
+    return !root;
+  }
+
+  // EFFECTS: Returns the number of levels of nodes in this BTree, or 0 if
+  //          it is empty.
+  size_t height() const {
+    size_t levels = 0;
+    for (const Node *node = root; node; node = first_child_impl(node)) {
+      ++levels;
+    }
+    return levels;
+  }
+
+  // EFFECTS: Returns the number of elements in this BTree.
+  size_t size() const {
+    return root ? root->size : 0;
+  }
+
+  // EFFECTS: Returns whether every element is less than the one after it.
+  bool check_sorting_invariant() const {
+    if (!root) {
+      return true;
+    }
+    Iterator prev = begin();
+    for (Iterator it = ++begin(); it != end(); ++prev, ++it) {
+      if (!less(*prev, *it)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // EFFECTS: Returns whether the shape of the tree is valid: every node
+  //          but the root holds at least min_slots elements, all leaves
+  //          are at the same depth, and the recorded subtree sizes and
+  //          parent links are correct.
+  bool check_balance_invariant() const {
+    return !root
+      || (!root->parent && check_node_impl(root, height(), true));
+  }
+
+  template <typename Element>
+  class Tree_iterator {
+    // OVERVIEW: Iterator interface for BTree. Iterates over the elements
+    //           in ascending order. An Iterator refers to a slot of a node
+    //           and steps between nodes through parent links, so stepping
+    //           does no comparisons.
+
+    //           Element is T for an Iterator, through which elements may
+    //           be changed, and const T for a Const_iterator, which
+    //           cbegin, cend, cfind and the const range queries return.
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Element *;
+    using reference = Element &;
+
+    Tree_iterator()
+      : tree(nullptr), node(nullptr), index(0) { }
+
+    // Converts an Iterator to a Const_iterator
+    template <typename Other, typename = std::enable_if_t<
+                  std::is_same<Element, const Other>::value>>
+    Tree_iterator(const Tree_iterator<Other> &other)
+      : tree(other.tree), node(other.node), index(other.index) { }
+
+    // EFFECTS:  Returns the current element by reference.
+    // WARNING:  Modifications must leave the element comparing equal to
+    //           its old value, or the sorting invariant will not hold.
+    Element &operator*() const {
+      return node->slot(index);
+    }
+
+    // EFFECTS:  Returns the current element by pointer.
+    // WARNING:  See operator*.
+    Element *operator->() const {
+      return &node->slot(index);
+    }
+
+    // Prefix ++
+    Tree_iterator &operator++() {
+      if (!node->leaf) {
+        // The next element is the first of the subtree to the right
+        node = leftmost_leaf_impl(child_impl(node, index + 1));
+        index = 0;
+        return *this;
+      }
+      if (++index < node->count) {
+        return *this;
+      }
+      // Otherwise, climb out of every subtree this was the last element
+      // of. The next element separates the last one left from its sibling.
+      Node *climb = node;
+      while (climb->parent && climb->position == climb->parent->count) {
+        climb = climb->parent;
+      }
+      node = climb->parent;
+      index = node ? climb->position : 0;
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Tree_iterator operator++(int) {
+      Tree_iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    // Prefix --
+    // REQUIRES: this Iterator does not refer to the minimum element, and
+    //           if it is an end Iterator, it was obtained from a tree.
+    Tree_iterator &operator--() {
+      if (!node || !node->leaf) {
+        // The previous element is the last of the subtree to the left
+        node = rightmost_leaf_impl(node ? child_impl(node, index) : tree->root);
+        index = node->count - 1;
+      }
+      else if (index > 0) {
+        --index;
+      }
+      else {
+        Node *climb = node;
+        while (climb->position == 0) {
+          climb = climb->parent;
+        }
+        node = climb->parent;
+        index = climb->position - 1;
+      }
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Tree_iterator operator--(int) {
+      Tree_iterator result(*this);
+      --(*this);
+      return result;
+    }
+
+    // An Iterator and a Const_iterator may be compared with each other
+    template <typename Other>
+    bool operator==(const Tree_iterator<Other> &rhs) const {
+      return node == rhs.node && index == rhs.index;
+    }
+
+    template <typename Other>
+    bool operator!=(const Tree_iterator<Other> &rhs) const {
+      return !(*this == rhs);
+    }
+
+  private:
+    friend class BTree;
+    template <typename> friend class Tree_iterator;
+
+    const BTree *tree;
+    Node *node;
+    size_t index;
+
+    Tree_iterator(const BTree *tree_in, Node *node_in, size_t index_in)
+      : tree(tree_in), node(node_in), index(index_in) { }
+
+  }; // BTree::Tree_iterator
+
+  // An iterator through which elements may be changed
+  using Iterator = Tree_iterator<T>;
+
+  // An iterator through which elements may only be read
+  using Const_iterator = Tree_iterator<const T>;
+
+  // A view of the elements in an interval (see range)
+  using Range = Iterator_range<Iterator>;
+  using Const_range = Iterator_range<Const_iterator>;
+
+  // EFFECTS : Returns an iterator to the first element, or an end Iterator
+  //           if the tree is empty.
+  // NOTE:     begin, end and find return an Iterator even on a const tree,
+  //           as BinarySearchTree does, so that Map has the same interface
+  //           over either. cbegin, cend and cfind return a Const_iterator.
+  Iterator begin() const {
+    return root ? Iterator(this, leftmost_leaf_impl(root), 0) : end();
+  }
+
+  // EFFECTS : Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator(this, nullptr, 0);
+  }
+
+  // EFFECTS : Same as begin() and end(), but return a Const_iterator.
+  Const_iterator cbegin() const {
+    return begin();
+  }
+
+  Const_iterator cend() const {
+    return end();
+  }
+
+  // EFFECTS : Returns an iterator to the element equivalent to query, or
+  //           an end Iterator if there is none.
+  Iterator find(const T &query) const {
+    return find_key(query);
+  }
+
+  // EFFECTS : Same as find(const T &), but compares elements directly
+  //           against a value of another type K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return find_key(query);
+  }
+
+  // EFFECTS : Same as find, but returns a Const_iterator.
+  Const_iterator cfind(const T &query) const {
+    return find(query);
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_iterator cfind(const K &query) const {
+    return find(query);
+  }
+
+  // EFFECTS : Returns an iterator to the element with exactly k smaller
+  //           elements, or an end Iterator if k >= size().
+  Const_iterator nth_element(size_t k) const {
+    return nth_slot(k);
+  }
+
+  Iterator nth_element(size_t k) {
+    return nth_slot(k);
+  }
+
+  // EFFECTS : Returns the number of elements less than val.
+  size_t rank(const T &val) const {
+    return rank_key(val);
+  }
+
+  // EFFECTS : Same as rank(const T &), for a value of another type K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t rank(const K &val) const {
+    return rank_key(val);
+  }
+
+  // EFFECTS : Returns an iterator to the first element not less than val,
+  //           or an end Iterator if there is none.
+  Const_iterator lower_bound(const T &val) const {
+    return lower_bound_key(val);
+  }
+
+  Iterator lower_bound(const T &val) {
+    return lower_bound_key(val);
+  }
+
+  // EFFECTS : Same as lower_bound(const T &), for a value of another type
+  //           K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_iterator lower_bound(const K &val) const {
+    return lower_bound_key(val);
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K &val) {
+    return lower_bound_key(val);
+  }
+
+  // EFFECTS : Returns an iterator to the first element greater than val,
+  //           or an end Iterator if there is none.
+  Const_iterator upper_bound(const T &val) const {
+    return equal_range_key(val).second;
+  }
+
+  Iterator upper_bound(const T &val) {
+    return equal_range_key(val).second;
+  }
+
+  // EFFECTS : Same as upper_bound(const T &), for a value of another type
+  //           K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_iterator upper_bound(const K &val) const {
+    return equal_range_key(val).second;
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K &val) {
+    return equal_range_key(val).second;
+  }
+
+  // EFFECTS : Returns the pair of lower_bound(val) and upper_bound(val),
+  //           found in a single descent.
+  std::pair<Const_iterator, Const_iterator>
+  equal_range(const T &val) const {
+    return equal_range_key(val);
+  }
+
+  std::pair<Iterator, Iterator> equal_range(const T &val) {
+    return equal_range_key(val);
+  }
+
+  // EFFECTS : Same as equal_range(const T &), for a value of another type
+  //           K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Const_iterator, Const_iterator>
+  equal_range(const K &val) const {
+    return equal_range_key(val);
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const K &val) {
+    return equal_range_key(val);
+  }
+
+  // EFFECTS : Returns a view of the elements not less than lo and less
+  //           than hi, in ascending order; empty if hi is not greater than
+  //           lo. Finding the ends takes O(log n) and stepping through k
+  //           elements O(k) more.
+  Const_range range(const T &lo, const T &hi) const {
+    Range found = range_key(lo, hi);
+    return Const_range(found.begin(), found.end());
+  }
+
+  Range range(const T &lo, const T &hi) {
+    return range_key(lo, hi);
+  }
+
+  // EFFECTS : Same as range(const T &, const T &), for bounds of another
+  //           type K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_range range(const K &lo, const K &hi) const {
+    Range found = range_key(lo, hi);
+    return Const_range(found.begin(), found.end());
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Range range(const K &lo, const K &hi) {
+    return range_key(lo, hi);
+  }
+
+  // EFFECTS : Returns the number of elements not less than lo and less
+  //           than hi, in O(log n) from the recorded subtree sizes.
+  size_t count_range(const T &lo, const T &hi) const {
+    return count_range_key(lo, hi);
+  }
+
+  // EFFECTS : Same as count_range(const T &, const T &), for bounds of
+  //           another type K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t count_range(const K &lo, const K &hi) const {
+    return count_range_key(lo, hi);
+  }
+
+  // EFFECTS: Returns an immutable snapshot of the elements of this tree,
+  //          laid out for fast read-only lookup (see FrozenTree.hpp).
+  //          Runs in linear time. Later changes to this tree do not
+  //          affect the snapshot.
+  FrozenTree<T, Compare> freeze() const {
+    return FrozenTree<T, Compare>(begin(), end());
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Inserts a copy of item unless an equivalent element is
+  //           already present. Returns an iterator to the element with
+  //           that value, along with whether it was inserted.
+  std::pair<Iterator, bool> try_insert(const T &item) {
+    auto make = [&](T *where) {
+      Alloc_traits::construct(alloc, where, item);
+    };
+    return insert_key(item, make);
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Same as try_insert(const T &), but moves item into the tree.
+  //           If an equivalent element is present, item is not moved.
+  std::pair<Iterator, bool> try_insert(T &&item) {
+    auto make = [&](T *where) {
+      Alloc_traits::construct(alloc, where, std::move(item));
+    };
+    return insert_key(item, make);
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : If an element equivalent to key is present, returns an
+  //           iterator to it along with false, and args are left untouched.
+  //           Otherwise, inserts an element constructed in place from args
+  //           (which must compare equivalent to key) and returns an
+  //           iterator to it along with true.
+  template <typename K, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const K &key, Args &&...args) {
+    auto make = [&](T *where) {
+      Alloc_traits::construct(alloc, where, std::forward<Args>(args)...);
+    };
+    return insert_key(key, make);
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Constructs an element from args and inserts it unless an
+  //           equivalent element is already present, in which case the
+  //           constructed element is discarded. Returns the same as
+  //           try_insert.
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args &&...args) {
+    T item(std::forward<Args>(args)...);
+    return try_insert(std::move(item));
+  }
+
+  // REQUIRES: [first, last) is strictly increasing according to Compare
+  // MODIFIES: this BTree
+  // EFFECTS : Replaces the contents of this tree with copies of the
+  //           elements in [first, last) in linear time, packing the nodes
+  //           as full as possible. If copying an element throws, this tree
+  //           is left unchanged.
+  template <typename Forward_iterator>
+  void assign_sorted(Forward_iterator first, Forward_iterator last) {
+    assert(std::adjacent_find(first, last, [this](const T &a, const T &b) {
+      return !less(a, b);
+    }) == last);
+    Node *built = build_sorted_impl(first, last, alloc);
+    destroy_nodes_impl(root, alloc);
+    root = built;
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the element equivalent to value, if there is one.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const T &value) {
+    return erase_key(value);
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Same as erase(const T &), for a value of another type K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t erase(const K &value) {
+    return erase_key(value);
+  }
+
+  // REQUIRES: pos refers to an element of this BTree
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the element at pos and returns an Iterator to the
+  //           element that followed it (or an end Iterator).
+  Iterator erase(Const_iterator pos) {
+    size_t index = index_of_impl(pos.node, pos.index);
+    erase_slot(pos.node, pos.index);
+    return nth_element(index);
+  }
+
+  Iterator erase(Iterator pos) {
+    return erase(Const_iterator(pos));
+  }
+
+  // REQUIRES: [first, last) is a range of elements of this BTree
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the elements in [first, last) and returns an
+  //           Iterator to the element that followed them.
+  Iterator erase(Const_iterator first, Const_iterator last) {
+    size_t from = first.node ? index_of_impl(first.node, first.index) : size();
+    size_t to = last.node ? index_of_impl(last.node, last.index) : size();
+    for (size_t k = from; k < to; ++k) {
+      Iterator pos = nth_element(from);
+      erase_slot(pos.node, pos.index);
+    }
+    return nth_element(from);
+  }
+
+private:
+  // The root node of this BTree, or a null pointer if it is empty.
+  Node *root;
+
+  // An instance of the Compare type. Use this to compare elements.
+  Compare less;
+
+  // The allocator that elements are constructed with. Nodes come from
+  // copies of it rebound to the node types.
+  Allocator alloc;
+
+  Iterator nth_slot(size_t k) const {
+    if (k >= size()) {
+      return end();
+    }
+    Node *node = root;
+    while (!node->leaf) {
+      size_t i = 0;
+      while (k > child_impl(node, i)->size) {
+        k -= child_impl(node, i)->size + 1;
+        ++i;
+      }
+      if (k == child_impl(node, i)->size) {
+        return Iterator(this, node, i);
+      }
+      node = child_impl(node, i);
+    }
+    return Iterator(this, node, k);
+  }
+
+  template <typename K>
+  Iterator find_key(const K &query) const {
+    Node *node = root;
+    while (node) {
+      size_t i = lower_bound_impl(node, query, less);
+      if (equivalent_at_impl(node, i, query, less)) {
+        return Iterator(this, node, i);
+      }
+      node = node->leaf ? nullptr : child_impl(node, i);
+    }
+    return end();
+  }
+
+  template <typename K>
+  size_t rank_key(const K &val) const {
+    size_t result = 0;
+    Node *node = root;
+    while (node) {
+      size_t i = lower_bound_impl(node, val, less);
+      result += i + children_size_impl(node, i);
+      if (equivalent_at_impl(node, i, val, less)) {
+        // Everything in the subtree just left of val is also less
+        return result + (node->leaf ? 0 : child_impl(node, i)->size);
+      }
+      node = node->leaf ? nullptr : child_impl(node, i);
+    }
+    return result;
+  }
+
+  // Each node on the way down narrows the answer: the lower bound within
+  // a node is the best candidate so far, and the child to its left can
+  // only hold closer ones.
+  template <typename K>
+  Iterator lower_bound_key(const K &key) const {
+    Iterator best = end();
+    Node *node = root;
+    while (node) {
+      size_t i = lower_bound_impl(node, key, less);
+      if (i < node->count) {
+        best = Iterator(this, node, i);
+        if (equivalent_at_impl(node, i, key, less)) {
+          return best;
+        }
+      }
+      node = node->leaf ? nullptr : child_impl(node, i);
+    }
+    return best;
+  }
+
+  template <typename K>
+  std::pair<Iterator, Iterator> equal_range_key(const K &key) const {
+    Iterator lower = lower_bound_key(key);
+    if (lower != end() && !less(key, *lower)) {
+      Iterator upper(lower);
+      return std::pair<Iterator, Iterator>(lower, ++upper);
+    }
+    return std::pair<Iterator, Iterator>(lower, lower);
+  }
+
+  // Bounds of type K may not be comparable with each other, so an empty
+  // interval is detected by comparing hi with the first element in it.
+  template <typename K>
+  Range range_key(const K &lo, const K &hi) const {
+    Iterator first = lower_bound_key(lo);
+    if (first == end() || !less(*first, hi)) {
+      return Range(first, first);
+    }
+    return Range(first, lower_bound_key(hi));
+  }
+
+  template <typename K>
+  size_t count_range_key(const K &lo, const K &hi) const {
+    size_t below_lo = rank_key(lo);
+    size_t below_hi = rank_key(hi);
+    return below_hi > below_lo ? below_hi - below_lo : 0;
+  }
+
+  // EFFECTS: Descends from the root to the slot where key belongs,
+  //          splitting every full node on the way so that a node always
+  //          has room for an element pushed up from its child. If an
+  //          element equivalent to key is found, returns its position and
+  //          false. Otherwise, calls make() to construct the new element
+  //          in its leaf slot and returns its position and true.
+  template <typename K, typename Make>
+  std::pair<Iterator, bool> insert_key(const K &key, Make &make) {
+    if (!root) {
+      root = new_leaf_impl(alloc);
+    }
+    else if (root->count == max_slots) {
+      Internal_node *top = new_internal_impl(alloc);
+      top->size = root->size;
+      set_child_impl(top, 0, root);
+      root = top;
+      split_child_impl(top, 0, alloc);
+    }
+    Node *node = root;
+    while (true) {
+      size_t i = lower_bound_impl(node, key, less);
+      if (equivalent_at_impl(node, i, key, less)) {
+        return { Iterator(this, node, i), false };
+      }
+      if (node->leaf) {
+        return { Iterator(this, node, i), insert_slot(node, i, make) };
+      }
+      if (child_impl(node, i)->count == max_slots) {
+        // The child's middle element moves up into slot i, so search this
+        // node again
+        split_child_impl(static_cast<Internal_node *>(node), i, alloc);
+        continue;
+      }
+      node = child_impl(node, i);
+    }
+  }
+
+  // REQUIRES: 'leaf' is a leaf with room for another element
+  // EFFECTS : Calls make() to construct an element in slot i of 'leaf',
+  //           shifting later elements up, and counts the element in every
+  //           ancestor. Returns true. If make() throws, the tree is left
+  //           unchanged (except that an empty root is freed).
+  template <typename Make>
+  bool insert_slot(Node *leaf, size_t i, Make &make) {
+    open_slot_impl(leaf, i);
+    try {
+      make(leaf->address(i));
+    }
+    catch (...) {
+      close_slot_impl(leaf, i);
+      if (root->size == 0) {
+        free_node_impl(root, alloc);
+        root = nullptr;
+      }
+      throw;
+    }
+    store_key_impl(leaf, i);
+    ++leaf->count;
+    for (Node *node = leaf; node; node = node->parent) {
+      ++node->size;
+    }
+    return true;
+  }
+
+  template <typename K>
+  size_t erase_key(const K &value) {
+    Iterator pos = find_key(value);
+    if (!pos.node) {
+      return 0;
+    }
+    erase_slot(pos.node, pos.index);
+    return 1;
+  }
+
+  // EFFECTS: Destroys the element in slot i of 'node'. If 'node' is
+  //          internal, the element's predecessor (the last element of the
+  //          rightmost leaf to its left) moves into the slot instead. The
+  //          leaf that lost an element is then refilled, see refill().
+  void erase_slot(Node *node, size_t i) {
+    Alloc_traits::destroy(alloc, &node->slot(i));
+    if (node->leaf) {
+      close_slot_impl(node, i);
+    }
+    else {
+      Node *leaf = rightmost_leaf_impl(child_impl(node, i));
+      move_slot_impl(node, i, leaf, leaf->count - 1);
+      node = leaf;
+    }
+    --node->count;
+    for (Node *ancestor = node; ancestor; ancestor = ancestor->parent) {
+      --ancestor->size;
+    }
+    refill(node);
+  }
+
+  // EFFECTS: Walks up from 'node' while it holds fewer than min_slots
+  //          elements. A node in that state borrows an element from a
+  //          sibling that can spare one, through their parent; otherwise
+  //          it merges with a sibling, which takes an element from the
+  //          parent, and the walk continues with the parent. An empty root
+  //          is then replaced by its only child.
+  void refill(Node *node) {
+    while (node != root && node->count < min_slots) {
+      Internal_node *parent = node->parent;
+      size_t pos = node->position;
+      if (pos > 0 && parent->children[pos - 1]->count > min_slots) {
+        rotate_right_impl(parent, pos - 1, alloc);
+        return;
+      }
+      if (pos < parent->count && parent->children[pos + 1]->count > min_slots) {
+        rotate_left_impl(parent, pos, alloc);
+        return;
+      }
+      merge_children_impl(parent, pos > 0 ? pos - 1 : pos, alloc);
+      node = parent;
+    }
+    if (root->count == 0) {
+      Node *old_root = root;
+      root = old_root->leaf ? nullptr : child_impl(old_root, 0);
+      if (root) {
+        root->parent = nullptr;
+      }
+      free_node_impl(old_root, alloc);
+    }
+  }
+
+  // NODE HELPERS
+  // These static member functions work on the nodes of a tree. They
+  // follow the same conventions as the *_impl functions of
+  // BinarySearchTree.
+
+  static Node *child_impl(const Node *node, size_t i) {
+    return static_cast<const Internal_node *>(node)->children[i];
+  }
+
+  static Node *first_child_impl(const Node *node) {
+    return node->leaf ? nullptr : child_impl(node, 0);
+  }
+
+  static Node *leftmost_leaf_impl(Node *node) {
+    while (!node->leaf) {
+      node = child_impl(node, 0);
+    }
+    return node;
+  }
+
+  static Node *rightmost_leaf_impl(Node *node) {
+    while (!node->leaf) {
+      node = child_impl(node, node->count);
+    }
+    return node;
+  }
+
+  // EFFECTS: Returns the total size of the first n children of 'node', or
+  //          0 if 'node' is a leaf.
+  static size_t children_size_impl(const Node *node, size_t n) {
+    size_t total = 0;
+    for (size_t i = 0; !node->leaf && i < n; ++i) {
+      total += child_impl(node, i)->size;
+    }
+    return total;
+  }
+
+  // EFFECTS: Returns the index of the first element of 'node' that is not
+  //          less than key, or node->count if there is none.
+  // NOTE:    When key has a search key, this counts the search keys less
+  //          than it with vector instructions rather than calling 'less'.
+  template <typename K>
+  static size_t lower_bound_impl(const Node *node, const K &key,
+                                 Compare less) {
+    if constexpr (by_search_key<K>) {
+      return count_keys_less(search_keys_impl(node), node->count,
+                             search_key_of_impl(key));
+    }
+    size_t lo = 0;
+    size_t hi = node->count;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (less(node->slot(mid), key)) {
+        lo = mid + 1;
+      }
+      else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  // EFFECTS: Returns whether slot i of 'node' holds an element equivalent
+  //          to key, given that it is the lower bound of key.
+  template <typename K>
+  static bool equivalent_at_impl(const Node *node, size_t i, const K &key,
+                                 Compare less) {
+    if (i == node->count) {
+      return false;
+    }
+    if constexpr (by_search_key<K>) {
+      return !(search_key_of_impl(key) < search_keys_impl(node)[i]);
+    }
+    else {
+      return !less(key, node->slot(i));
+    }
+  }
+
+  // Whether a query of type K can be located by its search key: it is
+  // either a search key itself or an element.
+  template <typename K>
+  static constexpr bool by_search_key = Search_key::enabled
+    && (std::is_same<K, Key>::value || std::is_same<K, T>::value);
+
+  // REQUIRES: by_search_key<K>
+  // EFFECTS:  Returns the search key of key.
+  template <typename K>
+  static Key search_key_of_impl(const K &key) {
+    if constexpr (std::is_same<K, Key>::value) {
+      return key;
+    }
+    else {
+      return Search_key::get(key);
+    }
+  }
+
+  // EFFECTS: Returns the search keys of the elements of 'node', in order.
+  static const Key *search_keys_impl(const Node *node) {
+    if constexpr (shadow_keys) {
+      return node->keys;
+    }
+    else {
+      return reinterpret_cast<const Key *>(node->bytes);
+    }
+  }
+
+  // REQUIRES: slot i of 'node' holds an element
+  // EFFECTS : Records the search key of that element, if the nodes keep
+  //           their own copies of the search keys.
+  static void store_key_impl(Node *node, size_t i) {
+    if constexpr (shadow_keys) {
+      node->keys[i] = Search_key::get(node->slot(i));
+    }
+  }
+
+  // EFFECTS: Returns the number of elements in the tree that come before
+  //          slot i of 'node'.
+  static size_t index_of_impl(const Node *node, size_t i) {
+    size_t result = i + children_size_impl(node, i + 1);
+    for (; node->parent; node = node->parent) {
+      result += node->position
+        + children_size_impl(node->parent, node->position);
+    }
+    return result;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Returns a new leaf with no elements.
+  static Node *new_leaf_impl(Allocator &alloc) {
+    Leaf_allocator leaf_alloc(alloc);
+    Node *node = std::allocator_traits<Leaf_allocator>::allocate(leaf_alloc, 1);
+    init_node_impl(new (node) Node, true);
+    return node;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Returns a new internal node with no elements and null child
+  //           pointers.
+  static Internal_node *new_internal_impl(Allocator &alloc) {
+    Internal_allocator internal_alloc(alloc);
+    Internal_node *node =
+      std::allocator_traits<Internal_allocator>::allocate(internal_alloc, 1);
+    init_node_impl(new (node) Internal_node, false);
+    for (Node *&child : node->children) {
+      child = nullptr;
+    }
+    return node;
+  }
+
+  static void init_node_impl(Node *node, bool leaf) {
+    node->parent = nullptr;
+    node->size = 0;
+    node->count = 0;
+    node->position = 0;
+    node->leaf = leaf;
+  }
+
+  // REQUIRES: 'node' holds no elements
+  // MODIFIES: alloc
+  // EFFECTS : Returns the memory of 'node' to the allocator.
+  static void free_node_impl(Node *node, Allocator &alloc) {
+    if (node->leaf) {
+      Leaf_allocator leaf_alloc(alloc);
+      std::allocator_traits<Leaf_allocator>::deallocate(leaf_alloc, node, 1);
+    }
+    else {
+      Internal_allocator internal_alloc(alloc);
+      std::allocator_traits<Internal_allocator>::deallocate(
+        internal_alloc, static_cast<Internal_node *>(node), 1);
+    }
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Destroys every element and frees every node of the subtree
+  //           rooted at 'node'. Null child pointers are skipped.
+  // NOTE:     The recursion is as deep as the tree is tall, which is
+  //           logarithmic in its size.
+  static void destroy_nodes_impl(Node *node, Allocator &alloc) {
+    if (!node) {
+      return;
+    }
+    for (size_t i = 0; !node->leaf && i <= node->count; ++i) {
+      destroy_nodes_impl(child_impl(node, i), alloc);
+    }
+    for (size_t i = 0; i < node->count; ++i) {
+      Alloc_traits::destroy(alloc, &node->slot(i));
+    }
+    node->count = 0;
+    free_node_impl(node, alloc);
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Returns the root of a copy of the subtree rooted at 'node'.
+  //           If copying an element throws, frees what was copied.
+  // NOTE:     See destroy_nodes_impl on the depth of the recursion.
+  static Node *copy_nodes_impl(const Node *node, Allocator &alloc) {
+    if (!node) {
+      return nullptr;
+    }
+    Node *copy = node->leaf ? new_leaf_impl(alloc) : new_internal_impl(alloc);
+    try {
+      for (; copy->count < node->count; ++copy->count) {
+        Alloc_traits::construct(alloc, copy->address(copy->count),
+                                node->slot(copy->count));
+        store_key_impl(copy, copy->count);
+      }
+      for (size_t i = 0; !node->leaf && i <= node->count; ++i) {
+        set_child_impl(static_cast<Internal_node *>(copy), i,
+                       copy_nodes_impl(child_impl(node, i), alloc));
+      }
+    }
+    catch (...) {
+      destroy_nodes_impl(copy, alloc);
+      throw;
+    }
+    copy->size = node->size;
+    return copy;
+  }
+
+  // MODIFIES: parent, child
+  // EFFECTS : Makes 'child' child i of 'parent'.
+  static void set_child_impl(Internal_node *parent, size_t i, Node *child) {
+    parent->children[i] = child;
+    child->parent = parent;
+    child->position = static_cast<unsigned short>(i);
+  }
+
+  // REQUIRES: slot di of 'dst' is vacant and slot si of 'src' is not
+  // EFFECTS : Moves the element in slot si of 'src' into slot di of 'dst',
+  //           leaving slot si vacant.
+  // NOTE:     Elements are created and destroyed through the allocator,
+  //           but relocated with a plain move, as std::vector does.
+  static void move_slot_impl(Node *dst, size_t di, Node *src, size_t si) {
+    T &item = src->slot(si);
+    new (dst->address(di)) T(std::move(item));
+    item.~T();
+    if constexpr (shadow_keys) {
+      dst->keys[di] = src->keys[si];
+    }
+  }
+
+  // REQUIRES: 'node' has room for another element
+  // EFFECTS : Shifts the elements of 'node' from slot i on up by one,
+  //           leaving slot i vacant. Does not change node->count.
+  static void open_slot_impl(Node *node, size_t i) {
+    for (size_t j = node->count; j > i; --j) {
+      move_slot_impl(node, j, node, j - 1);
+    }
+  }
+
+  // REQUIRES: slot i of 'node' is vacant
+  // EFFECTS : Shifts the elements of 'node' after slot i down by one,
+  //           leaving the last slot vacant. Does not change node->count.
+  static void close_slot_impl(Node *node, size_t i) {
+    for (size_t j = i + 1; j < node->count; ++j) {
+      move_slot_impl(node, j - 1, node, j);
+    }
+  }
+
+  // EFFECTS: Shifts the children of 'node' from child i on up by one,
+  //          leaving child i unset. Does not change node->count.
+  static void open_child_impl(Internal_node *node, size_t i) {
+    for (size_t j = node->count + 1; j > i; --j) {
+      set_child_impl(node, j, node->children[j - 1]);
+    }
+  }
+
+  // EFFECTS: Removes child i of 'node', shifting the children after it
+  //          down by one. Does not change node->count.
+  static void close_child_impl(Internal_node *node, size_t i) {
+    for (size_t j = i + 1; j <= node->count; ++j) {
+      set_child_impl(node, j - 1, node->children[j]);
+    }
+  }
+
+  // REQUIRES: child i of 'parent' is full and 'parent' is not
+  // MODIFIES: alloc
+  // EFFECTS : Moves the upper half of the child into a new sibling that
+  //           becomes child i + 1, and its middle element up into slot i
+  //           of 'parent'.
+  static void split_child_impl(Internal_node *parent, size_t i,
+                               Allocator &alloc) {
+    Node *child = parent->children[i];
+    Node *sibling = child->leaf ? new_leaf_impl(alloc)
+                                : new_internal_impl(alloc);
+    for (size_t j = 0; j < min_slots; ++j) {
+      move_slot_impl(sibling, j, child, min_degree + j);
+    }
+    sibling->count = min_slots;
+    sibling->size = min_slots;
+    for (size_t j = 0; !child->leaf && j < min_degree; ++j) {
+      Node *moved = child_impl(child, min_degree + j);
+      set_child_impl(static_cast<Internal_node *>(sibling), j, moved);
+      sibling->size += moved->size;
+    }
+    open_slot_impl(parent, i);
+    open_child_impl(parent, i + 1);
+    move_slot_impl(parent, i, child, min_slots);
+    set_child_impl(parent, i + 1, sibling);
+    ++parent->count;
+    child->count = min_slots;
+    child->size -= sibling->size + 1;
+  }
+
+  // EFFECTS: Moves the last element of child k of 'parent' up into slot k
+  //          and the element that was there down to the front of child
+  //          k + 1, along with the last child of child k, if any.
+  static void rotate_right_impl(Internal_node *parent, size_t k,
+                                Allocator &alloc) {
+    Node *left = parent->children[k];
+    Node *right = parent->children[k + 1];
+    open_slot_impl(right, 0);
+    move_slot_impl(right, 0, parent, k);
+    move_slot_impl(parent, k, left, left->count - 1);
+    size_t moved = 1;
+    if (!right->leaf) {
+      Node *subtree = child_impl(left, left->count);
+      open_child_impl(static_cast<Internal_node *>(right), 0);
+      set_child_impl(static_cast<Internal_node *>(right), 0, subtree);
+      moved += subtree->size;
+    }
+    --left->count;
+    ++right->count;
+    left->size -= moved;
+    right->size += moved;
+  }
+
+  // EFFECTS: Moves the first element of child k + 1 of 'parent' up into
+  //          slot k and the element that was there down to the end of
+  //          child k, along with the first child of child k + 1, if any.
+  static void rotate_left_impl(Internal_node *parent, size_t k,
+                               Allocator &alloc) {
+    Node *left = parent->children[k];
+    Node *right = parent->children[k + 1];
+    move_slot_impl(left, left->count, parent, k);
+    move_slot_impl(parent, k, right, 0);
+    close_slot_impl(right, 0);
+    size_t moved = 1;
+    if (!left->leaf) {
+      Node *subtree = child_impl(right, 0);
+      close_child_impl(static_cast<Internal_node *>(right), 0);
+      set_child_impl(static_cast<Internal_node *>(left), left->count + 1,
+                     subtree);
+      moved += subtree->size;
+    }
+    ++left->count;
+    --right->count;
+    left->size += moved;
+    right->size -= moved;
+  }
+
+  // REQUIRES: children k and k + 1 of 'parent' hold at most max_slots - 1
+  //           elements between them
+  // MODIFIES: alloc
+  // EFFECTS : Moves slot k of 'parent' and everything in child k + 1 to
+  //           the end of child k, and frees child k + 1.
+  static void merge_children_impl(Internal_node *parent, size_t k,
+                                  Allocator &alloc) {
+    Node *left = parent->children[k];
+    Node *right = parent->children[k + 1];
+    move_slot_impl(left, left->count, parent, k);
+    for (size_t j = 0; j < right->count; ++j) {
+      move_slot_impl(left, left->count + 1 + j, right, j);
+    }
+    for (size_t j = 0; !left->leaf && j <= right->count; ++j) {
+      set_child_impl(static_cast<Internal_node *>(left), left->count + 1 + j,
+                     child_impl(right, j));
+    }
+    left->count += 1 + right->count;
+    left->size += 1 + right->size;
+    right->count = 0;
+    close_slot_impl(parent, k);
+    close_child_impl(parent, k + 1);
+    --parent->count;
+    free_node_impl(right, alloc);
+  }
+
+  // REQUIRES: [first, last) is strictly increasing
+  // MODIFIES: alloc
+  // EFFECTS : Returns the root of a new tree holding copies of the
+  //           elements in [first, last), or a null pointer if the range is
+  //           empty. If an element fails to copy, frees what was built.
+  // NOTE:     Elements are appended along the right edge of the tree,
+  //           whose nodes are kept in 'spine' (spine[0] is a leaf). When
+  //           the nodes at the bottom of the spine are full, the element
+  //           goes into the lowest node that is not (or a new root), and
+  //           fresh empty nodes start the spine below it. That leaves every
+  //           node full except those on the final spine, which are then
+  //           topped up from their left siblings (see fill_spine_impl).
+  template <typename Iter>
+  static Node *build_sorted_impl(Iter first, Iter last, Allocator &alloc) {
+    if (first == last) {
+      return nullptr;
+    }
+    Node *spine[64];
+    size_t levels = 1;
+    spine[0] = new_leaf_impl(alloc);
+    try {
+      for (; first != last; ++first) {
+        size_t level = 0;
+        while (level < levels && spine[level]->count == max_slots) {
+          ++level;
+        }
+        if (level == levels) {
+          Internal_node *top = new_internal_impl(alloc);
+          set_child_impl(top, 0, spine[levels - 1]);
+          spine[levels++] = top;
+        }
+        Node *node = spine[level];
+        Alloc_traits::construct(alloc, node->address(node->count), *first);
+        store_key_impl(node, node->count);
+        ++node->count;
+        for (; level > 0; --level) {
+          Node *fresh = level == 1 ? new_leaf_impl(alloc)
+                                   : new_internal_impl(alloc);
+          set_child_impl(static_cast<Internal_node *>(spine[level]),
+                         spine[level]->count, fresh);
+          spine[level - 1] = fresh;
+        }
+      }
+    }
+    catch (...) {
+      destroy_nodes_impl(spine[levels - 1], alloc);
+      throw;
+    }
+    count_sizes_impl(spine[levels - 1]);
+    fill_spine_impl(spine, levels, alloc);
+    return spine[levels - 1];
+  }
+
+  // EFFECTS: Sets the recorded size of every node in the subtree rooted at
+  //          'node'. See destroy_nodes_impl on the depth of the recursion.
+  static void count_sizes_impl(Node *node) {
+    node->size = node->count;
+    for (size_t i = 0; !node->leaf && i <= node->count; ++i) {
+      count_sizes_impl(child_impl(node, i));
+      node->size += child_impl(node, i)->size;
+    }
+  }
+
+  // REQUIRES: every node off the spine is full
+  // EFFECTS : Moves elements into each spine node below the root from its
+  //           left sibling, which is full, until it holds min_slots.
+  // NOTE:     This goes from the top down. A spine node may start out as
+  //           the only child of the spine node above it, and only gains a
+  //           left sibling once that node has been filled.
+  static void fill_spine_impl(Node **spine, size_t levels, Allocator &alloc) {
+    for (size_t level = levels - 1; level-- > 0; ) {
+      Node *node = spine[level];
+      while (node->count < min_slots) {
+        rotate_right_impl(node->parent, node->position - 1, alloc);
+      }
+    }
+  }
+
+  // EFFECTS: Returns whether the subtree rooted at 'node' has the shape
+  //          described in check_balance_invariant, with all of its leaves
+  //          'levels' levels down.
+  static bool check_node_impl(const Node *node, size_t levels, bool is_root) {
+    if (node->count > max_slots || (!is_root && node->count < min_slots)
+        || node->leaf != (levels == 1)) {
+      return false;
+    }
+    size_t total = node->count;
+    for (size_t i = 0; !node->leaf && i <= node->count; ++i) {
+      const Node *child = child_impl(node, i);
+      if (child->parent != node || child->position != i
+          || !check_node_impl(child, levels - 1, false)) {
+        return false;
+      }
+      total += child->size;
+    }
+    return node->size == total;
+  }
+
+}; // END of BTree class
+
+#endif // BTREE_HPP
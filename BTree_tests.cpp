@@ -0,0 +1,431 @@
+#include "BTree.hpp"
+#include "NodePool.hpp"
+#include "unit_test_framework.hpp"
+// make BTree_tests.exe
+// ./BTree_tests.exe
+using namespace std;
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Large enough that a node holds only three of them, so small trees
+// already split and merge at several levels.
+struct Wide {
+    int key;
+    char padding[120];
+    Wide(int key_in) : key(key_in) {}
+    bool operator<(const Wide &rhs) const { return key < rhs.key; }
+};
+
+template <typename T>
+static int key_of(const T &item) {
+    return item;
+}
+
+static int key_of(const Wide &item) {
+    return item.key;
+}
+
+TEST(empty_tree){
+    BTree<int> tree;
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQUAL(tree.size(), 0);
+    ASSERT_EQUAL(tree.height(), 0);
+    ASSERT_TRUE(tree.begin() == tree.end());
+    ASSERT_TRUE(tree.find(3) == tree.end());
+    ASSERT_EQUAL(tree.erase(3), 0);
+    ASSERT_TRUE(tree.check_balance_invariant());
+}
+
+TEST(fanout_fits_node_size){
+    ASSERT_TRUE(BTree<int>::max_slots > 32);
+    ASSERT_EQUAL(BTree<Wide>::max_slots, 3);
+}
+
+TEST(insert_and_find_wide){
+    BTree<Wide> tree;
+    set<int> expected;
+    for (int i = 0; i < 500; ++i) {
+        int key = (i * 37) % 500;
+        ASSERT_TRUE(tree.try_insert(Wide(key)).second);
+        expected.insert(key);
+    }
+    ASSERT_FALSE(tree.try_insert(Wide(37)).second);
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_EQUAL(tree.size(), 500);
+    ASSERT_TRUE(tree.height() > 4);
+    for (int key = 0; key < 500; ++key) {
+        ASSERT_EQUAL(tree.find(Wide(key))->key, key);
+    }
+    ASSERT_TRUE(tree.find(Wide(500)) == tree.end());
+}
+
+TEST(iterate_both_directions){
+    BTree<Wide> tree;
+    for (int i = 0; i < 200; ++i) {
+        tree.try_insert(Wide((i * 71) % 200));
+    }
+    int expected = 0;
+    for (const Wide &item : tree) {
+        ASSERT_EQUAL(item.key, expected++);
+    }
+    auto it = tree.end();
+    for (int key = 199; key >= 0; --key) {
+        ASSERT_EQUAL((--it)->key, key);
+    }
+    ASSERT_TRUE(it == tree.begin());
+}
+
+template <typename Tree>
+static void random_insert_erase(int keys, int rounds) {
+    Tree tree;
+    set<int> expected;
+    unsigned seed = 1;
+    for (int round = 0; round < rounds; ++round) {
+        seed = seed * 1103515245u + 12345u;
+        int key = static_cast<int>((seed >> 8) % keys);
+        if ((seed >> 4) % 3 == 0) {
+            ASSERT_EQUAL(tree.erase(key), expected.erase(key));
+        }
+        else {
+            ASSERT_EQUAL(tree.try_insert(key).second,
+                         expected.insert(key).second);
+        }
+        if (round % 97 == 0) {
+            ASSERT_TRUE(tree.check_balance_invariant());
+        }
+    }
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_EQUAL(tree.size(), expected.size());
+    auto it = tree.begin();
+    for (int key : expected) {
+        ASSERT_EQUAL(key_of(*it), key);
+        ++it;
+    }
+    ASSERT_TRUE(it == tree.end());
+    while (!tree.empty()) {
+        tree.erase(tree.nth_element(tree.size() / 2));
+    }
+    ASSERT_TRUE(tree.check_balance_invariant());
+}
+
+TEST(random_insert_erase_wide){
+    random_insert_erase<BTree<Wide>>(300, 20000);
+}
+
+TEST(random_insert_erase_int){
+    random_insert_erase<BTree<int>>(5000, 50000);
+}
+
+TEST(nth_element_and_rank){
+    BTree<Wide> tree;
+    for (int i = 0; i < 300; ++i) {
+        tree.try_insert(Wide(2 * ((i * 43) % 300)));
+    }
+    for (int k = 0; k < 300; ++k) {
+        ASSERT_EQUAL(tree.nth_element(k)->key, 2 * k);
+        ASSERT_EQUAL(tree.rank(Wide(2 * k)), k);
+        ASSERT_EQUAL(tree.rank(Wide(2 * k + 1)), k + 1);
+    }
+    ASSERT_TRUE(tree.nth_element(300) == tree.end());
+}
+
+TEST(erase_iterator_and_range){
+    BTree<Wide> tree;
+    for (int i = 0; i < 100; ++i) {
+        tree.try_insert(Wide(i));
+    }
+    auto it = tree.erase(tree.find(Wide(40)));
+    ASSERT_EQUAL(it->key, 41);
+    it = tree.erase(tree.find(Wide(10)), tree.find(Wide(90)));
+    ASSERT_EQUAL(it->key, 90);
+    ASSERT_EQUAL(tree.size(), 20);
+    ASSERT_TRUE(tree.erase(tree.find(Wide(99))) == tree.end());
+    ASSERT_TRUE(tree.erase(tree.begin(), tree.end()) == tree.end());
+    ASSERT_TRUE(tree.empty());
+}
+
+TEST(const_iterators_are_read_only){
+    BTree<int> tree;
+    for (int i = 0; i < 100; ++i) {
+        tree.try_insert(i);
+    }
+    const BTree<int> &reader = tree;
+    BTree<int>::Const_iterator found = reader.lower_bound(40);
+    static_assert(is_same<decltype(*found), const int &>::value,
+                  "a const range query must hand out read-only elements");
+    static_assert(is_same<decltype(*tree.cfind(40)), const int &>::value,
+                  "cfind must hand out read-only elements");
+    static_assert(is_same<decltype(*tree.lower_bound(40)), int &>::value,
+                  "a non-const tree hands out writable elements");
+    ASSERT_EQUAL(*found, 40);
+    ASSERT_TRUE(found == tree.find(40));
+    ASSERT_TRUE(tree.cfind(40) == reader.nth_element(40));
+    int sum = 0;
+    for (auto it = tree.cbegin(); it != tree.cend(); ++it) {
+        sum += *it;
+    }
+    ASSERT_EQUAL(sum, 4950);
+    for (const int &item : reader.range(10, 12)) {
+        sum -= item;
+    }
+    ASSERT_EQUAL(sum, 4929);
+    ASSERT_EQUAL(*tree.erase(found), 41);
+}
+
+TEST(copy_and_move){
+    BTree<string> tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.try_insert(to_string(i));
+    }
+    BTree<string> copy(tree);
+    ASSERT_TRUE(copy.check_balance_invariant());
+    ASSERT_EQUAL(copy.size(), 1000);
+    ASSERT_EQUAL(*copy.find("517"), "517");
+    copy.erase("517");
+    ASSERT_EQUAL(*tree.find("517"), "517");
+    BTree<string> moved(std::move(copy));
+    ASSERT_TRUE(copy.empty());
+    ASSERT_EQUAL(moved.size(), 999);
+    copy = tree;
+    ASSERT_EQUAL(copy.size(), 1000);
+    tree = std::move(moved);
+    ASSERT_EQUAL(tree.size(), 999);
+}
+
+TEST(assign_sorted_packs_nodes){
+    int keys[20000];
+    for (int i = 0; i < 20000; ++i) {
+        keys[i] = i;
+    }
+    for (int n : { 0, 1, 3, 4, 7, 58, 59, 1000, 20000 }) {
+        BTree<Wide> wide;
+        wide.assign_sorted(keys, keys + n);
+        ASSERT_EQUAL(wide.size(), n);
+        ASSERT_TRUE(wide.check_balance_invariant());
+        BTree<int> tree;
+        tree.try_insert(-1);
+        tree.assign_sorted(keys, keys + n);
+        ASSERT_EQUAL(tree.size(), n);
+        ASSERT_TRUE(tree.check_balance_invariant());
+        ASSERT_TRUE(tree.check_sorting_invariant());
+    }
+    BTree<int> tree;
+    tree.assign_sorted(keys, keys + 20000);
+    ASSERT_EQUAL(tree.height(), 3);
+    ASSERT_EQUAL(tree.rank(12345), 12345);
+}
+
+// Checks lower_bound, upper_bound, equal_range, range and count_range
+// against a scan of the sorted keys, for bounds all around the even keys
+// 0, 2, ..., 2n - 2 that the tree holds.
+template <typename Tree, typename Make>
+static void check_range_queries(Tree &tree, int n, Make make) {
+    vector<int> keys;
+    for (int i = 0; i < n; ++i) {
+        tree.try_insert(make(2 * (i * 7 % n)));
+        keys.push_back(2 * i);
+    }
+    auto key_at = [&](typename Tree::Iterator it) {
+        return it == tree.end() ? -1 : key_of(*it);
+    };
+    auto key_or_end = [&](vector<int>::iterator it) {
+        return it == keys.end() ? -1 : *it;
+    };
+    for (int lo = -2; lo <= 2 * n; ++lo) {
+        auto lower = tree.lower_bound(make(lo));
+        auto upper = tree.upper_bound(make(lo));
+        ASSERT_EQUAL(key_at(lower),
+                     key_or_end(lower_bound(keys.begin(), keys.end(), lo)));
+        ASSERT_EQUAL(key_at(upper),
+                     key_or_end(upper_bound(keys.begin(), keys.end(), lo)));
+        ASSERT_TRUE(tree.equal_range(make(lo)).first == lower);
+        ASSERT_TRUE(tree.equal_range(make(lo)).second == upper);
+        for (int hi : { lo - 1, lo, lo + 1, lo + 2, lo + 9, lo + 2 * n }) {
+            vector<int> expected;
+            if (lo < hi) {
+                expected.assign(lower_bound(keys.begin(), keys.end(), lo),
+                                lower_bound(keys.begin(), keys.end(), hi));
+            }
+            vector<int> seen;
+            for (const auto &item : tree.range(make(lo), make(hi))) {
+                seen.push_back(key_of(item));
+            }
+            ASSERT_TRUE(seen == expected);
+            ASSERT_EQUAL(tree.count_range(make(lo), make(hi)), expected.size());
+        }
+    }
+}
+
+TEST(bound_and_range_queries){
+    BTree<int> ints;
+    check_range_queries(ints, 3000, [](int k) { return k; });
+    BTree<Wide> wides;
+    check_range_queries(wides, 300, [](int k) { return Wide(k); });
+    BTree<string, less<>> words;
+    words.emplace("apple");
+    words.emplace("cherry");
+    words.emplace("pear");
+    ASSERT_EQUAL(*words.lower_bound("banana"), "cherry");
+    ASSERT_EQUAL(*words.upper_bound("cherry"), "pear");
+    ASSERT_EQUAL(words.count_range("b", "q"), 2);
+    ASSERT_TRUE(words.range("q", "b").empty());
+}
+
+TEST(transparent_lookup){
+    BTree<string, less<>> tree;
+    tree.try_emplace("pear", "pear");
+    tree.emplace("apple");
+    ASSERT_EQUAL(*tree.find("pear"), "pear");
+    ASSERT_EQUAL(tree.rank("banana"), 1);
+    ASSERT_EQUAL(tree.erase("apple"), 1);
+    ASSERT_EQUAL(tree.size(), 1);
+}
+
+// Throws from its copy constructor once copies_left runs out.
+struct Fragile {
+    static int copies_left;
+    int value;
+    Fragile(int value_in) : value(value_in) {}
+    Fragile(const Fragile &other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw runtime_error("copy failed");
+        }
+    }
+    Fragile(Fragile &&other) noexcept : value(other.value) {}
+    bool operator<(const Fragile &rhs) const { return value < rhs.value; }
+};
+int Fragile::copies_left = 0;
+
+// EFFECTS: Returns whether calling f throws a runtime_error.
+template <typename F>
+static bool throws(F f) {
+    try {
+        f();
+    }
+    catch (const runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+TEST(failed_copy_leaves_tree_unchanged){
+    Fragile item(7);
+    BTree<Fragile> tree;
+    Fragile::copies_left = 0;
+    ASSERT_TRUE(throws([&]() { tree.try_insert(item); }));
+    ASSERT_TRUE(tree.empty());
+    for (int i = 0; i < 100; ++i) {
+        tree.try_insert(Fragile(i));
+    }
+    Fragile::copies_left = 50;
+    ASSERT_TRUE(throws([&]() { BTree<Fragile> copy(tree); }));
+    Fragile::copies_left = 10;
+    ASSERT_TRUE(throws([&]() { tree.assign_sorted(tree.begin(), tree.end()); }));
+    ASSERT_EQUAL(tree.size(), 100);
+    ASSERT_TRUE(tree.check_balance_invariant());
+}
+
+TEST(pool_allocator){
+    Pool_allocator<int> pool;
+    BTree<int, less<int>, Pool_allocator<int>> tree(pool);
+    for (int i = 0; i < 10000; ++i) {
+        tree.try_insert(i);
+    }
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_TRUE(pool.bytes_reserved() > 0);
+}
+
+TEST(random_insert_erase_vector_keys){
+    random_insert_erase<BTree<int64_t>>(5000, 20000);
+    random_insert_erase<BTree<double>>(5000, 20000);
+    random_insert_erase<BTree<int, less<>>>(5000, 20000);
+}
+
+// EFFECTS: Returns whether count_keys_less agrees with a plain count for
+//          strictly increasing arrays of every length up to 70, built from
+//          'values', queried with each key, the keys' neighbors in 'values',
+//          and the extremes of K.
+template <typename K>
+static bool count_keys_less_agrees(const vector<K> &values) {
+    K low = numeric_limits<K>::lowest();
+    K high = numeric_limits<K>::max();
+    for (size_t n = 0; n <= 70 && n <= values.size(); ++n) {
+        vector<K> keys(values.begin(), values.begin() + n);
+        vector<K> queries(values.begin(), values.end());
+        queries.push_back(low);
+        queries.push_back(high);
+        for (K query : queries) {
+            size_t expected = 0;
+            while (expected < n && keys[expected] < query) {
+                ++expected;
+            }
+            if (count_keys_less(keys.data(), n, query) != expected) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+TEST(count_keys_less_matches_scalar){
+    vector<int32_t> i32;
+    vector<int64_t> i64;
+    vector<float> f32;
+    vector<double> f64;
+    for (int i = -40; i < 40; ++i) {
+        i32.push_back(i * 1000003);
+        i64.push_back(static_cast<int64_t>(i) * (int64_t(1) << 40));
+        f32.push_back(i * 0.25f);
+        f64.push_back(i * 1e300 / 40);
+    }
+    i32.front() = numeric_limits<int32_t>::min();
+    i64.back() = numeric_limits<int64_t>::max();
+    f64.back() = numeric_limits<double>::infinity();
+    ASSERT_TRUE(count_keys_less_agrees(i32));
+    ASSERT_TRUE(count_keys_less_agrees(i64));
+    ASSERT_TRUE(count_keys_less_agrees(f32));
+    ASSERT_TRUE(count_keys_less_agrees(f64));
+}
+
+// Orders Records by key and declares the key as a search key, so a BTree
+// of Records searches its nodes without calling it.
+struct Record {
+    int64_t key;
+    string name;
+};
+static int record_compare_calls = 0;
+struct RecordLess {
+    using search_key_type = int64_t;
+    static int64_t search_key(const Record &record) { return record.key; }
+    bool operator()(const Record &a, const Record &b) const {
+        ++record_compare_calls;
+        return a.key < b.key;
+    }
+};
+
+TEST(search_keys_replace_comparator_calls){
+    BTree<Record, RecordLess> tree;
+    for (int i = 0; i < 2000; ++i) {
+        tree.try_insert(Record{ (i * 7919) % 2000, to_string(i) });
+    }
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    for (int i = 0; i < 2000; i += 3) {
+        tree.erase(Record{ i, "" });
+    }
+    ASSERT_TRUE(tree.check_balance_invariant());
+    BTree<Record, RecordLess> copy(tree);
+    record_compare_calls = 0;
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQUAL(copy.find(Record{ i, "" }) == copy.end(), i % 3 == 0);
+    }
+    ASSERT_EQUAL(record_compare_calls, 0);
+}
+
+TEST_MAIN()
@@ -15,16 +15,104 @@
  * for the private static member functions as directed.
  */
 
+#include "FrozenTree.hpp"
+#include "ForkJoin.hpp"
+#include "IteratorRange.hpp"
+#include "TreeStats.hpp"
+#include "TreeSerialize.hpp"
 #include <cassert>  //assert
 #include <iostream> //ostream
 #include <functional> //less
+#include <iterator> //iterator_traits, distance
 #include <algorithm>
+#include <atomic> //atomic
+#include <cstdlib> //abs
+#include <memory> //allocator, allocator_traits
+#include <type_traits>
+#include <utility> //pair, move, forward, in_place
 
 // You may add aditional libraries here if needed. You may use any
 // part of the STL except for containers.
 
+// BALANCING POLICIES
+// The Balance parameter of BinarySearchTree selects how the tree keeps
+// its shape as elements are inserted.
+//
+// Unbalanced:  elements are inserted as leaves and the tree is never
+//              restructured. Inserting sorted input produces a tree whose
+//              height equals its size.
+// AvlBalanced: after each insertion the tree performs AVL rotations so
+//              that the heights of the two subtrees of any node differ by
+//              at most one. The height stays O(log n) for any input order.
+struct Unbalanced {
+  static const bool self_balancing = false;
+};
+
+struct AvlBalanced {
+  static const bool self_balancing = true;
+};
+
+// A summary of the shape of a tree, for telling when searches have grown
+// slow because the tree has degraded rather than because it has grown.
+// Depths count nodes, as height does: the root is at depth 1.
+struct Tree_shape {
+  size_t size;
+  size_t height;
+  // The height of a perfectly balanced tree of the same size
+  size_t optimal_height;
+  // The average depth of an element, which is what a successful search
+  // visits on average
+  double mean_depth;
+  // The number of maximal runs of two or more nodes that each have only
+  // one child. Sorted insertions into an Unbalanced tree create these;
+  // an AVL tree never has any.
+  size_t degenerate_chains;
+
+  // EFFECTS: Returns height / optimal_height: 1 for a perfectly balanced
+  //          (or empty) tree, at most about 1.44 for an AVL tree, and up
+  //          to size / log2(size) for a degenerate one.
+  double height_ratio() const {
+    return optimal_height ? static_cast<double>(height) / optimal_height : 1;
+  }
+};
+
+// EFFECTS: Returns whether destroying 'alloc' returns every object that
+//          was allocated from it to the heap at once, as allocators with a
+//          releases_in_bulk() member report (see Pool_allocator in
+//          NodePool.hpp). Trees using such an allocator do not free their
+//          nodes one at a time on destruction when the elements need no
+//          destructor. Other allocators never release in bulk.
+template <typename Alloc>
+auto releases_in_bulk(const Alloc &alloc, int)
+    -> decltype(bool(alloc.releases_in_bulk())) {
+  return alloc.releases_in_bulk();
+}
+
+template <typename Alloc>
+bool releases_in_bulk(const Alloc &, long) {
+  return false;
+}
+
+// EFFECTS: Is true for std::allocator and for allocators that declare an
+//          allocates_concurrently member type of std::true_type: those
+//          that several threads may allocate from and free to at once.
+//          Only trees using such an allocator split work across threads
+//          (see BinarySearchTree::set_parallelism).
+template <typename Alloc, typename = void>
+struct allocates_concurrently : std::false_type { };
+
+template <typename Alloc>
+struct allocates_concurrently<
+    Alloc, std::void_t<typename Alloc::allocates_concurrently>>
+  : Alloc::allocates_concurrently { };
+
+template <typename U>
+struct allocates_concurrently<std::allocator<U>> : std::true_type { };
+
 template <typename T,
-          typename Compare=std::less<T> // default if argument isn't provided
+          typename Compare=std::less<T>, // default if argument isn't provided
+          typename Balance=Unbalanced,
+          typename Allocator=std::allocator<T>
          >
 class BinarySearchTree {
 
@@ -33,6 +121,7 @@ class BinarySearchTree {
   // between elements. The default is std::less<T>, which orders
   // according to the < operator on T. (For simplicity, we assume only
   // comparators that can be default constructed will be used.)
+  // Nodes are obtained from the Allocator, rebound to the node type.
 
   // INVARIANTS: All these invariants must hold for valid implementations
   // of BinarySearchTree. The invariants may also be considered as an implicit
@@ -61,52 +150,267 @@ class BinarySearchTree {
   // Compare functor. Note that "greater than or equal to" and
   // "greater than" end up meaning the same thing when duplicates are
   // not allowed.
-
-  // NOTE: Any operation you define must use RECURSION rather than iteration.
-  //       You may NOT use any looping constructs.
+  //
+  // INVARIANT: PARENT LINKS
+  // The parent pointer of the root is null, and the parent pointer of
+  // every other node points to the node that has it as a child.
+  //
+  // INVARIANT: BALANCE
+  // Every node records the height and size of the subtree rooted at it.
+  // If the Balance policy is self-balancing, the heights of the left and
+  // right subtrees of every node differ by at most one.
+
+  // INVARIANT: SHARING
+  // A tree made by share() shares the nodes of the original until one of
+  // them changes. Nodes that have been shared have a Share_count, which
+  // counts the trees sharing them; a tree with no Share_count owns its
+  // nodes alone. Before any change, and before a non-const member
+  // function hands out an Iterator through which an element may be
+  // changed, a tree that shares its nodes copies them and gives up its
+  // share (see detach).
+
+  // NOTE: Every operation runs in bounded stack space. Searches walk down
+  //       child links in a loop, and traversals, copying and destruction
+  //       move between nodes using child and parent links, so no
+  //       operation recurses to the depth of the tree.
 
 private:
 
-  // A Node stores an element and pointers to its left and right children
-  // DO NOT change this struct definition.
+  // A Node stores an element, pointers to its left and right children
+  // and to its parent (null for the root), and the height and size of
+  // the subtree rooted at it.
   struct Node {
 
     // Default constructor - does nothing
     Node() {}
 
-    // Custom constructor provided for convenience
-    Node(const T &datum_in, Node *left_in, Node *right_in)
-            : datum(datum_in), left(left_in), right(right_in) { }
+    // Constructs a leaf whose datum is built in place from args
+    template <typename... Args>
+    explicit Node(std::in_place_t, Args &&...args)
+            : datum(std::forward<Args>(args)...), left(nullptr),
+              right(nullptr), parent(nullptr), size(1), path_length(0),
+              height(1), chains(0) { }
 
     T datum;
     Node *left;
     Node *right;
+    Node *parent;
+    size_t size;
+    // The sum of the depths of the nodes of this subtree below this node
+    size_t path_length;
+    int height;
+    // The number of degenerate chains in this subtree (see Tree_shape)
+    int chains;
+  };
+
+  // The number of trees sharing one set of nodes. The count is atomic so
+  // that trees sharing nodes may be copied, changed and destroyed from
+  // different threads.
+  struct Share_count {
+    Share_count()
+      : trees(1) { }
+
+    std::atomic<size_t> trees;
   };
 
+  using Node_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+  using Node_traits = std::allocator_traits<Node_allocator>;
+
 public:
 
   // Default constructor
   // (Note this will default construct the less comparator)
   BinarySearchTree()
-    : root(nullptr) { }
+    : root(nullptr), sharers(nullptr), workers(1), height_factor(0) { }
+
+  // Constructs an empty tree whose nodes come from alloc_in
+  explicit BinarySearchTree(const Allocator &alloc_in)
+    : root(nullptr), sharers(nullptr), workers(1), height_factor(0),
+      alloc(alloc_in) { }
+
+  // Range constructor
+  // (Note a range of forward iterators that is strictly increasing is
+  // built into a perfectly balanced tree in linear time, as by
+  // assign_sorted. Any other range is inserted one element at a time, and
+  // elements equivalent to an earlier one are skipped.)
+  template <typename Iter,
+            typename = typename std::iterator_traits<Iter>::iterator_category>
+  BinarySearchTree(Iter first, Iter last,
+                   const Allocator &alloc_in = Allocator())
+    : root(nullptr), sharers(nullptr), workers(1), height_factor(0),
+      alloc(alloc_in) {
+    assign_range(first, last,
+                 typename std::iterator_traits<Iter>::iterator_category());
+  }
 
   // Copy constructor
+  // (Note the copy has nodes of its own, so Iterators and references into
+  // either tree change only that tree. See share() for a copy that runs
+  // in constant time.)
   BinarySearchTree(const BinarySearchTree &other)
-    : root(copy_nodes_impl(other.root)) { }
+    : root(nullptr), sharers(nullptr), workers(other.workers),
+      height_factor(other.height_factor),
+      alloc(Node_traits::select_on_container_copy_construction(other.alloc)) {
+    adopt_nodes(copy_nodes_parallel_impl(other.root, alloc, usable_workers()));
+  }
+
+  // Move constructor
+  // (Note the nodes of other are taken over without copying, and other is
+  // left empty. Iterators into other remain valid but must not be
+  // decremented from past-the-end.)
+  BinarySearchTree(BinarySearchTree &&other) noexcept
+    : root(other.root), sharers(other.sharers.load(std::memory_order_relaxed)),
+      workers(other.workers), height_factor(other.height_factor),
+      alloc(other.alloc) {
+    other.root = nullptr;
+    other.sharers.store(nullptr, std::memory_order_relaxed);
+  }
 
   // Assignment operator
+  // (Note this copies the nodes of rhs, as the copy constructor does, and
+  // takes on its parallelism and rebalance factor.)
   BinarySearchTree &operator=(const BinarySearchTree &rhs) {
     if (this == &rhs) {
       return *this;
     }
-    destroy_nodes_impl(root);
-    root = copy_nodes_impl(rhs.root);
+    Node *copy = copy_nodes_parallel_impl(rhs.root, alloc, usable_workers());
+    release_nodes(true);
+    adopt_nodes(copy);
+    workers = rhs.workers;
+    height_factor = rhs.height_factor;
+    return *this;
+  }
+
+  // Move assignment operator
+  // (Note the nodes of rhs are taken over when both trees can free each
+  // other's nodes; otherwise they are copied with this tree's allocator.
+  // rhs is left empty either way. This tree takes on the parallelism and
+  // rebalance factor of rhs.)
+  BinarySearchTree &operator=(BinarySearchTree &&rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    release_nodes(true);
+    workers = rhs.workers;
+    height_factor = rhs.height_factor;
+    if (Node_traits::propagate_on_container_move_assignment::value) {
+      alloc = rhs.alloc;
+    }
+    if (alloc == rhs.alloc) {
+      std::swap(root, rhs.root);
+      sharers.store(rhs.sharers.exchange(nullptr, std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+    }
+    else {
+      adopt_nodes(copy_nodes_parallel_impl(rhs.root, alloc, usable_workers()));
+      rhs.release_nodes(true);
+    }
     return *this;
   }
 
   // Destructor
+  // (Note the nodes are freed only if no other tree shares them. If the
+  // elements need no destructor and destroying this tree's allocator
+  // releases all of its memory, the nodes are left for the allocator to
+  // reclaim rather than being visited one by one.)
   ~BinarySearchTree() {
-    destroy_nodes_impl(root);
+    release_nodes(!std::is_trivially_destructible<T>::value
+                  || !releases_in_bulk(alloc, 0));
+  }
+
+  // REQUIRES: Iterators and references into this tree obtained before
+  //           the call, and Iterators returned by the const member
+  //           functions of either tree, are not used to change elements.
+  // EFFECTS : Returns a copy of this tree in constant time. The copy
+  //           shares the nodes of this tree until either tree changes,
+  //           and the one that changes first copies them then. Nodes are
+  //           copied right away only if the two allocators cannot free
+  //           each other's nodes.
+  BinarySearchTree share() const {
+    BinarySearchTree copy(
+        Node_traits::select_on_container_copy_construction(alloc));
+    copy.workers = workers;
+    copy.height_factor = height_factor;
+    copy.share_or_copy(*this);
+    return copy;
+  }
+
+  // EFFECTS: Returns a copy of the allocator used by this tree.
+  Allocator get_allocator() const {
+    return Allocator(alloc);
+  }
+
+  // REQUIRES: Different elements may be copied, destroyed and compared on
+  //           different threads at the same time.
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Lets this tree use up to 'threads' threads (0 meaning one
+  //           per hardware thread) to copy its nodes (see detach), free
+  //           them, and build it in assign_unsorted. Only subtrees of
+  //           many thousands of nodes are handed to another thread.
+  //           The default is 1. Trees copied or assigned from this one
+  //           take on its setting.
+  // NOTE:     A tree whose allocator is not known to be thread-safe (see
+  //           allocates_concurrently) still sorts with these threads, but
+  //           does all its allocation on one.
+  void set_parallelism(size_t threads) {
+    if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
+    }
+    workers = threads > 0 ? threads : 1;
+  }
+
+  // EFFECTS: Returns the number of threads this tree may use (see
+  //          set_parallelism).
+  size_t parallelism() const {
+    return workers;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Rearranges the nodes of this tree into a perfectly balanced
+  //           shape (the height is the number of bits in size()), in O(n)
+  //           time, by the Day-Stout-Warren algorithm: rotations turn the
+  //           tree into a sorted list and then fold the list back up.
+  //           Allocates nothing and moves no elements, so iterators,
+  //           pointers and references to elements stay valid. Unless
+  //           another tree shares this tree's nodes (see share), in which
+  //           case they are first copied.
+  void rebalance() {
+    detach();
+    if (root) {
+      rebuild_subtree(root);
+    }
+  }
+
+  // REQUIRES: factor == 0 or factor > 1
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Makes insertions keep the height of this tree within
+  //           'factor' times the height of a perfectly balanced tree of the
+  //           same size, or stops doing so if factor is 0 (the default).
+  //           When an insertion makes the tree too tall, the smallest
+  //           subtree above the new element that is itself too tall for its
+  //           size is rebalanced in place, as by rebalance(), and then any
+  //           ancestor still too tall, so the tree is back within bounds.
+  //           If the tree is already too tall, it is rebalanced now.
+  //           Trees copied or assigned from this one take on its
+  //           setting.
+  // NOTE:     Rebuilding only a subtree keeps ordered insertions at
+  //           O(log n) amortized each, as in a scapegoat tree, instead of
+  //           the O(n / log n) that rebuilding the whole tree would cost.
+  //           Has no effect on self-balancing trees, whose height is
+  //           already within 1.45 times the optimum.
+  void set_rebalance_factor(double factor) {
+    assert(factor == 0 || factor > 1);
+    height_factor = factor;
+    if (root && too_tall(root)) {
+      rebalance();
+    }
+  }
+
+  // EFFECTS: Returns the height limit that insertions keep (see
+  //          set_rebalance_factor), or 0 if there is none.
+  double rebalance_factor() const {
+    return height_factor;
   }
 
   // EFFECTS: Returns whether this BinarySearchTree is empty.
@@ -120,8 +424,26 @@ public:
   }
 
   // EFFECTS: Returns the number of elements in this BinarySearchTree.
+  // NOTE:    The root records the size of the whole tree, so this
+  //          function runs in constant time.
   size_t size() const {
-    return static_cast<size_t>(size_impl(root));
+    return node_size_impl(root);
+  }
+
+  // EFFECTS: Returns the height, mean element depth and number of
+  //          degenerate chains of this tree (see Tree_shape).
+  // NOTE:    Every node records these for its subtree, alongside its size
+  //          and height, so this function runs in constant time.
+  Tree_shape shape() const {
+    Tree_shape result;
+    result.size = size();
+    result.height = height();
+    result.optimal_height = bit_width_impl(result.size);
+    result.mean_depth = result.size
+        ? 1 + static_cast<double>(node_path_length_impl(root)) / result.size
+        : 0;
+    result.degenerate_chains = static_cast<size_t>(node_chains_impl(root));
+    return result;
   }
 
   // EFFECTS: Traverses the tree using an in-order traversal,
@@ -133,6 +455,47 @@ public:
     traverse_inorder_impl(root, os);
   }
 
+  // MODIFIES: os
+  // EFFECTS : Writes this tree to os as a binary snapshot of its elements
+  //           in sorted order, each encoded by Binary_codec<T> (see
+  //           TreeSerialize.hpp). Open file streams in binary mode.
+  void save(std::ostream &os) const {
+    size_t bytes = Binary_codec<T>::fixed_size
+                   ? size() * Binary_codec<T>::fixed_size
+                   : encoded_size_impl(root);
+    std::unique_ptr<char[]> payload(new char[bytes]);
+    encode_impl(root, payload.get());
+    Snapshot_header header = make_snapshot_header<T>(size(), payload.get(),
+                                                     bytes);
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    os.write(payload.get(), static_cast<std::streamsize>(bytes));
+  }
+
+  // MODIFIES: this BinarySearchTree, is
+  // EFFECTS : Replaces the contents of this tree with the elements of the
+  //           snapshot that save wrote to is, arranged as a perfectly
+  //           balanced tree in linear time. Returns false, leaving this
+  //           tree unchanged, if is does not hold an intact snapshot of
+  //           elements of type T in strictly increasing order according to
+  //           Compare. If decoding or copying an element throws, this tree
+  //           is left unchanged.
+  bool load(std::istream &is) {
+    Snapshot_payload<T> snapshot(is);
+    if (!snapshot.valid()) {
+      return false;
+    }
+    Byte_reader in = snapshot.reader();
+    Node *built = build_sorted_impl(Decoding_iterator<T>(in), snapshot.count(),
+                                    alloc);
+    if (!in.finished() || !check_sorting_invariant_impl(built, less)) {
+      destroy_nodes_impl(built, alloc);
+      return false;
+    }
+    release_nodes(true);
+    adopt_nodes(built);
+    return true;
+  }
+
   // EFFECTS: Traverses the tree using a pre-order traversal,
   //          printing each element to os in turn. Each element is followed
   //          by a space (there will be an "extra" space at the end).
@@ -145,30 +508,75 @@ public:
   // EFFECTS: Returns whether or not the sorting invariant holds on
   //          the root of this BinarySearchTree.
   //
-  // NOTE: This function must be recursive.
   bool check_sorting_invariant() const {
     return check_sorting_invariant_impl(root, less);
   }
 
-  class Iterator {
+  // EFFECTS: Returns how many searches from the root this tree has made
+  //          since it was created or reset_stats was last called, with
+  //          their comparisons, the nodes they visited, and a histogram
+  //          of how deep they went. Walks that need no search (iteration,
+  //          copies, set operations) are not counted. All zero unless
+  //          compiled with TREE_STATS=1 (see TreeStats.hpp).
+  Search_stats stats() const {
+    return counters.snapshot();
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Sets the counts that stats reports back to zero.
+  void reset_stats() {
+    counters.reset();
+  }
+
+  // EFFECTS: Returns whether or not the balance invariant holds on
+  //          the root of this BinarySearchTree. The recorded height, size
+  //          and parent of every node must be correct, and if the Balance
+  //          policy is self-balancing, no node may have subtrees whose
+  //          heights differ by more than one.
+  bool check_balance_invariant() const {
+    return (!root || !root->parent) && check_balance_invariant_impl(root);
+  }
+
+  template <typename Element>
+  class Tree_iterator {
     // OVERVIEW: Iterator interface for BinarySearchTree.
     //           Iterates over the elements in ascending order as defined
     //           by the sorted ordering of the BinarySearchTree.
 
+    //           Iterators follow parent pointers, so stepping in either
+    //           direction does no comparisons and a full traversal
+    //           visits each node a constant number of times.
+
+    //           Element is T for an Iterator, through which elements may
+    //           be changed, and const T for a Const_iterator, which
+    //           cbegin, cend, cfind and the const range queries return.
+
     // Big Three for Iterator not needed
 
   public:
-    Iterator()
-      : root(nullptr), current_node(nullptr) {}
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Element *;
+    using reference = Element &;
+
+    Tree_iterator()
+      : tree(nullptr), current_node(nullptr) {}
+
+    // Converts an Iterator to a Const_iterator
+    template <typename Other, typename = std::enable_if_t<
+                  std::is_same<Element, const Other>::value>>
+    Tree_iterator(const Tree_iterator<Other> &other)
+      : tree(other.tree), current_node(other.current_node) { }
 
     // EFFECTS:  Returns the current element by reference.
-    // WARNING:  Dereferencing an iterator returns an element from the tree
+    // WARNING:  Dereferencing an Iterator returns an element from the tree
     //           by reference, which could be modified. It is the
     //           responsibility of the user to ensure that any
     //           modifications result in a new value that compares equal
     //           to the existing value. Otherwise, the sorting invariant
     //           will no longer hold.
-    T &operator*() const {
+    Element &operator*() const {
       return current_node->datum;
     }
 
@@ -185,77 +593,145 @@ public:
     //             auto it = tree.insert({ 3, 4.1 });
     //             cout << it->first << endl; // prints 3
     //             cout << it->second << endl; // prints 4.1
-    T *operator->() const {
+    Element *operator->() const {
       return &current_node->datum;
     }
 
     // Prefix ++
-    Iterator &operator++() {
+    Tree_iterator &operator++() {
       if (current_node->right) {
         // If has right child, next element is minimum of right subtree
         current_node = min_element_impl(current_node->right);
       }
       else {
-        // Otherwise, look in the whole tree for the next biggest element
-        current_node = min_greater_than_impl(root, current_node->datum, less);
+        // Otherwise, the next element is the closest ancestor that has
+        // the current node in its left subtree
+        current_node = successor_ancestor_impl(current_node);
       }
       return *this;
     }
 
     // Postfix ++ (implemented in terms of prefix ++)
-    Iterator operator++(int) {
-      Iterator result(*this);
+    Tree_iterator operator++(int) {
+      Tree_iterator result(*this);
       ++(*this);
       return result;
     }
 
-    bool operator==(const Iterator &rhs) const {
+    // Prefix --
+    // REQUIRES: this Iterator does not refer to the minimum element, and
+    //           if it is an end Iterator, it was obtained from a tree.
+    Tree_iterator &operator--() {
+      if (!current_node) {
+        // Stepping back from past-the-end yields the maximum element
+        current_node = max_element_impl(tree->root);
+      }
+      else if (current_node->left) {
+        // If has left child, previous element is maximum of left subtree
+        current_node = max_element_impl(current_node->left);
+      }
+      else {
+        // Otherwise, the previous element is the closest ancestor that
+        // has the current node in its right subtree
+        current_node = predecessor_ancestor_impl(current_node);
+      }
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Tree_iterator operator--(int) {
+      Tree_iterator result(*this);
+      --(*this);
+      return result;
+    }
+
+    // An Iterator and a Const_iterator may be compared with each other
+    template <typename Other>
+    bool operator==(const Tree_iterator<Other> &rhs) const {
       return current_node == rhs.current_node;
     }
 
-    bool operator!=(const Iterator &rhs) const {
+    template <typename Other>
+    bool operator!=(const Tree_iterator<Other> &rhs) const {
       return current_node != rhs.current_node;
     }
 
   private:
     friend class BinarySearchTree;
+    template <typename> friend class Tree_iterator;
 
-    Node *root;
+    const BinarySearchTree *tree;
     Node *current_node;
-    Compare less;
 
-    Iterator(Node *root_in, Node* current_node_in, Compare less_in)
-      : root(root_in), current_node(current_node_in), less(less_in) { }
+    Tree_iterator(const BinarySearchTree *tree_in, Node* current_node_in)
+      : tree(tree_in), current_node(current_node_in) { }
 
-  }; // BinarySearchTree::Iterator
+  }; // BinarySearchTree::Tree_iterator
   ////////////////////////////////////////
 
+  // An iterator through which elements may be changed
+  using Iterator = Tree_iterator<T>;
+
+  // An iterator through which elements may only be read
+  using Const_iterator = Tree_iterator<const T>;
+
+  // A view of the elements in an interval (see range)
+  using Range = Iterator_range<Iterator>;
+  using Const_range = Iterator_range<Const_iterator>;
 
   // EFFECTS : Returns an iterator to the first element in this
   //           BinarySearchTree or an end Iterator if the tree is empty.
+  // NOTE:     On a non-const tree, this and the other functions returning
+  //           an Iterator to an element first stop sharing nodes with any
+  //           tree made by share(), since the Iterator may be used to
+  //           change the element. To only read a shared tree, use cbegin,
+  //           cend and cfind: these return a Const_iterator, through
+  //           which elements cannot be changed, and keep sharing.
   Iterator begin() const {
-    if (root == nullptr) {
-      return Iterator();
-    }
-    return Iterator(root, min_element_impl(root), less);
+    return Iterator(this, min_element_impl(root));
+  }
+
+  Iterator begin() {
+    detach();
+    return std::as_const(*this).begin();
   }
 
   // EFFECTS: Returns an iterator to past-the-end.
   Iterator end() const {
-    return Iterator();
+    return Iterator(this, nullptr);
+  }
+
+  // EFFECTS: Same as begin() and end(), but return a Const_iterator and
+  //          never stop sharing nodes (see begin).
+  Const_iterator cbegin() const {
+    return begin();
+  }
+
+  Const_iterator cend() const {
+    return end();
   }
 
 
   // EFFECTS: Returns an Iterator to the minimum element in this
   //          BinarySearchTree or an end Iterator if the tree is empty.
   Iterator min_element() const {
-    return Iterator(root, min_element_impl(root), less);
+    return Iterator(this, min_element_impl(root));
+  }
+
+  Iterator min_element() {
+    detach();
+    return std::as_const(*this).min_element();
   }
 
   // EFFECTS: Returns an Iterator to the maximum element in this
   //          BinarySearchTree or an end Iterator if the tree is empty.
   Iterator max_element() const {
-    return Iterator(root, max_element_impl(root), less);
+    return Iterator(this, max_element_impl(root));
+  }
+
+  Iterator max_element() {
+    detach();
+    return std::as_const(*this).max_element();
   }
 
   // EFFECTS: Returns an Iterator to the minimum element in this
@@ -263,9 +739,189 @@ public:
   //          If the tree is empty or if no element is greater than
   //          the given value, returns an end Iterator.
   Iterator min_greater_than(const T &value) const {
-    return Iterator(root, min_greater_than_impl(root, value, less), less);
+    return Iterator(this, min_greater_than_impl(root, value, searcher()));
+  }
+
+  Iterator min_greater_than(const T &value) {
+    detach();
+    return std::as_const(*this).min_greater_than(value);
+  }
+
+  // EFFECTS: Returns an Iterator to the minimum element in this
+  //          BinarySearchTree that is not less than the given value, or
+  //          an end Iterator if there is none.
+  Const_iterator lower_bound(const T &value) const {
+    return Const_iterator(this, lower_bound_impl(root, value, searcher()));
+  }
+
+  Iterator lower_bound(const T &value) {
+    detach();
+    return as_mutable(std::as_const(*this).lower_bound(value));
+  }
+
+  // EFFECTS: Same as lower_bound(const T &), but compares elements
+  //          directly against a value of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_iterator lower_bound(const K &value) const {
+    return Const_iterator(this, lower_bound_impl(root, value, searcher()));
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K &value) {
+    detach();
+    return as_mutable(std::as_const(*this).lower_bound(value));
+  }
+
+  // EFFECTS: Returns an Iterator to the minimum element in this
+  //          BinarySearchTree that is greater than the given value, or an
+  //          end Iterator if there is none (the same as min_greater_than).
+  Const_iterator upper_bound(const T &value) const {
+    return Const_iterator(this,
+                          min_greater_than_impl(root, value, searcher()));
+  }
+
+  Iterator upper_bound(const T &value) {
+    detach();
+    return as_mutable(std::as_const(*this).upper_bound(value));
+  }
+
+  // EFFECTS: Same as upper_bound(const T &), but compares elements
+  //          directly against a value of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_iterator upper_bound(const K &value) const {
+    return Const_iterator(this,
+                          min_greater_than_impl(root, value, searcher()));
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K &value) {
+    detach();
+    return as_mutable(std::as_const(*this).upper_bound(value));
+  }
+
+  // EFFECTS: Returns the pair of lower_bound(value) and upper_bound(value),
+  //          which bound the element equivalent to value if there is one,
+  //          and are equal otherwise. Takes a single descent.
+  std::pair<Const_iterator, Const_iterator>
+  equal_range(const T &value) const {
+    return equal_range_key(value);
+  }
+
+  std::pair<Iterator, Iterator> equal_range(const T &value) {
+    detach();
+    return as_mutable(std::as_const(*this).equal_range(value));
+  }
+
+  // EFFECTS: Same as equal_range(const T &), but compares elements
+  //          directly against a value of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Const_iterator, Const_iterator>
+  equal_range(const K &value) const {
+    return equal_range_key(value);
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const K &value) {
+    detach();
+    return as_mutable(std::as_const(*this).equal_range(value));
+  }
+
+  // EFFECTS: Returns a view of the elements that are not less than lo
+  //          and are less than hi, in ascending order. The view is empty
+  //          if hi is not greater than lo.
+  // NOTE:    Finding the ends of the view takes O(height), and stepping
+  //          through its k elements O(k) more, since the Iterator moves
+  //          along parent links rather than searching from the root.
+  Const_range range(const T &lo, const T &hi) const {
+    return range_key(lo, hi);
+  }
+
+  Range range(const T &lo, const T &hi) {
+    detach();
+    return as_mutable(std::as_const(*this).range(lo, hi));
+  }
+
+  // EFFECTS: Same as range(const T &, const T &), but compares elements
+  //          directly against bounds of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_range range(const K &lo, const K &hi) const {
+    return range_key(lo, hi);
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Range range(const K &lo, const K &hi) {
+    detach();
+    return as_mutable(std::as_const(*this).range(lo, hi));
   }
 
+  // EFFECTS: Returns the number of elements that are not less than lo
+  //          and are less than hi (0 if hi is not greater than lo).
+  // NOTE:    Runs in O(height) using the recorded subtree sizes, without
+  //          visiting the elements.
+  size_t count_range(const T &lo, const T &hi) const {
+    return count_range_key(lo, hi);
+  }
+
+  // EFFECTS: Same as count_range(const T &, const T &), but compares
+  //          elements directly against bounds of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t count_range(const K &lo, const K &hi) const {
+    return count_range_key(lo, hi);
+  }
+
+
+  // EFFECTS: Returns an Iterator to the element that has exactly k
+  //          elements less than it in this BinarySearchTree (so k = 0 is
+  //          the minimum). Returns an end Iterator if k >= size().
+  // NOTE:    Runs in O(height) using the recorded subtree sizes.
+  Const_iterator nth_element(size_t k) const {
+    return Const_iterator(this, nth_element_impl(root, k));
+  }
+
+  Iterator nth_element(size_t k) {
+    detach();
+    return as_mutable(std::as_const(*this).nth_element(k));
+  }
+
+  // EFFECTS: Returns the number of elements in this BinarySearchTree that
+  //          are less than the given value. If value is in the tree, this
+  //          is its position in sorted order, so nth_element(rank(value))
+  //          finds it again.
+  // NOTE:    Runs in O(height) using the recorded subtree sizes.
+  size_t rank(const T &value) const {
+    return rank_impl(root, value, searcher());
+  }
+
+  // EFFECTS: Same as rank(const T &), but compares elements directly
+  //          against a value of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t rank(const K &value) const {
+    return rank_impl(root, value, searcher());
+  }
+
+  // EFFECTS: Returns an immutable snapshot of the elements of this tree,
+  //          laid out for fast read-only lookup (see FrozenTree.hpp).
+  //          Runs in linear time. Later changes to this tree do not
+  //          affect the snapshot.
+  FrozenTree<T, Compare> freeze() const {
+    return FrozenTree<T, Compare>(begin(), end());
+  }
 
   // EFFECTS: Searches this tree for an element equivalent to query.
   //          Returns an iterator to the existing element if found,
@@ -277,7 +933,43 @@ public:
   //          to the existing value. Otherwise, the sorting invariant
   //          will no longer hold.
   Iterator find(const T &query) const {
-    return Iterator(root, find_impl(root, query, less), less);
+    return Iterator(this, find_impl(root, query, searcher()));
+  }
+
+  Iterator find(const T &query) {
+    detach();
+    return std::as_const(*this).find(query);
+  }
+
+  // EFFECTS: Same as find(const T &), but compares elements directly
+  //          against a query of another type K, so no T needs to be
+  //          constructed for the lookup.
+  // NOTE:    Only available when Compare defines is_transparent, which
+  //          declares that it can compare T with other types consistently
+  //          with the ordering of T.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return Iterator(this, find_impl(root, query, searcher()));
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) {
+    detach();
+    return std::as_const(*this).find(query);
+  }
+
+  // EFFECTS: Same as find, but returns a Const_iterator and never stops
+  //          sharing nodes (see begin).
+  Const_iterator cfind(const T &query) const {
+    return find(query);
+  }
+
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Const_iterator cfind(const K &query) const {
+    return find(query);
   }
 
   // REQUIRES: The given item is not already contained in this BinarySearchTree
@@ -285,9 +977,304 @@ public:
   // EFFECTS : Inserts the element k into this BinarySearchTree, maintaining the
   //           sorting invariant. Returns an iterator to the newly inserted element.
   Iterator insert(const T &item) {
-    assert(find(item) == end());
-    root = insert_impl(root, item, less);
-    return find(item);
+    std::pair<Iterator, bool> result = try_insert(item);
+    assert(result.second);
+    return result.first;
+  }
+
+  // REQUIRES: The given item is not already contained in this BinarySearchTree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as insert(const T &), but moves item into the new node.
+  Iterator insert(T &&item) {
+    std::pair<Iterator, bool> result = try_insert(std::move(item));
+    assert(result.second);
+    return result.first;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : If an element equivalent to item is already in this
+  //           BinarySearchTree, returns an Iterator to it along with the
+  //           value false. Otherwise, inserts item, maintaining the sorting
+  //           invariant, and returns an Iterator to the new element along
+  //           with the value true.
+  // NOTE:     Both cases are handled in a single descent from the root.
+  std::pair<Iterator, bool> try_insert(const T &item) {
+    return try_emplace(item, item);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as try_insert(const T &), but moves item into the new
+  //           node. If an equivalent element exists, item is not moved from.
+  std::pair<Iterator, bool> try_insert(T &&item) {
+    // item is only moved from after the descent is done comparing it
+    return try_emplace(item, std::move(item));
+  }
+
+  // REQUIRES: key is a T, or Compare is transparent and can compare key
+  //           with elements of this tree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : If an element equivalent to key is already in this
+  //           BinarySearchTree, returns an Iterator to it along with the
+  //           value false, and args are left untouched. Otherwise,
+  //           constructs a new element in place from args, which must be
+  //           equivalent to key, and returns an Iterator to it along with
+  //           the value true.
+  // NOTE:     Both cases are handled in a single descent from the root.
+  template <typename K, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const K &key, Args &&...args) {
+    detach();
+    size_t old_size = size();
+    auto make = [&]() {
+      return new_node_impl(alloc, std::forward<Args>(args)...);
+    };
+    Node *node = insert_impl(root, key, searcher(), make);
+    bool inserted = size() != old_size;
+    if (inserted) {
+      limit_height(node);
+    }
+    return std::pair<Iterator, bool>(Iterator(this, node), inserted);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Constructs an element in place from args. If an equivalent
+  //           element is already in this BinarySearchTree, the new element
+  //           is destroyed and an Iterator to the existing one is returned
+  //           along with the value false. Otherwise, the new element is
+  //           linked into the tree and returned along with the value true.
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args &&...args) {
+    detach();
+    Node *fresh = new_node_impl(alloc, std::forward<Args>(args)...);
+    auto make = [fresh]() {
+      return fresh;
+    };
+    Node *node = insert_impl(root, fresh->datum, searcher(), make);
+    if (node != fresh) {
+      delete_node_impl(fresh, alloc);
+    }
+    else {
+      limit_height(node);
+    }
+    return std::pair<Iterator, bool>(Iterator(this, node), node == fresh);
+  }
+
+  // REQUIRES: [first, last) is strictly increasing according to Compare
+  //           (in particular, it holds no two equivalent elements)
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Replaces the contents of this tree with copies of the
+  //           elements in [first, last), arranged as a perfectly balanced
+  //           tree. Runs in linear time and makes no comparisons (except
+  //           to check the requirement in debug builds). If copying an
+  //           element throws, this tree is left unchanged.
+  template <typename Forward_iterator>
+  void assign_sorted(Forward_iterator first, Forward_iterator last) {
+    assert(is_strictly_sorted_impl(first, last, less));
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    Node *built = build_sorted_impl(first, n, alloc);
+    release_nodes(true);
+    adopt_nodes(built);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Replaces the contents of this tree with copies of the
+  //           elements in [first, last), which may be in any order. Of
+  //           equivalent elements, only the earliest is kept. Pointers to
+  //           the elements are sorted and the tree is then built perfectly
+  //           balanced from them, both split across the threads allowed by
+  //           set_parallelism, in O(n log n) time overall. If copying an
+  //           element throws, this tree is left unchanged.
+  template <typename Forward_iterator>
+  void assign_unsorted(Forward_iterator first, Forward_iterator last) {
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    std::unique_ptr<const T *[]> order(new const T *[n]);
+    for (size_t i = 0; i < n; ++i, ++first) {
+      order[i] = &*first;
+    }
+    sort_pointers_impl(order.get(), n, less, workers);
+    const T **unique_end = std::unique(order.get(), order.get() + n,
+                                       [this](const T *a, const T *b) {
+                                         return !less(*a, *b);
+                                       });
+    Node *built = build_sorted_parallel_impl(
+        order.get(), static_cast<size_t>(unique_end - order.get()), alloc,
+        usable_workers());
+    release_nodes(true);
+    adopt_nodes(built);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Adds copies of the elements of other that have no equivalent
+  //           in this tree. Where both trees hold equivalent elements,
+  //           this tree's element is kept. If copying an element throws,
+  //           this tree is left unchanged, unless other is much smaller
+  //           (see below), in which case some elements may have been added.
+  // NOTE:     If other is much smaller than this tree, its elements are
+  //           inserted one at a time in O(m log n). Otherwise the two
+  //           trees are merged in sorted order in O(n + m) and this tree
+  //           is relinked perfectly balanced from its own nodes and the
+  //           new ones. Either way, iterators to elements of this tree
+  //           stay valid.
+  void union_with(const BinarySearchTree &other) {
+    if (&other == this) {
+      return;
+    }
+    detach();
+    if (few_against_impl(other.size(), size())) {
+      for (const T &item : other) {
+        try_insert(item);
+      }
+      return;
+    }
+    size_t total = size() + other.size();
+    std::unique_ptr<Node *[]> merged(new Node *[total]);
+    std::unique_ptr<Node *[]> added(new Node *[other.size()]);
+    size_t copies = 0;
+    size_t count = 0;
+    try {
+      auto copy_new = [&](Node *theirs, bool dup) -> Node * {
+        if (dup) {
+          return nullptr;
+        }
+        added[copies] = clone_element_impl(theirs, alloc);
+        return added[copies++];
+      };
+      count = merge_nodes(other.root, merged.get(), copy_new);
+    }
+    catch (...) {
+      for (size_t i = 0; i < copies; ++i) {
+        delete_node_impl(added[i], alloc);
+      }
+      throw;
+    }
+    root = relink_sorted_impl(merged.get(), count);
+  }
+
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS : Moves the elements of other that have no equivalent in this
+  //           tree into it, and leaves other empty. Where both trees hold
+  //           equivalent elements, this tree's element is kept and other's
+  //           is destroyed. The nodes of other are relinked into this tree
+  //           rather than copied, when the two allocators are equal and no
+  //           other tree shares them; otherwise this is union_with
+  //           followed by emptying other. Runs in the same time as
+  //           union_with, and iterators to elements of this tree stay
+  //           valid.
+  void merge(BinarySearchTree &&other) {
+    if (&other == this) {
+      return;
+    }
+    if (!(alloc == other.alloc) || other.shares_nodes()) {
+      union_with(other);
+      other.release_nodes(true);
+      return;
+    }
+    detach();
+    if (few_against_impl(other.size(), size())) {
+      splice_each(other);
+      return;
+    }
+    size_t total = size() + other.size();
+    std::unique_ptr<Node *[]> merged(new Node *[total]);
+    size_t dups = 0;
+    // Other's duplicates fill 'merged' from the back, to be freed below
+    auto take_new = [&](Node *theirs, bool dup) -> Node * {
+      if (dup) {
+        merged[total - ++dups] = theirs;
+        return nullptr;
+      }
+      return theirs;
+    };
+    size_t count = merge_nodes(other.root, merged.get(), take_new);
+    for (size_t i = total - dups; i < total; ++i) {
+      delete_node_impl(merged[i], alloc);
+    }
+    root = relink_sorted_impl(merged.get(), count);
+    other.release_nodes(false);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the elements of this tree that have no equivalent in
+  //           other. Runs in O(n log m) if this tree is much smaller than
+  //           other, and in O(n + m) otherwise; this tree is then relinked
+  //           perfectly balanced. Iterators to the remaining elements stay
+  //           valid.
+  void intersect_with(const BinarySearchTree &other) {
+    if (&other != this) {
+      detach();
+      retain(other, true);
+    }
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the elements of this tree that have an equivalent in
+  //           other. Runs in O(m log n) if other is much smaller than this
+  //           tree (erasing its elements one at a time), and otherwise as
+  //           intersect_with does. Iterators to the remaining elements
+  //           stay valid.
+  void difference_with(const BinarySearchTree &other) {
+    if (&other == this) {
+      release_nodes(true);
+      return;
+    }
+    detach();
+    if (few_against_impl(other.size(), size())) {
+      for (const T &item : other) {
+        erase_key(item);
+      }
+      return;
+    }
+    retain(other, false);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the element equivalent to value, if there is one.
+  //           Returns the number of elements removed (0 or 1).
+  // NOTE:     Iterators to other elements remain valid.
+  size_t erase(const T &value) {
+    return erase_key(value);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as erase(const T &), but compares elements directly
+  //           against a value of another type K.
+  // NOTE:     Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  size_t erase(const K &value) {
+    return erase_key(value);
+  }
+
+  // REQUIRES: pos refers to an element of this BinarySearchTree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the element at pos and returns an Iterator to the
+  //           element that followed it (or an end Iterator).
+  // NOTE:     Only pos is invalidated. Nodes are relinked rather than
+  //           having their elements moved, so iterators and references to
+  //           other elements remain valid (unless this tree was sharing
+  //           its nodes with a copy, in which case it now has nodes of its
+  //           own and all earlier iterators refer to the copy's).
+  Iterator erase(Const_iterator pos) {
+    Node *node = detach_keeping(pos.current_node);
+    Node *next = successor_impl(node);
+    erase_node_impl(root, node, alloc);
+    return Iterator(this, next);
+  }
+
+  Iterator erase(Iterator pos) {
+    return erase(Const_iterator(pos));
+  }
+
+  // REQUIRES: [first, last) is a range of elements of this BinarySearchTree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the elements in [first, last) and returns last.
+  Iterator erase(Const_iterator first, Const_iterator last) {
+    size_t end_position = position_impl(last.current_node, root);
+    Iterator pos(this, detach_keeping(first.current_node));
+    Iterator stop(this, nth_element_impl(root, end_position));
+    while (pos != stop) {
+      pos = erase(pos);
+    }
+    return stop;
   }
 
   // EFFECTS: Returns a human-readable string representation of this
@@ -304,89 +1291,742 @@ private:
   // The root node of this BinarySearchTree.
   Node *root;
 
-  // An instance of the Compare type. Use this to compare elements.
-  Compare less;
+  // The count of trees sharing the nodes under root, or null if no other
+  // tree has shared them since this tree last had nodes of its own. It is
+  // created when the tree is first copied (see shared_count).
+  mutable std::atomic<Share_count *> sharers;
 
-    
-  // NOTE: These member types are implemented for you in TreePrint.hpp.
-  //       They support the to_string function. You do not have to do
-  //       anything with them. DO NOT CHANGE.
-  class Tree_grid_square;
-  class Tree_grid;
+  // The number of threads that whole-tree work may use (see
+  // set_parallelism).
+  size_t workers;
 
-  // NOTE: This member function is implemented for you in TreePrint.hpp.
-  //       It supports the to_string function. You do not have to do
-  //       anything with it. DO NOT CHANGE.
-  int get_max_elt_width() const;
+  // How many times its optimal height this tree may grow before an
+  // insertion rebuilds part of it, or 0 to never rebuild (see
+  // set_rebalance_factor).
+  double height_factor;
 
+  // An instance of the Compare type. Use this to compare elements.
+  Compare less;
 
+  // The allocator that every Node of this tree is obtained from.
+  Node_allocator alloc;
 
-// ---------- DO NOT CHANGE ANYTHING IN THIS FILE ABOVE THIS LINE ----------
+  // What searches of this tree have cost; empty unless TREE_STATS is set.
+  mutable Search_counters<TREE_STATS != 0> counters;
 
+  // EFFECTS: Returns the comparator to search this tree with: 'less', or
+  //          with TREE_STATS, a copy of it that counts into 'counters'.
+  auto searcher() const {
+    return search_compare(less, counters);
+  }
 
-  // TREE IMPLEMENTATION FUNCTIONS
-  // You must write an implementation for each of these static member
-  // functions, which are called from the regular member functions that
-  // are included in the starter code for the BinarySearchTree class.
+  // REQUIRES: this tree does not share its nodes
+  // EFFECTS : Returns an Iterator to the element of this tree that 'it'
+  //           refers to, through which it may be changed.
+  Iterator as_mutable(Const_iterator it) {
+    return Iterator(this, it.current_node);
+  }
 
+  std::pair<Iterator, Iterator>
+  as_mutable(std::pair<Const_iterator, Const_iterator> its) {
+    return std::pair<Iterator, Iterator>(as_mutable(its.first),
+                                         as_mutable(its.second));
+  }
 
-  // EFFECTS: Returns whether the tree rooted at 'node' is empty.
-  // NOTE:    This function must run in constant time.
-  //          No iteration or recursion is allowed.
-  static bool empty_impl(const Node *node) {
-    if(!node){
-      return true;
-    }
-    return false;
+  Range as_mutable(Const_range view) {
+    return Range(as_mutable(view.begin()), as_mutable(view.end()));
+  }
+
+  // EFFECTS: Removes the element equivalent to value, if there is one,
+  //          and returns the number of elements removed.
+  template <typename K>
+  size_t erase_key(const K &value) {
+    Node *node = find_impl(root, value, searcher());
+    if (!node) {
+      return 0;
+    }
+    erase_node_impl(root, detach_keeping(node), alloc);
+    return 1;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Makes this tree the only owner of its nodes, copying them
+  //           if another tree shares them. Allocates nothing otherwise.
+  //           If copying throws, this tree is unchanged.
+  void detach() {
+    if (!shares_nodes()) {
+      return;
+    }
+    Node *copy = copy_nodes_parallel_impl(root, alloc, usable_workers());
+    release_nodes(true);
+    root = copy;
+  }
+
+  // EFFECTS : Returns the Share_count of this tree's nodes, first giving
+  //           them one that counts only this tree if they have none.
+  // NOTE:     Several threads may copy one const tree at once, so the new
+  //           count is installed with a compare-and-swap, and a thread
+  //           that loses the race uses the winner's.
+  Share_count *shared_count() const {
+    Share_count *count = sharers.load(std::memory_order_acquire);
+    if (count) {
+      return count;
+    }
+    Share_count *fresh = new Share_count();
+    if (sharers.compare_exchange_strong(count, fresh,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+      return fresh;
+    }
+    delete fresh;
+    return count;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Detaches this tree and returns the node that is now at the
+  //           same position in sorted order as 'node' was (null stays
+  //           null).
+  Node *detach_keeping(Node *node) {
+    if (shares_nodes()) {
+      size_t position = position_impl(node, root);
+      detach();
+      return nth_element_impl(root, position);
+    }
+    detach();
+    return node;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Gives up this tree's share of its nodes, leaving it empty.
+  //           If no other tree shares them and free_nodes is true, frees
+  //           the nodes.
+  void release_nodes(bool free_nodes) {
+    Share_count *count = sharers.exchange(nullptr, std::memory_order_acquire);
+    if (!count || count->trees.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      if (free_nodes) {
+        destroy_nodes_parallel_impl(root, alloc, usable_workers());
+      }
+      delete count;
+    }
+    root = nullptr;
+  }
+
+  // REQUIRES: this tree is empty and holds no share
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Makes 'nodes', which no other tree holds, the nodes of this
+  //           tree.
+  void adopt_nodes(Node *nodes) {
+    root = nodes;
+  }
+
+  // REQUIRES: this tree is empty and holds no share
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Shares the nodes of other if this tree's allocator can free
+  //           them, and otherwise copies them.
+  void share_or_copy(const BinarySearchTree &other) {
+    if (!other.root) {
+      return;
+    }
+    if (alloc == other.alloc) {
+      Share_count *count = other.shared_count();
+      count->trees.fetch_add(1, std::memory_order_relaxed);
+      root = other.root;
+      sharers.store(count, std::memory_order_relaxed);
+    }
+    else {
+      adopt_nodes(copy_nodes_parallel_impl(other.root, alloc,
+                                           usable_workers()));
+    }
+  }
+
+  // EFFECTS : Returns how many threads this tree may allocate and free
+  //           nodes on at once.
+  size_t usable_workers() const {
+    return allocates_concurrently<Node_allocator>::value ? workers : 1;
+  }
+
+  // EFFECTS : Returns whether another tree shares this tree's nodes.
+  bool shares_nodes() const {
+    Share_count *count = sharers.load(std::memory_order_acquire);
+    return count && count->trees.load(std::memory_order_acquire) > 1;
+  }
+
+  // EFFECTS : Returns whether the subtree rooted at 'node' is taller than
+  //           the rebalance factor allows for its size.
+  bool too_tall(const Node *node) const {
+    return node->height > height_factor * bit_width_impl(node->size);
+  }
+
+  // REQUIRES: this tree does not share its nodes, and 'added' is in it
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : If the tree has grown too tall (see set_rebalance_factor),
+  //           rebalances the lowest ancestor of 'added' whose subtree is
+  //           too tall, and then each higher one that still is, up to the
+  //           root if need be.
+  void limit_height(Node *added) {
+    if (Balance::self_balancing || height_factor == 0 || !too_tall(root)) {
+      return;
+    }
+    for (Node *node = added; node && too_tall(root); node = node->parent) {
+      if (too_tall(node)) {
+        node = rebuild_subtree(node);
+      }
+    }
+  }
+
+  // REQUIRES: this tree does not share its nodes, and 'node' is in it
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Rebalances the subtree rooted at 'node' in place (see
+  //           rebalance), brings the recorded shape of its ancestors up to
+  //           date, and returns the new root of the subtree.
+  Node *rebuild_subtree(Node *node) {
+    Node *parent = node->parent;
+    Node **link = &root;
+    if (parent) {
+      link = parent->left == node ? &parent->left : &parent->right;
+    }
+    vine_to_tree_impl(link, tree_to_vine_impl(link));
+    restore_links_impl(*link, parent);
+    for (Node *above = parent; above; above = above->parent) {
+      update_impl(above);
+    }
+    return *link;
+  }
+
+  // REQUIRES: 'out' has room for size() plus the number of nodes from
+  //           'theirs' on
+  // MODIFIES: out
+  // EFFECTS : Walks the nodes of this tree and the nodes of another tree
+  //           from 'theirs' on together in sorted order, writing to 'out'
+  //           the nodes of this tree and, for each node of the other tree,
+  //           the node that take(node, dup) returns if it is not null. dup
+  //           tells whether this tree holds an equivalent element. Returns
+  //           the number of nodes written. Changes no tree.
+  template <typename Take>
+  size_t merge_nodes(Node *theirs, Node **out, Take take) const {
+    size_t count = 0;
+    Node *mine = min_element_impl(root);
+    theirs = min_element_impl(theirs);
+    while (mine || theirs) {
+      bool mine_first = !theirs || (mine && less(mine->datum, theirs->datum));
+      bool dup = !mine_first && mine && !less(theirs->datum, mine->datum);
+      if (!mine_first) {
+        Node *taken = take(theirs, dup);
+        if (taken) {
+          out[count++] = taken;
+        }
+        theirs = successor_impl(theirs);
+      }
+      if (mine_first || dup) {
+        out[count++] = mine;
+        mine = successor_impl(mine);
+      }
+    }
+    return count;
+  }
+
+  // REQUIRES: this tree does not share its nodes, and its allocator is
+  //           equal to other's
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS : Moves the nodes of other into this tree one at a time,
+  //           destroying those whose elements are already here, and leaves
+  //           other empty. If a comparison throws, the nodes not yet moved
+  //           are destroyed.
+  void splice_each(BinarySearchTree &other) {
+    size_t m = other.size();
+    std::unique_ptr<Node *[]> theirs(new Node *[m]);
+    size_t i = 0;
+    for (Node *node = min_element_impl(other.root); node;
+         node = successor_impl(node)) {
+      theirs[i++] = node;
+    }
+    other.release_nodes(false);
+    try {
+      for (i = 0; i < m; ++i) {
+        Node *node = reset_node_impl(theirs[i]);
+        auto make = [node]() {
+          return node;
+        };
+        if (insert_impl(root, node->datum, searcher(), make) != node) {
+          delete_node_impl(node, alloc);
+        }
+        else {
+          limit_height(node);
+        }
+      }
+    }
+    catch (...) {
+      for (; i < m; ++i) {
+        delete_node_impl(theirs[i], alloc);
+      }
+      throw;
+    }
+  }
+
+  // REQUIRES: this tree does not share its nodes
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Keeps the elements of this tree that have an equivalent in
+  //           other if keep_found is true, or that have none if it is
+  //           false, frees the rest, and relinks the tree perfectly
+  //           balanced. Each element is looked up in other if this tree is
+  //           much smaller, and found by a merge walk otherwise. If a
+  //           comparison throws, this tree is left unchanged.
+  void retain(const BinarySearchTree &other, bool keep_found) {
+    size_t n = size();
+    std::unique_ptr<Node *[]> order(new Node *[n]);
+    bool by_lookup = few_against_impl(n, other.size());
+    Node *theirs = min_element_impl(other.root);
+    size_t kept = 0;
+    size_t dropped = 0;
+    for (Node *node = min_element_impl(root); node;
+         node = successor_impl(node)) {
+      bool found;
+      if (by_lookup) {
+        found = find_impl(other.root, node->datum, less) != nullptr;
+      }
+      else {
+        while (theirs && less(theirs->datum, node->datum)) {
+          theirs = successor_impl(theirs);
+        }
+        found = theirs && !less(node->datum, theirs->datum);
+      }
+      // Kept nodes fill 'order' from the front, dropped ones from the back
+      if (found == keep_found) {
+        order[kept++] = node;
+      }
+      else {
+        order[n - ++dropped] = node;
+      }
+    }
+    for (size_t i = kept; i < n; ++i) {
+      delete_node_impl(order[i], alloc);
+    }
+    root = relink_sorted_impl(order.get(), kept);
+  }
+
+  // EFFECTS : Implements equal_range for a value of type K.
+  template <typename K>
+  std::pair<Const_iterator, Const_iterator>
+  equal_range_key(const K &value) const {
+    Node *first = lower_bound_impl(root, value, searcher());
+    Const_iterator lower(this, first);
+    if (first && !less(value, first->datum)) {
+      Const_iterator upper(lower);
+      return std::pair<Const_iterator, Const_iterator>(lower, ++upper);
+    }
+    return std::pair<Const_iterator, Const_iterator>(lower, lower);
+  }
+
+  // EFFECTS : Implements range for bounds of type K.
+  // NOTE:     Bounds of type K may not be comparable with each other, so an
+  //           empty interval is detected by comparing hi with the first
+  //           element not less than lo.
+  template <typename K>
+  Const_range range_key(const K &lo, const K &hi) const {
+    Node *first = lower_bound_impl(root, lo, searcher());
+    if (!first || !less(first->datum, hi)) {
+      return Const_range(Const_iterator(this, first),
+                         Const_iterator(this, first));
+    }
+    return Const_range(Const_iterator(this, first),
+                       Const_iterator(this,
+                                      lower_bound_impl(root, hi, searcher())));
+  }
+
+  // EFFECTS : Implements count_range for bounds of type K.
+  template <typename K>
+  size_t count_range_key(const K &lo, const K &hi) const {
+    size_t below_lo = rank_impl(root, lo, searcher());
+    size_t below_hi = rank_impl(root, hi, searcher());
+    return below_hi > below_lo ? below_hi - below_lo : 0;
+  }
+
+  // REQUIRES: this tree is empty
+  // EFFECTS : Inserts the elements in [first, last) one at a time,
+  //           skipping any that are already present. If an insertion
+  //           throws, the elements inserted so far are freed.
+  template <typename Iter>
+  void assign_range(Iter first, Iter last, std::input_iterator_tag) {
+    try {
+      for (; first != last; ++first) {
+        try_insert(*first);
+      }
+    }
+    catch (...) {
+      release_nodes(true);
+      throw;
+    }
+  }
+
+  // REQUIRES: this tree is empty
+  // EFFECTS : Builds the tree in linear time if [first, last) is strictly
+  //           increasing, and otherwise inserts one element at a time.
+  template <typename Iter>
+  void assign_range(Iter first, Iter last, std::forward_iterator_tag) {
+    if (is_strictly_sorted_impl(first, last, less)) {
+      size_t n = static_cast<size_t>(std::distance(first, last));
+      adopt_nodes(build_sorted_impl(first, n, alloc));
+    }
+    else {
+      assign_range(first, last, std::input_iterator_tag());
+    }
+  }
+
+    
+  // NOTE: These member types are implemented for you in TreePrint.hpp.
+  //       They support the to_string function. You do not have to do
+  //       anything with them. DO NOT CHANGE.
+  class Tree_grid_square;
+  class Tree_grid;
+
+  // NOTE: This member function is implemented for you in TreePrint.hpp.
+  //       It supports the to_string function. You do not have to do
+  //       anything with it. DO NOT CHANGE.
+  int get_max_elt_width() const;
+
+
+
+// ---------- DO NOT CHANGE ANYTHING IN THIS FILE ABOVE THIS LINE ----------
+
+
+  // TREE IMPLEMENTATION FUNCTIONS
+  // You must write an implementation for each of these static member
+  // functions, which are called from the regular member functions that
+  // are included in the starter code for the BinarySearchTree class.
+
+
+  // EFFECTS: Returns whether the tree rooted at 'node' is empty.
+  // NOTE:    This function must run in constant time.
+  //          No iteration or recursion is allowed.
+  static bool empty_impl(const Node *node) {
+    if(!node){
+      return true;
+    }
+    return false;
   }
 
   // EFFECTS: Returns the size of the tree rooted at 'node', which is the
   //          total number of nodes in that tree. The size of an empty
   //          tree is 0.
-  // NOTE:    This function must be tree recursive.
-  static int size_impl(const Node *node) {
+  // NOTE:    This function must run in constant time. It reads the size
+  //          recorded in 'node'.
+  static size_t node_size_impl(const Node *node) {
     if(!node){
       return 0;
     }
-    return 1+size_impl(node->right)+size_impl(node->left);
+    return node->size;
   }
 
   // EFFECTS: Returns the height of the tree rooted at 'node', which is the
   //          number of nodes in the longest path from the 'node' to a leaf.
   //          The height of an empty tree is 0.
-  // NOTE:    This function must be tree recursive.
+  // NOTE:    This function must run in constant time. It reads the height
+  //          recorded in 'node'.
   static int height_impl(const Node *node) {
-    if(!node){
-      return 0;
+    return node_height_impl(node);
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Allocates a new Node from 'alloc' whose datum is constructed
+  //           in place from 'args', with no children or parent, and returns
+  //           a pointer to it.
+  template <typename... Args>
+  static Node *new_node_impl(Node_allocator &alloc, Args &&...args) {
+    Node *node = Node_traits::allocate(alloc, 1);
+    try {
+      Node_traits::construct(alloc, node, std::in_place,
+                             std::forward<Args>(args)...);
+    }
+    catch (...) {
+      Node_traits::deallocate(alloc, node, 1);
+      throw;
     }
-    return 1+std::max(height_impl(node->right), height_impl(node->left));
+    return node;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Destroys 'node' and returns its memory to 'alloc'.
+  static void delete_node_impl(Node *node, Node_allocator &alloc) {
+    Node_traits::destroy(alloc, node);
+    Node_traits::deallocate(alloc, node, 1);
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Allocates a new Node from 'alloc' holding a copy of the datum
+  //           and recorded shape of 'node', with no children or parent.
+  static Node *clone_node_impl(const Node *node, Node_allocator &alloc) {
+    Node *copy = new_node_impl(alloc, node->datum);
+    copy->size = node->size;
+    copy->path_length = node->path_length;
+    copy->height = node->height;
+    copy->chains = node->chains;
+    return copy;
   }
 
   // EFFECTS: Creates and returns a pointer to the root of a new node structure
   //          with the same elements and EXACTLY the same structure as the
-  //          tree rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
-  static Node *copy_nodes_impl(Node *node) {
+  //          tree rooted at 'node'. The new nodes are obtained from 'alloc'.
+  //          If copying an element throws, the nodes copied so far are
+  //          freed and the exception propagates.
+  // NOTE:    This function walks the source and the copy in lockstep,
+  //          going down child links and back up parent links, so it uses
+  //          constant stack space at any depth.
+  static Node *copy_nodes_impl(const Node *node, Node_allocator &alloc) {
     if(!node){
       return nullptr;
     }
-    Node *newN = new Node;
-    newN->datum = node->datum;
-    newN->left = copy_nodes_impl(node->left);
-    newN->right = copy_nodes_impl(node->right);
-    return newN;
+    Node *copy_root = clone_node_impl(node, alloc);
+    try {
+      copy_children_impl(node, copy_root, alloc);
+    }
+    catch (...) {
+      destroy_nodes_impl(copy_root, alloc);
+      throw;
+    }
+    return copy_root;
+  }
 
+  // REQUIRES: 'copy' is a childless clone of 'node'
+  // MODIFIES: copy, alloc
+  // EFFECTS : Gives 'copy' clones of all descendants of 'node', in the
+  //           same structure. A clone that throws leaves the copy a
+  //           well-formed (partial) tree.
+  static void copy_children_impl(const Node *node, Node *copy,
+                                 Node_allocator &alloc) {
+    const Node *src = node;
+    Node *dst = copy;
+    while(true){
+      if(src->left && !dst->left){
+        dst->left = clone_node_impl(src->left, alloc);
+        dst->left->parent = dst;
+        src = src->left;
+        dst = dst->left;
+      }
+      else if(src->right && !dst->right){
+        dst->right = clone_node_impl(src->right, alloc);
+        dst->right->parent = dst;
+        src = src->right;
+        dst = dst->right;
+      }
+      else if(src == node){
+        return;
+      }
+      else{
+        src = src->parent;
+        dst = dst->parent;
+      }
+    }
   }
 
-  // EFFECTS: Frees the memory for all nodes used in the tree rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
-  static void destroy_nodes_impl(Node *node) {
+  // EFFECTS: Frees the memory for all nodes used in the tree rooted at 'node',
+  //          returning it to 'alloc'.
+  // NOTE:    Leaves are freed bottom-up by following parent links, so this
+  //          function uses constant stack space at any depth.
+  static void destroy_nodes_impl(Node *node, Node_allocator &alloc) {
     if(!node){
       return;
     }
-    destroy_nodes_impl(node->left);
-    destroy_nodes_impl(node->right);
-    delete node;
+    Node *top = node->parent;
+    while(node != top){
+      if(node->left){
+        node = node->left;
+      }
+      else if(node->right){
+        node = node->right;
+      }
+      else{
+        Node *parent = node->parent;
+        if(parent != top){
+          if(parent->left == node){
+            parent->left = nullptr;
+          }
+          else{
+            parent->right = nullptr;
+          }
+        }
+        delete_node_impl(node, alloc);
+        node = parent;
+      }
+    }
+  }
+
+  // Subtrees smaller than this are copied, freed or built on one thread:
+  // below it, starting a thread costs more than it saves.
+  static constexpr size_t parallel_grain = 16384;
+
+  // REQUIRES: 'link' is parent->left or parent->right
+  // MODIFIES: parent, child
+  // EFFECTS : Makes 'child' (which may be null) the child of 'parent' at
+  //           'link', leaving the height and size of 'parent' alone.
+  static void link_child_impl(Node *parent, Node *&link, Node *child) {
+    link = child;
+    if(child){
+      child->parent = parent;
+    }
+  }
+
+  // EFFECTS: Same as copy_nodes_impl, but copies disjoint subtrees on up
+  //          to 'threads' threads at once.
+  static Node *copy_nodes_parallel_impl(const Node *node,
+                                        Node_allocator &alloc,
+                                        size_t threads) {
+    if(threads < 2 || node_size_impl(node) < parallel_grain){
+      return copy_nodes_impl(node, alloc);
+    }
+    Node *copy_root = clone_node_impl(node, alloc);
+    try {
+      copy_children_parallel_impl(node, copy_root, alloc, threads);
+    }
+    catch (...) {
+      destroy_nodes_impl(copy_root, alloc);
+      throw;
+    }
+    return copy_root;
+  }
+
+  // REQUIRES: 'copy' is a childless clone of 'node'
+  // MODIFIES: copy, alloc
+  // EFFECTS : Same as copy_children_impl, using up to 'threads' threads.
+  // NOTE:     While one subtree is too small to be worth a thread, it is
+  //           copied here and the walk moves down into the other, so this
+  //           recurses only where it forks, at most 'threads' deep.
+  static void copy_children_parallel_impl(const Node *node, Node *copy,
+                                          Node_allocator &alloc,
+                                          size_t threads) {
+    while(std::min(node_size_impl(node->left), node_size_impl(node->right))
+          < parallel_grain){
+      bool left_larger = node_size_impl(node->left)
+                         >= node_size_impl(node->right);
+      const Node *larger = left_larger ? node->left : node->right;
+      Node *&larger_link = left_larger ? copy->left : copy->right;
+      Node *&smaller_link = left_larger ? copy->right : copy->left;
+      link_child_impl(copy, smaller_link,
+                      copy_nodes_impl(left_larger ? node->right : node->left,
+                                      alloc));
+      if(node_size_impl(larger) < parallel_grain){
+        link_child_impl(copy, larger_link, copy_nodes_impl(larger, alloc));
+        return;
+      }
+      link_child_impl(copy, larger_link, clone_node_impl(larger, alloc));
+      node = larger;
+      copy = larger_link;
+    }
+    size_t left_threads = split_threads(threads, node->left->size,
+                                        node->right->size);
+    fork_join([&]() {
+      link_child_impl(copy, copy->left,
+                      copy_nodes_parallel_impl(node->left, alloc,
+                                               left_threads));
+    }, [&]() {
+      link_child_impl(copy, copy->right,
+                      copy_nodes_parallel_impl(node->right, alloc,
+                                               threads - left_threads));
+    });
+  }
+
+  // EFFECTS: Same as destroy_nodes_impl, but frees disjoint subtrees on up
+  //          to 'threads' threads at once.
+  // NOTE:    As in copy_children_parallel_impl, this recurses only where
+  //          it forks.
+  static void destroy_nodes_parallel_impl(Node *node, Node_allocator &alloc,
+                                          size_t threads) {
+    while(true){
+      if(threads < 2 || node_size_impl(node) < parallel_grain){
+        destroy_nodes_impl(node, alloc);
+        return;
+      }
+      size_t left_size = node_size_impl(node->left);
+      size_t right_size = node_size_impl(node->right);
+      if(std::min(left_size, right_size) >= parallel_grain){
+        break;
+      }
+      Node *larger = left_size >= right_size ? node->left : node->right;
+      destroy_nodes_impl(left_size >= right_size ? node->right : node->left,
+                         alloc);
+      larger->parent = nullptr;
+      delete_node_impl(node, alloc);
+      node = larger;
+    }
+    size_t left_threads = split_threads(threads, node->left->size,
+                                        node->right->size);
+    fork_join([&]() {
+      destroy_nodes_parallel_impl(node->left, alloc, left_threads);
+    }, [&]() {
+      destroy_nodes_parallel_impl(node->right, alloc, threads - left_threads);
+    });
+    delete_node_impl(node, alloc);
+  }
+
+  // Walks an array of pointers to elements, yielding the elements.
+  struct Pointee_iterator {
+    const T *const *at;
+
+    const T &operator*() const {
+      return **at;
+    }
+
+    Pointee_iterator &operator++() {
+      ++at;
+      return *this;
+    }
+  };
+
+  // MODIFIES: the n pointers starting at 'first'
+  // EFFECTS : Stably sorts the pointers by the elements they point to,
+  //           sorting halves on up to 'threads' threads at once and then
+  //           merging them.
+  static void sort_pointers_impl(const T **first, size_t n, Compare less,
+                                 size_t threads) {
+    auto by_element = [less](const T *a, const T *b) {
+      return less(*a, *b);
+    };
+    if(threads < 2 || n < parallel_grain){
+      std::stable_sort(first, first + n, by_element);
+      return;
+    }
+    size_t half = n / 2;
+    size_t left_threads = threads / 2;
+    fork_join([&]() {
+      sort_pointers_impl(first, half, less, left_threads);
+    }, [&]() {
+      sort_pointers_impl(first + half, n - half, less, threads - left_threads);
+    });
+    std::inplace_merge(first, first + half, first + n, by_element);
+  }
+
+  // REQUIRES: the elements that the n pointers starting at 'first' point
+  //           to are strictly increasing
+  // MODIFIES: alloc
+  // EFFECTS : Same as build_sorted_impl over those elements (and giving
+  //           the same shape), but builds the two subtrees of each large
+  //           range on up to 'threads' threads at once.
+  static Node *build_sorted_parallel_impl(const T *const *first, size_t n,
+                                          Node_allocator &alloc,
+                                          size_t threads) {
+    if(threads < 2 || n < parallel_grain){
+      return build_sorted_impl(Pointee_iterator{ first }, n, alloc);
+    }
+    size_t half = n / 2;
+    size_t left_threads = threads / 2;
+    Node *node = new_node_impl(alloc, *first[half]);
+    try {
+      fork_join([&]() {
+        link_child_impl(node, node->left,
+                        build_sorted_parallel_impl(first, half, alloc,
+                                                   left_threads));
+      }, [&]() {
+        link_child_impl(node, node->right,
+                        build_sorted_parallel_impl(first + half + 1,
+                                                   n - half - 1, alloc,
+                                                   threads - left_threads));
+      });
+    }
+    catch (...) {
+      destroy_nodes_impl(node, alloc);
+      throw;
+    }
+    update_impl(node);
+    return node;
   }
 
   // EFFECTS : Searches the tree rooted at 'node' for an element equivalent
@@ -394,69 +2034,500 @@ private:
   //           containing it. If the tree is empty or the element is not
   //           found, returns a null pointer.
   //
-  // NOTE: This function must be tail recursive.
   // HINT: Equivalence is defined according to the Compare functor
   //       associated with this instantiation of the BinarySearchTree
   //       template, NOT according to the == operator. Use the "less"
   //       parameter to compare elements.
   //       Two elements A and B are equivalent if and only if A is
   //       not less than B and B is not less than A.
-  static Node * find_impl(Node *node, const T &query, Compare less) {
+  // NOTE: K is T unless Compare is transparent.
+  template <typename K, typename Less>
+  static Node * find_impl(Node *node, const K &query, Less less) {
+    Search_trace<Less> trace(less);
+    while(node){
+      trace.visit();
+      if(less(query,node->datum)){
+        node = node->left;
+      }
+      else if(less(node->datum,query)){
+        node = node->right;
+      }
+      else{
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  // REQUIRES: 'make' returns a new leaf Node whose datum is equivalent
+  //           to 'key'
+  // MODIFIES: the tree rooted at 'root'
+  // EFFECTS : If the tree rooted at 'root' contains an element equivalent
+  //           to 'key', returns a pointer to the Node holding it and
+  //           leaves the tree unchanged.
+  //           Otherwise, calls 'make' once to obtain a new Node, links it
+  //           into the proper location as a leaf according to the sorting
+  //           invariant, and returns a pointer to the new Node.
+  //           If 'root' represents an empty tree, the new Node becomes the
+  //           single-element tree.
+  //           The ancestors of the new Node are then updated from the
+  //           bottom up (see retrace_impl), and 'root' is updated if a
+  //           rotation replaced it.
+  // HINT: Element ordering is defined according to the Compare functor
+  //       associated with this instantiation of the BinarySearchTree
+  //       template, NOT according to the < operator. Use the "less"
+  //       parameter to compare elements.
+  // NOTE: K is T unless Compare is transparent.
+  template <typename K, typename Less, typename Make>
+  static Node * insert_impl(Node *&root, const K &key, Less less,
+                            Make &make) {
+    Search_trace<Less> trace(less);
+    Node *parent = nullptr;
+    Node **link = &root;
+    while(*link){
+      trace.visit();
+      parent = *link;
+      if(less(key,parent->datum)){
+        link = &parent->left;
+      }
+      else if(less(parent->datum,key)){
+        link = &parent->right;
+      }
+      else{
+        return parent;
+      }
+    }
+    Node *result = make();
+    result->parent = parent;
+    *link = result;
+    retrace_impl(root, parent);
+    return result;
+  }
+
+  // A subtree that build_sorted_impl has yet to finish: the range
+  // [lo, hi) of element positions it covers, and its root once created.
+  struct Build_frame {
+    size_t lo;
+    size_t hi;
+    Node *node;
+  };
+
+  // REQUIRES: the n elements starting at 'first' are strictly increasing
+  // MODIFIES: alloc
+  // EFFECTS : Creates and returns the root of a new tree holding copies of
+  //           those n elements. The middle element of every range becomes
+  //           the root of its subtree, so the sizes of the two subtrees of
+  //           every node differ by at most one. Parent links, sizes and
+  //           heights are all set. If an element fails to copy, the nodes
+  //           created so far are freed and the exception is rethrown.
+  // NOTE:    The nodes are created in order, by an in-order walk of the
+  //          implicit tree that keeps its pending subtrees on a fixed-size
+  //          stack. Each level halves the range, so 64 entries suffice.
+  template <typename Iter>
+  static Node *build_sorted_impl(Iter first, size_t n, Node_allocator &alloc) {
+    Build_frame stack[64];
+    size_t depth = 0;
+    size_t lo = 0;
+    size_t hi = n;
+    Node *built = nullptr;
+    try {
+      while(true){
+        while(lo < hi){
+          stack[depth++] = Build_frame{ lo, hi, nullptr };
+          hi = lo + (hi - lo) / 2;
+        }
+        // Pop every subtree whose right half is now complete
+        while(depth > 0 && stack[depth - 1].node){
+          Node *node = stack[--depth].node;
+          set_child_impl(node, node->right, built);
+          built = node;
+        }
+        if(depth == 0){
+          return built;
+        }
+        Build_frame &frame = stack[depth - 1];
+        frame.node = new_node_impl(alloc, *first);
+        set_child_impl(frame.node, frame.node->left, built);
+        built = nullptr;
+        ++first;
+        lo = frame.lo + (frame.hi - frame.lo) / 2 + 1;
+        hi = frame.hi;
+      }
+    }
+    catch (...) {
+      destroy_nodes_impl(built, alloc);
+      while(depth > 0){
+        destroy_nodes_impl(stack[--depth].node, alloc);
+      }
+      throw;
+    }
+  }
+
+  // EFFECTS : Returns whether doing 'few' searches in a tree of 'many'
+  //           elements costs less than one pass over all of them.
+  // NOTE:     The searches are made in sorted order, so consecutive ones
+  //           mostly revisit cached nodes, while a pass that relinks every
+  //           node misses the cache on most of them. Measured on trees of
+  //           10^5 and 10^6 elements, the two break even at about
+  //           few * log2(many) == 4 * many.
+  static bool few_against_impl(size_t few, size_t many) {
+    return few * bit_width_impl(many) < 4 * many;
+  }
+
+  // EFFECTS : Returns the number of bits needed to write n, which is the
+  //           height of a perfectly balanced tree of n nodes.
+  static size_t bit_width_impl(size_t n) {
+    size_t bits = 0;
+    while(n >> bits){
+      ++bits;
+    }
+    return bits;
+  }
+
+  // MODIFIES: node
+  // EFFECTS : Unlinks 'node' from its tree, making it a lone leaf, and
+  //           returns it.
+  static Node *reset_node_impl(Node *node) {
+    node->left = nullptr;
+    node->right = nullptr;
+    node->parent = nullptr;
+    node->size = 1;
+    node->path_length = 0;
+    node->height = 1;
+    node->chains = 0;
+    return node;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Returns a new lone leaf holding a copy of the datum of 'node'.
+  static Node *clone_element_impl(const Node *node, Node_allocator &alloc) {
+    return new_node_impl(alloc, node->datum);
+  }
+
+  // MODIFIES: the tree hanging from 'link'
+  // EFFECTS : Rotates the tree hanging from 'link' right until no node has
+  //           a left child, leaving a "vine" of its nodes in order down
+  //           the right links, and returns how many nodes it has. Only the
+  //           left and right links are kept up to date.
+  static size_t tree_to_vine_impl(Node **link) {
+    size_t n = 0;
+    while(*link){
+      Node *node = *link;
+      if(node->left){
+        Node *pivot = node->left;
+        node->left = pivot->right;
+        pivot->right = node;
+        *link = pivot;
+      }
+      else{
+        ++n;
+        link = &node->right;
+      }
+    }
+    return n;
+  }
+
+  // REQUIRES: the right spine from 'link' has at least 2 * count nodes
+  // MODIFIES: the tree hanging from 'link'
+  // EFFECTS : Rotates left at every other node of the right spine from
+  //           'link', 'count' times, making each of those nodes the left
+  //           child of the node that followed it. Only the left and right
+  //           links are kept up to date.
+  static void compress_impl(Node **link, size_t count) {
+    for(size_t i = 0; i < count; ++i){
+      Node *node = *link;
+      Node *pivot = node->right;
+      node->right = pivot->left;
+      pivot->left = node;
+      *link = pivot;
+      link = &pivot->right;
+    }
+  }
+
+  // REQUIRES: a vine of n nodes hangs from 'link' (see tree_to_vine_impl)
+  // MODIFIES: the nodes of the vine
+  // EFFECTS : Folds the vine into a perfectly balanced tree, whose bottom
+  //           level is filled from the left. The first pass makes the
+  //           bottom level; each pass after that halves the spine.
+  static void vine_to_tree_impl(Node **link, size_t n) {
+    size_t full = (size_t(1) << (bit_width_impl(n + 1) - 1)) - 1;
+    compress_impl(link, n - full);
+    for(size_t spine = full; spine > 1; spine /= 2){
+      compress_impl(link, spine / 2);
+    }
+  }
+
+  // REQUIRES: the tree rooted at 'node' is no taller than 64
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Sets the parent links of the tree rooted at 'node', whose
+  //           own parent is 'parent', and recomputes the recorded shape of
+  //           each of its nodes.
+  static void restore_links_impl(Node *node, Node *parent) {
     if(!node){
+      return;
+    }
+    node->parent = parent;
+    restore_links_impl(node->left, node);
+    restore_links_impl(node->right, node);
+    update_impl(node);
+  }
+
+  // REQUIRES: the elements of the n nodes starting at 'nodes' are strictly
+  //           increasing, and no other tree uses the nodes
+  // MODIFIES: the nodes
+  // EFFECTS : Relinks the nodes into a perfectly balanced tree, with the
+  //           same shape build_sorted_impl gives, and returns its root.
+  // NOTE:     The nodes are visited in order, which keeps memory access
+  //           close to sequential when they were allocated in order. Each
+  //           level of recursion halves the range, so the depth is at
+  //           most 64.
+  static Node *relink_sorted_impl(Node *const *nodes, size_t n) {
+    if(n == 0){
       return nullptr;
     }
-    if(!less(query,node->datum) && !less(node->datum,query)){
-      return node;
+    size_t half = n / 2;
+    Node *left = relink_sorted_impl(nodes, half);
+    Node *node = reset_node_impl(nodes[half]);
+    set_child_impl(node, node->left, left);
+    Node *right = relink_sorted_impl(nodes + half + 1, n - half - 1);
+    set_child_impl(node, node->right, right);
+    return node;
+  }
+
+  // REQUIRES: 'link' is node->left or node->right
+  // MODIFIES: node, child
+  // EFFECTS : Makes 'child' (which may be null) the child of 'node' at
+  //           'link', and recomputes the height and size of 'node'.
+  static void set_child_impl(Node *node, Node *&link, Node *child) {
+    link = child;
+    if(child){
+      child->parent = node;
     }
-    if(less(query,node->datum)){
-      
-      return find_impl(node->left,query,less);
-    }else{
-      return find_impl(node->right,query,less);
+    update_impl(node);
+  }
 
+  // EFFECTS : Returns whether every element of [first, last) is less than
+  //           the one after it according to 'less'.
+  template <typename Iter>
+  static bool is_strictly_sorted_impl(Iter first, Iter last, Compare less) {
+    if(first == last){
+      return true;
     }
-    
-    
+    for(Iter next = std::next(first); next != last; ++first, ++next){
+      if(!less(*first, *next)){
+        return false;
+      }
+    }
+    return true;
   }
 
-  // REQUIRES: item is not already contained in the tree rooted at 'node'
-  // MODIFIES: the tree rooted at 'node'
-  // EFFECTS : If 'node' represents an empty tree, allocates a new
-  //           Node to represent a single-element tree with 'item' as
-  //           its only element and returns a pointer to the new Node.
-  //           If the tree rooted at 'node' is not empty, inserts
-  //           'item' into the proper location as a leaf in the
-  //           existing tree structure according to the sorting
-  //           invariant and returns the original parameter 'node'.
-  // NOTE: This function must be linear recursive, but does not
-  //       need to be tail recursive.
-  // HINT: Element ordering is defined according to the Compare functor
-  //       associated with this instantiation of the BinarySearchTree
-  //       template, NOT according to the < operator. Use the "less"
-  //       parameter to compare elements.
-  static Node * insert_impl(Node *node, const T &item, Compare less) {
+  // REQUIRES: 'node' is in the tree rooted at 'root'
+  // MODIFIES: the tree rooted at 'root', alloc
+  // EFFECTS : Unlinks 'node' from the tree and frees it. If 'node' has two
+  //           children, its in-order successor is relinked into its place,
+  //           so no element is copied or moved. The ancestors of the
+  //           changed part of the tree are then updated from the bottom up
+  //           (see retrace_impl), and 'root' is updated if it changed.
+  static void erase_node_impl(Node *&root, Node *node, Node_allocator &alloc) {
+    Node *start;
+    if(node->left && node->right){
+      Node *succ = min_element_impl(node->right);
+      if(succ->parent == node){
+        start = succ;
+      }
+      else{
+        // Detach succ (which has no left child) from its parent, then let
+        // it take over the right subtree of 'node'.
+        start = succ->parent;
+        start->left = succ->right;
+        if(succ->right){
+          succ->right->parent = start;
+        }
+        succ->right = node->right;
+        succ->right->parent = succ;
+      }
+      succ->left = node->left;
+      succ->left->parent = succ;
+      replace_child_impl(root, node->parent, node, succ);
+    }
+    else{
+      start = node->parent;
+      replace_child_impl(root, start, node, node->left ? node->left : node->right);
+    }
+    delete_node_impl(node, alloc);
+    retrace_impl(root, start);
+  }
+
+  // REQUIRES: 'old' is a child of 'parent', or the root if 'parent' is null
+  // MODIFIES: the tree rooted at 'root'
+  // EFFECTS : Puts 'child' (which may be null) in the place of 'old',
+  //           updating the link in 'parent' (or 'root') and the parent
+  //           pointer of 'child'.
+  static void replace_child_impl(Node *&root, Node *parent, Node *old,
+                                 Node *child) {
+    if(!parent){
+      root = child;
+    }
+    else if(parent->left == old){
+      parent->left = child;
+    }
+    else{
+      parent->right = child;
+    }
+    if(child){
+      child->parent = parent;
+    }
+  }
+
+  // MODIFIES: the tree rooted at 'root'
+  // EFFECTS : Walks from 'node' up to the root, recomputing the recorded
+  //           height and size of every node on the way and, if the
+  //           Balance policy is self-balancing, rebalancing each one.
+  //           Updates 'root' if a rotation replaced it.
+  // NOTE:    This is used after the children of 'node' have changed, by
+  //          both insertion and removal.
+  static void retrace_impl(Node *&root, Node *node) {
+    while(node){
+      update_impl(node);
+      Node *parent = node->parent;
+      replace_child_impl(root, parent, node, rebalance_impl(node));
+      node = parent;
+    }
+  }
+
+  // EFFECTS : Returns the recorded height of the tree rooted at 'node',
+  //           or 0 if the tree is empty.
+  static int node_height_impl(const Node *node) {
     if(!node){
-      Node *ptr = new Node;
-      ptr->datum = item;
-      ptr->left = nullptr;
-      ptr->right = nullptr;
-      return ptr;
+      return 0;
     }
-    if(!less(item,node->datum) && !less(node->datum,item)){
+    return node->height;
+  }
+
+  // EFFECTS : Returns the recorded path length of the tree rooted at
+  //           'node', or 0 if the tree is empty.
+  static size_t node_path_length_impl(const Node *node) {
+    return node ? node->path_length : 0;
+  }
+
+  // EFFECTS : Returns the recorded number of degenerate chains in the tree
+  //           rooted at 'node', or 0 if the tree is empty.
+  static int node_chains_impl(const Node *node) {
+    return node ? node->chains : 0;
+  }
+
+  // EFFECTS : Returns the child of 'node' if it has exactly one, or a null
+  //           pointer if 'node' is null or has zero or two children.
+  static const Node *only_child_impl(const Node *node) {
+    if(!node || (node->left && node->right)){
+      return nullptr;
+    }
+    return node->left ? node->left : node->right;
+  }
+
+  // REQUIRES: the recorded sizes and path lengths of node's children are
+  //           correct
+  // EFFECTS : Returns the path length of the tree rooted at 'node'. Every
+  //           node of a child's subtree is one level deeper from 'node'.
+  static size_t path_length_from_children_impl(const Node *node) {
+    return node_path_length_impl(node->left) + node_size_impl(node->left)
+           + node_path_length_impl(node->right) + node_size_impl(node->right);
+  }
+
+  // REQUIRES: the recorded chain counts of node's children are correct
+  // EFFECTS : Returns the number of degenerate chains in the tree rooted at
+  //           'node'. Each chain is counted at its second-last node, the
+  //           one whose only child has an only child with zero or two
+  //           children, so this depends on three levels below 'node'.
+  static int chains_from_children_impl(const Node *node) {
+    int chains = node_chains_impl(node->left) + node_chains_impl(node->right);
+    const Node *grandchild = only_child_impl(only_child_impl(node));
+    if(grandchild && !only_child_impl(grandchild)){
+      ++chains;
+    }
+    return chains;
+  }
+
+  // REQUIRES: the recorded shape of node's children is correct
+  // MODIFIES: node
+  // EFFECTS : Recomputes the recorded height, size, path length and chain
+  //           count of 'node' from its children.
+  static void update_impl(Node *node) {
+    node->height = 1 + std::max(node_height_impl(node->left),
+                                node_height_impl(node->right));
+    node->size = 1 + node_size_impl(node->left) + node_size_impl(node->right);
+    node->path_length = path_length_from_children_impl(node);
+    node->chains = chains_from_children_impl(node);
+  }
+
+  // REQUIRES: node->right is not null
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Rotates the tree rooted at 'node' to the left, so that its
+  //           right child becomes the new root. The new root takes over
+  //           the parent pointer of 'node'. Returns the new root.
+  static Node * rotate_left_impl(Node *node) {
+    Node *pivot = node->right;
+    node->right = pivot->left;
+    if(node->right){
+      node->right->parent = node;
+    }
+    pivot->left = node;
+    pivot->parent = node->parent;
+    node->parent = pivot;
+    update_impl(node);
+    update_impl(pivot);
+    return pivot;
+  }
+
+  // REQUIRES: node->left is not null
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Rotates the tree rooted at 'node' to the right, so that its
+  //           left child becomes the new root. The new root takes over
+  //           the parent pointer of 'node'. Returns the new root.
+  static Node * rotate_right_impl(Node *node) {
+    Node *pivot = node->left;
+    node->left = pivot->right;
+    if(node->left){
+      node->left->parent = node;
+    }
+    pivot->right = node;
+    pivot->parent = node->parent;
+    node->parent = pivot;
+    update_impl(node);
+    update_impl(pivot);
+    return pivot;
+  }
+
+  // REQUIRES: the subtrees of 'node' satisfy the balance invariant and
+  //           their heights differ by at most two, as is the case after
+  //           a single insertion or removal below 'node'
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : If the Balance policy is self-balancing, performs the AVL
+  //           single or double rotation needed to restore the balance
+  //           invariant at 'node'. Returns the root of the resulting tree.
+  //           Otherwise, returns 'node' unchanged.
+  static Node * rebalance_impl(Node *node) {
+    if(!Balance::self_balancing){
       return node;
     }
-    if(less(item,node->datum/*.first if it doesn't work*/)){
-      node->left = insert_impl(node->left,item,less);
+    int balance = node_height_impl(node->left) - node_height_impl(node->right);
+    if(balance > 1){
+      if(node_height_impl(node->left->left) < node_height_impl(node->left->right)){
+        node->left = rotate_left_impl(node->left);
+      }
+      return rotate_right_impl(node);
     }
-    else{
-      node->right = insert_impl(node->right,item,less);
+    if(balance < -1){
+      if(node_height_impl(node->right->right) < node_height_impl(node->right->left)){
+        node->right = rotate_right_impl(node->right);
+      }
+      return rotate_left_impl(node);
     }
     return node;
   }
 
   // EFFECTS : Returns a pointer to the Node containing the minimum element
   //           in the tree rooted at 'node' or a null pointer if the tree is empty.
-  // NOTE: This function must be tail recursive.
   // NOTE: This function is used in the implementation of the ++ operator for
   //       the iterator code that is provided for you.
   // HINT: You don't need to compare any elements! Think about the
@@ -465,49 +2536,138 @@ private:
     if(!node){
       return nullptr;
     }
-    if(!node->left){
-      return node;
+    while(node->left){
+      node = node->left;
     }
-    return min_element_impl(node->left);
-    
+    return node;
   }
 
   // EFFECTS : Returns a pointer to the Node containing the maximum element
   //           in the tree rooted at 'node' or a null pointer if the tree is empty.
-  // NOTE: This function must be tail recursive.
   // HINT: You don't need to compare any elements! Think about the
   //       structure, and where the largest element lives.
   static Node * max_element_impl(Node *node) {
     if(!node){
       return nullptr;
     }
-    if(!node->right){
-      return node;
+    while(node->right){
+      node = node->right;
     }
-    return max_element_impl(node->right);
+    return node;
   }
 
 
-  // EFFECTS: Returns whether the sorting invariant holds on the tree
-  //          rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
-  static bool check_sorting_invariant_impl(const Node *node, Compare less) {
-    if(!node){
-      return true;
+  // REQUIRES: node is not null
+  // EFFECTS : Returns a pointer to the closest ancestor of 'node' that
+  //           has 'node' in its left subtree, which is the Node holding
+  //           the next element in order when 'node' has no right child.
+  //           Returns a null pointer if there is no such ancestor.
+  // NOTE: This function is used in the implementation of the ++ operator.
+  static Node * successor_ancestor_impl(Node *node) {
+    Node *parent = node->parent;
+    while(parent && parent->right == node){
+      node = parent;
+      parent = node->parent;
     }
+    return parent;
+  }
+
+  // REQUIRES: node is not null
+  // EFFECTS : Returns a pointer to the closest ancestor of 'node' that
+  //           has 'node' in its right subtree, which is the Node holding
+  //           the previous element in order when 'node' has no left child.
+  //           Returns a null pointer if there is no such ancestor.
+  // NOTE: This function is used in the implementation of the -- operator.
+  static Node * predecessor_ancestor_impl(Node *node) {
+    Node *parent = node->parent;
+    while(parent && parent->left == node){
+      node = parent;
+      parent = node->parent;
+    }
+    return parent;
+  }
+
+  // REQUIRES: node is not null
+  // EFFECTS : Returns a pointer to the Node holding the next element after
+  //           node->datum in order, or a null pointer if there is none.
+  static Node * successor_impl(Node *node) {
+    if(node->right){
+      return min_element_impl(node->right);
+    }
+    return successor_ancestor_impl(node);
+  }
+
+  // REQUIRES: node is not null
+  // EFFECTS : Returns the Node visited after 'node' in a pre-order
+  //           traversal of the whole tree, or a null pointer if 'node' is
+  //           the last one.
+  static Node * preorder_next_impl(Node *node) {
     if(node->left){
-      if(!less(node->left->datum,node->datum)){
-        return false;
-      }
+      return node->left;
     }
     if(node->right){
-      if(!less(node->datum,node->right->datum)){
+      return node->right;
+    }
+    Node *parent = node->parent;
+    while(parent && (parent->right == node || !parent->right)){
+      node = parent;
+      parent = node->parent;
+    }
+    return parent ? parent->right : nullptr;
+  }
+
+  // EFFECTS: Returns whether the sorting invariant holds on the tree
+  //          rooted at 'node'.
+  // NOTE:    The sorting invariant holds exactly when an in-order walk
+  //          visits strictly increasing elements, so this function checks
+  //          each element against the one before it.
+  static bool check_sorting_invariant_impl(Node *node, Compare less) {
+    const Node *prev = nullptr;
+    for(node = min_element_impl(node); node; node = successor_impl(node)){
+      if(prev && !less(prev->datum,node->datum)){
         return false;
       }
+      prev = node;
     }
-    return check_sorting_invariant_impl(node->left,less) 
-    && check_sorting_invariant_impl(node->right,less);
+    return true;
+  }
 
+  // REQUIRES: the parent pointers of the children of 'node' are correct
+  // EFFECTS: Returns whether the recorded shape of 'node' matches
+  //          its children, the parent pointers of its children point back
+  //          to it, and, if the Balance policy is self-balancing, the
+  //          heights of its subtrees differ by at most one.
+  static bool check_node_balance_impl(const Node *node) {
+    int left = node_height_impl(node->left);
+    int right = node_height_impl(node->right);
+    if(node->height != 1 + std::max(left, right)){
+      return false;
+    }
+    if(node->size != 1 + node_size_impl(node->left) + node_size_impl(node->right)){
+      return false;
+    }
+    if(node->path_length != path_length_from_children_impl(node)
+       || node->chains != chains_from_children_impl(node)){
+      return false;
+    }
+    if((node->left && node->left->parent != node)
+       || (node->right && node->right->parent != node)){
+      return false;
+    }
+    return !Balance::self_balancing || std::abs(left - right) <= 1;
+  }
+
+  // EFFECTS: Returns whether the balance invariant holds on the tree
+  //          rooted at 'node'.
+  // NOTE:    Each node's child links are verified before the pre-order
+  //          walk follows them, so the walk is safe on a broken tree.
+  static bool check_balance_invariant_impl(Node *node) {
+    for(; node; node = preorder_next_impl(node)){
+      if(!check_node_balance_impl(node)){
+        return false;
+      }
+    }
+    return true;
   }
 
   // EFFECTS : Traverses the tree rooted at 'node' using an in-order traversal,
@@ -515,16 +2675,32 @@ private:
   //           by a space (there will be an "extra" space at the end).
   //           If the tree is empty, nothing is printed.
   // MODIFIES: os
-  // NOTE: This function must be tree recursive.
-  //       See https://en.wikipedia.org/wiki/Tree_traversal#In-order
+  // NOTE: See https://en.wikipedia.org/wiki/Tree_traversal#In-order
   //       for the definition of a in-order traversal.
-  static void traverse_inorder_impl(const Node *node, std::ostream &os) {
-    if(!node){
-      return;
+  static void traverse_inorder_impl(Node *node, std::ostream &os) {
+    for(node = min_element_impl(node); node; node = successor_impl(node)){
+      os << node->datum << " ";
+    }
+  }
+
+  // EFFECTS : Returns the number of bytes Binary_codec<T> encodes the
+  //           elements of the tree rooted at 'node' into.
+  static size_t encoded_size_impl(Node *node) {
+    size_t bytes = 0;
+    for(node = min_element_impl(node); node; node = successor_impl(node)){
+      bytes += Binary_codec<T>::size(node->datum);
+    }
+    return bytes;
+  }
+
+  // REQUIRES: 'out' has room for encoded_size_impl(node) bytes
+  // MODIFIES: out
+  // EFFECTS : Encodes the elements of the tree rooted at 'node' to 'out'
+  //           in sorted order.
+  static void encode_impl(Node *node, char *out) {
+    for(node = min_element_impl(node); node; node = successor_impl(node)){
+      out = Binary_codec<T>::encode(node->datum, out);
     }
-    traverse_inorder_impl(node->left,os);
-    os << node->datum << " ";
-    traverse_inorder_impl(node->right,os);
   }
 
   // EFFECTS : Traverses the tree rooted at 'node' using a pre-order traversal,
@@ -532,16 +2708,69 @@ private:
   //           by a space (there will be an "extra" space at the end).
   //           If the tree is empty, nothing is printed.
   // MODIFIES: os
-  // NOTE: This function must be tree recursive.
-  //       See https://en.wikipedia.org/wiki/Tree_traversal#Pre-order
+  // NOTE: See https://en.wikipedia.org/wiki/Tree_traversal#Pre-order
   //       for the definition of a pre-order traversal.
-  static void traverse_preorder_impl(const Node *node, std::ostream &os) {
+  static void traverse_preorder_impl(Node *node, std::ostream &os) {
+    for(; node; node = preorder_next_impl(node)){
+      os << node->datum << " ";
+    }
+  }
+
+  // EFFECTS : Returns a pointer to the Node holding the element with
+  //           exactly k smaller elements in the tree rooted at 'node', or a
+  //           null pointer if the tree has k or fewer elements.
+  static Node * nth_element_impl(Node *node, size_t k) {
+    while(node){
+      size_t left = node_size_impl(node->left);
+      if(k < left){
+        node = node->left;
+      }
+      else if(k == left){
+        return node;
+      }
+      else{
+        k -= left + 1;
+        node = node->right;
+      }
+    }
+    return nullptr;
+  }
+
+  // REQUIRES: 'node' is null or a node of the tree rooted at 'root'
+  // EFFECTS : Returns the number of elements before 'node' in sorted
+  //           order, or the size of the tree if 'node' is null, so that
+  //           nth_element_impl(root, position) finds 'node' again.
+  static size_t position_impl(const Node *node, const Node *root) {
     if(!node){
-      return;
+      return node_size_impl(root);
+    }
+    size_t position = node_size_impl(node->left);
+    for(; node->parent; node = node->parent){
+      if(node == node->parent->right){
+        position += node_size_impl(node->parent->left) + 1;
+      }
+    }
+    return position;
+  }
+
+  // EFFECTS : Returns the number of elements in the tree rooted at 'node'
+  //           that are less than 'val'.
+  // NOTE: K is T unless Compare is transparent.
+  template <typename K, typename Less>
+  static size_t rank_impl(const Node *node, const K &val, Less less) {
+    Search_trace<Less> trace(less);
+    size_t rank = 0;
+    while(node){
+      trace.visit();
+      if(less(node->datum, val)){
+        rank += node_size_impl(node->left) + 1;
+        node = node->right;
+      }
+      else{
+        node = node->left;
+      }
     }
-    os << node->datum << " ";
-    traverse_preorder_impl(node->left,os);
-    traverse_preorder_impl(node->right,os);
+    return rank;
   }
 
   // EFFECTS : Returns a pointer to the Node containing the smallest element
@@ -549,32 +2778,46 @@ private:
   //           Returns a null pointer if the tree is empty or if it does not
   //           contain any elements that are greater than 'val'.
   //
-  // NOTE: This function must be linear recursive.
-  // NOTE: This function is used in the implementation of the ++ operator for
-  //       the iterator code that is provided for you.
   // HINT: At each step, compare 'val' the the current node (using the
   //       'less' parameter). Based on the result, you gain some information
   //       about where the element you're looking for could be.
-  static Node * min_greater_than_impl(Node *node, const T &val, Compare less) {
-    if(!node){
-      return nullptr;
-    }
-    if(less(val,node->datum)){//if val is less than node->datum
-      //check if left fits criteria better
-      Node* left = min_greater_than_impl(node->left,val,less);
-      if(left){
-        return left;
-      }else{
-        return node;
+  template <typename K, typename Less>
+  static Node * min_greater_than_impl(Node *node, const K &val, Less less) {
+    Search_trace<Less> trace(less);
+    Node *best = nullptr;
+    while(node){
+      trace.visit();
+      if(less(val,node->datum)){
+        // node qualifies, but the left subtree may hold a closer one
+        best = node;
+        node = node->left;
+      }
+      else{
+        node = node->right;
       }
-    }else{
-      //go to right side then
-      return min_greater_than_impl(node->right,val,less);
+    }
+    return best;
+  }
 
+  // EFFECTS : Returns a pointer to the Node containing the smallest element
+  //           in the tree rooted at 'node' that is not less than 'val', or
+  //           a null pointer if there is none.
+  template <typename K, typename Less>
+  static Node * lower_bound_impl(Node *node, const K &val, Less less) {
+    Search_trace<Less> trace(less);
+    Node *best = nullptr;
+    while(node){
+      trace.visit();
+      if(less(node->datum, val)){
+        node = node->right;
+      }
+      else{
+        // node qualifies, but the left subtree may hold a closer one
+        best = node;
+        node = node->left;
+      }
     }
-    
-    
-    
+    return best;
   }
 
 
@@ -595,9 +2838,9 @@ private:
 //           BinarySearchTree Iterator, which in turn depends on some
 //           of the functions you must write.
 
-template <typename T, typename Compare>
+template <typename T, typename Compare, typename Balance, typename Allocator>
 std::ostream &operator<<(std::ostream &os,
-                         const BinarySearchTree<T, Compare> &tree) {
+                         const BinarySearchTree<T, Compare, Balance, Allocator> &tree) {
 // DO NOT CHANGE THE IMPLEMENTATION OF THIS FUNCTION
   os << "[ ";
   for (T& elt : tree) {
@@ -0,0 +1,670 @@
+#include "BinarySearchTree.hpp"
+#include "NodePool.hpp"
+#include "Map.hpp"
+#include "ConcurrentMap.hpp"
+#include "ShardedMap.hpp"
+#include "PersistentTree.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+// make bench
+// ./BinarySearchTree_bench.exe [max keys]
+
+// EFFECTS: Returns the nanoseconds elapsed since 'start'.
+static double elapsed_ns(chrono::steady_clock::time_point start) {
+  chrono::duration<double, nano> d = chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+// EFFECTS: Prints one result line: name, number of keys, ns/op.
+static void report(const string &name, size_t n, double total_ns) {
+  cout << name << " n=" << n << " " << total_ns / n << " ns/op" << endl;
+}
+
+// EFFECTS: Inserts 0..n-1 in ascending order, then looks each key up,
+//          walks the tree in order, and copies and destroys it.
+template <typename Balance>
+static void bench_sorted_insert(const string &name, size_t n) {
+  BinarySearchTree<int, less<int>, Balance> tree;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    tree.insert(static_cast<int>(i));
+  }
+  report(name + " sorted insert", n, elapsed_ns(start));
+
+  start = chrono::steady_clock::now();
+  size_t found = 0;
+  for (size_t i = 0; i < n; ++i) {
+    found += tree.find(static_cast<int>(i)) != tree.end();
+  }
+  report(name + " find", n, elapsed_ns(start));
+
+  start = chrono::steady_clock::now();
+  long long sum = 0;
+  for (int elt : tree) {
+    sum += elt;
+  }
+  report(name + " iterate", n, elapsed_ns(start));
+
+  start = chrono::steady_clock::now();
+  {
+    BinarySearchTree<int, less<int>, Balance> copy(tree);
+    report(name + " copy", n, elapsed_ns(start));
+    start = chrono::steady_clock::now();
+  }
+  report(name + " destroy", n, elapsed_ns(start));
+  cout << "  height=" << tree.height() << " found=" << found
+       << " sum=" << sum << endl;
+}
+
+// EFFECTS: Inserts n pseudo-random keys into a balanced tree using the
+//          given allocator, then destroys the tree.
+template <typename Allocator>
+static void bench_allocator(const string &name, size_t n) {
+  auto start = chrono::steady_clock::now();
+  {
+    BinarySearchTree<int, less<int>, AvlBalanced, Allocator> tree;
+    unsigned key = 12345;
+    for (size_t i = 0; i < n; ++i) {
+      key = key * 1103515245u + 12345u;
+      if (tree.find(static_cast<int>(key >> 1)) == tree.end()) {
+        tree.insert(static_cast<int>(key >> 1));
+      }
+    }
+    report(name + " random insert", n, elapsed_ns(start));
+    start = chrono::steady_clock::now();
+  }
+  report(name + " destroy", n, elapsed_ns(start));
+}
+
+// EFFECTS: Fills a balanced tree with n pseudo-random keys, then performs
+//          n steady-state operations that each erase one key and insert a
+//          fresh one, so the size stays at n.
+template <typename Allocator>
+static void bench_insert_erase(const string &name, size_t n) {
+  BinarySearchTree<int, less<int>, AvlBalanced, Allocator> tree;
+  unsigned key = 12345;
+  while (tree.size() < n) {
+    key = key * 1103515245u + 12345u;
+    tree.try_insert(static_cast<int>(key >> 1));
+  }
+  unsigned victim = 12345;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    victim = victim * 1103515245u + 12345u;
+    tree.erase(tree.nth_element(victim % n));
+    do {
+      key = key * 1103515245u + 12345u;
+    } while (!tree.try_insert(static_cast<int>(key >> 1)).second);
+  }
+  report(name + " erase+insert", n, elapsed_ns(start));
+  cout << "  size=" << tree.size() << " height=" << tree.height() << endl;
+}
+
+// EFFECTS: Loads n sorted key-value pairs into a Map with assign_sorted
+//          and, if by_insert is set, also by inserting them one at a time.
+static void bench_sorted_load(size_t n, bool by_insert) {
+  vector<pair<int, int>> snapshot;
+  snapshot.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    snapshot.emplace_back(static_cast<int>(i), static_cast<int>(i));
+  }
+  auto start = chrono::steady_clock::now();
+  if (by_insert) {
+    Map<int, int> map;
+    for (const pair<int, int> &entry : snapshot) {
+      map.insert(entry);
+    }
+    report("map sorted load by insert", n, elapsed_ns(start));
+  }
+  start = chrono::steady_clock::now();
+  Map<int, int> map;
+  map.assign_sorted(snapshot.begin(), snapshot.end());
+  double load_ns = elapsed_ns(start);
+  report("map sorted load by assign_sorted", n, load_ns);
+  cout << "  total=" << load_ns / 1e6 << " ms size=" << map.size() << endl;
+}
+
+// EFFECTS: Fills a Map with the given storage with n pseudo-random keys,
+//          then times random successful lookups in batches of 16 and
+//          prints percentiles of the per-lookup latency.
+template <typename Storage>
+static void bench_lookup_latency(const string &name, size_t n) {
+  Map<int, int, less<int>, Storage> map;
+  vector<int> keys;
+  keys.reserve(n);
+  unsigned key = 12345;
+  auto start = chrono::steady_clock::now();
+  while (map.size() < n) {
+    key = key * 1103515245u + 12345u;
+    int k = static_cast<int>(key >> 1);
+    if (map.insert({ k, k }).second) {
+      keys.push_back(k);
+    }
+  }
+  report(name + " random insert", n, elapsed_ns(start));
+
+  const size_t batch = 16;
+  vector<double> samples(20000);
+  unsigned pick = 777;
+  long long sum = 0;
+  for (double &sample : samples) {
+    start = chrono::steady_clock::now();
+    for (size_t j = 0; j < batch; ++j) {
+      pick = pick * 1103515245u + 12345u;
+      sum += map.find(keys[(pick >> 4) % n])->second;
+    }
+    sample = elapsed_ns(start) / batch;
+  }
+  sort(samples.begin(), samples.end());
+  size_t last = samples.size() - 1;
+  cout << name << " lookup n=" << n << " p50=" << samples[last / 2]
+       << " p90=" << samples[last * 9 / 10]
+       << " p99=" << samples[last * 99 / 100]
+       << " p99.9=" << samples[last * 999 / 1000] << " ns/op"
+       << " sum=" << sum << endl;
+}
+
+// EFFECTS: Times random successful lookups of keys in items, which is a
+//          tree or a snapshot, and returns the sum of the elements found.
+template <typename Searchable>
+static long long time_lookups(const string &name, const Searchable &items,
+                              const vector<int> &keys) {
+  const size_t lookups = 2000000;
+  unsigned pick = 777;
+  long long sum = 0;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < lookups; ++i) {
+    pick = pick * 1103515245u + 12345u;
+    sum += *items.find(keys[(pick >> 4) % keys.size()]);
+  }
+  double total_ns = elapsed_ns(start) * keys.size() / lookups;
+  report(name + " lookup", keys.size(), total_ns);
+  return sum;
+}
+
+// EFFECTS: Fills an AVL tree with n pseudo-random keys and freezes it,
+//          then compares random lookups and an in-order walk of the tree
+//          with the same operations on the snapshot.
+static void bench_frozen(size_t n) {
+  BinarySearchTree<int, less<int>, AvlBalanced> tree;
+  vector<int> keys;
+  keys.reserve(n);
+  unsigned key = 12345;
+  while (tree.size() < n) {
+    key = key * 1103515245u + 12345u;
+    int k = static_cast<int>(key >> 1);
+    if (tree.try_insert(k).second) {
+      keys.push_back(k);
+    }
+  }
+  auto start = chrono::steady_clock::now();
+  FrozenTree<int> frozen = tree.freeze();
+  report("freeze", n, elapsed_ns(start));
+
+  long long sum = time_lookups("avl tree", tree, keys);
+  sum += time_lookups("frozen", frozen, keys);
+  start = chrono::steady_clock::now();
+  for (int item : tree) {
+    sum += item;
+  }
+  report("avl tree walk", n, elapsed_ns(start));
+  start = chrono::steady_clock::now();
+  for (int item : frozen) {
+    sum += item;
+  }
+  report("frozen walk", n, elapsed_ns(start));
+  cout << "  sum=" << sum << endl;
+}
+
+// Orders keys like std::less, but is not recognized as the built-in <, so
+// a BTree using it searches its nodes by calling it.
+struct Opaque_less {
+  template <typename K>
+  bool operator()(const K &a, const K &b) const {
+    return a < b;
+  }
+};
+
+// EFFECTS: Returns the processor's time stamp counter, or 0 where there is
+//          none.
+static uint64_t cycles_now() {
+#if defined(__x86_64__) && defined(__GNUC__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// EFFECTS: Loads n keys into a BTree-backed Map with the given comparator,
+//          then times random lookups and prints ns and cycles per lookup.
+template <typename Key, typename Compare>
+static void bench_key_search(const string &name, size_t n) {
+  vector<pair<Key, int>> entries;
+  entries.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    entries.emplace_back(static_cast<Key>(2 * i), static_cast<int>(i));
+  }
+  Map<Key, int, Compare, BTreeStorage> map;
+  map.assign_sorted(entries.begin(), entries.end());
+  const size_t lookups = 2000000;
+  unsigned pick = 777;
+  long long sum = 0;
+  auto start = chrono::steady_clock::now();
+  uint64_t start_cycles = cycles_now();
+  for (size_t i = 0; i < lookups; ++i) {
+    pick = pick * 1103515245u + 12345u;
+    sum += map.find(static_cast<Key>(2 * ((pick >> 4) % n)))->second;
+  }
+  double cycles = static_cast<double>(cycles_now() - start_cycles);
+  report(name + " lookup", n, elapsed_ns(start) * n / lookups);
+  cout << "  cycles/op=" << cycles / lookups << " sum=" << sum << endl;
+}
+
+// Counts every comparison made through it.
+static size_t compare_calls = 0;
+struct CountingLess {
+  bool operator()(int a, int b) const {
+    ++compare_calls;
+    return a < b;
+  }
+};
+
+// EFFECTS: Inserts n pseudo-random keys into a Map with insert(), then
+//          updates each one through operator[], and reports the number of
+//          comparator calls per operation.
+static void bench_map_insert(size_t n) {
+  Map<int, int, CountingLess> map;
+  compare_calls = 0;
+  auto start = chrono::steady_clock::now();
+  unsigned key = 12345;
+  for (size_t i = 0; i < n; ++i) {
+    key = key * 1103515245u + 12345u;
+    map.insert({ static_cast<int>(key >> 1), 0 });
+  }
+  report("map insert", n, elapsed_ns(start));
+  cout << "  comparisons/op=" << double(compare_calls) / n << endl;
+
+  compare_calls = 0;
+  start = chrono::steady_clock::now();
+  key = 12345;
+  for (size_t i = 0; i < n; ++i) {
+    key = key * 1103515245u + 12345u;
+    ++map[static_cast<int>(key >> 1)];
+  }
+  report("map operator[]", n, elapsed_ns(start));
+  cout << "  comparisons/op=" << double(compare_calls) / n << endl;
+}
+
+// EFFECTS: Builds an AVL tree and a PersistentTree of n keys, then times
+//          taking a snapshot (a shared copy) of each followed by one
+//          insertion, as a reader holding a consistent view while a writer
+//          moves on.
+static void bench_snapshots(size_t n) {
+  BinarySearchTree<int, less<int>, AvlBalanced> tree;
+  PersistentTree<int> persistent;
+  for (size_t i = 0; i < n; ++i) {
+    tree.try_insert(static_cast<int>(2 * i));
+    persistent = persistent.insert(static_cast<int>(2 * i));
+  }
+  const size_t rounds = 100;
+  size_t total = 0;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i) {
+    BinarySearchTree<int, less<int>, AvlBalanced> snapshot(tree.share());
+    tree.try_insert(static_cast<int>(2 * i + 1));
+    total += snapshot.size();
+  }
+  report("avl tree snapshot+insert", n, elapsed_ns(start) * n / rounds);
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i) {
+    PersistentTree<int> snapshot(persistent);
+    persistent = persistent.insert(static_cast<int>(2 * i + 1));
+    total += snapshot.size();
+  }
+  report("persistent snapshot+insert", n, elapsed_ns(start) * n / rounds);
+  cout << "  total=" << total << endl;
+}
+
+// EFFECTS: Builds a Map of n entries, then times sharing it and reading
+//          the shared copy through cfind, which keeps sharing the
+//          original's nodes, against sharing it and then changing the
+//          copy, which pays for the node copy on that first change.
+static void bench_map_copy(size_t n) {
+  vector<pair<int, int>> entries(n);
+  for (size_t i = 0; i < n; ++i) {
+    entries[i] = { static_cast<int>(i), static_cast<int>(i) };
+  }
+  Map<int, int> original(entries.begin(), entries.end());
+  const size_t rounds = 100;
+  long total = 0;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i) {
+    Map<int, int> copy(original.share());
+    total += copy.cfind(static_cast<int>(i % n))->second;
+  }
+  report("map share+read", n, elapsed_ns(start) * n / rounds);
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; ++i) {
+    Map<int, int> copy(original.share());
+    copy[static_cast<int>(i % n)] = -1;
+    total += copy.size();
+  }
+  report("map share+write", n, elapsed_ns(start) * n / rounds);
+  cout << "  total=" << total << endl;
+}
+
+// EFFECTS: Times building a tree from n shuffled keys (assign_unsorted),
+//          copying all its nodes and freeing them, each on up to 'threads'
+//          threads.
+static void bench_parallel(size_t n, size_t threads) {
+  vector<int> keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = static_cast<int>(i);
+  }
+  shuffle(keys.begin(), keys.end(), mt19937(12345));
+  string suffix = " threads=" + to_string(threads);
+  BinarySearchTree<int, less<int>, AvlBalanced> tree;
+  tree.set_parallelism(threads);
+  auto start = chrono::steady_clock::now();
+  tree.assign_unsorted(keys.begin(), keys.end());
+  report("parallel build" + suffix, n, elapsed_ns(start));
+  auto *copy = new BinarySearchTree<int, less<int>, AvlBalanced>(tree);
+  start = chrono::steady_clock::now();
+  copy->begin();  // copies the shared nodes
+  report("parallel copy" + suffix, n, elapsed_ns(start));
+  start = chrono::steady_clock::now();
+  delete copy;
+  report("parallel destroy" + suffix, n, elapsed_ns(start));
+}
+
+// EFFECTS: Builds a balanced tree of the keys 0..n-1, then times visiting
+//          windows of 'width' consecutive keys by re-searching for each
+//          next key with min_greater_than, by range(), and counting the
+//          windows with count_range. Prints ns per window.
+static void bench_range_scan(size_t n, size_t width) {
+  vector<int> keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = static_cast<int>(i);
+  }
+  BinarySearchTree<int, less<int>, AvlBalanced> tree(keys.begin(), keys.end());
+  const size_t windows = 20000;
+  vector<int> starts(windows);
+  mt19937 pick(12345);
+  for (int &lo : starts) {
+    lo = static_cast<int>(pick() % (n - width));
+  }
+  string suffix = " width=" + to_string(width);
+  long long sum = 0;
+  auto start = chrono::steady_clock::now();
+  for (int lo : starts) {
+    int hi = lo + static_cast<int>(width);
+    for (auto it = tree.find(lo); it != tree.end() && *it < hi;
+         it = tree.min_greater_than(*it)) {
+      sum += *it;
+    }
+  }
+  report("range by re-search" + suffix, windows, elapsed_ns(start));
+  start = chrono::steady_clock::now();
+  for (int lo : starts) {
+    for (int item : tree.range(lo, lo + static_cast<int>(width))) {
+      sum += item;
+    }
+  }
+  report("range view" + suffix, windows, elapsed_ns(start));
+  start = chrono::steady_clock::now();
+  for (int lo : starts) {
+    sum += tree.count_range(lo, lo + static_cast<int>(width));
+  }
+  report("count_range" + suffix, windows, elapsed_ns(start));
+  cout << "  sum=" << sum << endl;
+}
+
+// EFFECTS: Merges a tree of 'delta' random keys into a tree of n keys
+//          by inserting them one at a time, by union_with, and by merge,
+//          which relinks the delta's nodes. Prints ns per delta key.
+static void bench_set_merge(size_t n, size_t delta) {
+  using Tree = BinarySearchTree<int, less<int>, AvlBalanced>;
+  vector<int> keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = static_cast<int>(3 * i);
+  }
+  vector<int> extra(delta);
+  mt19937 pick(777);
+  for (int &key : extra) {
+    key = static_cast<int>(pick() % (3 * n));
+  }
+  string suffix = " base=" + to_string(n);
+  size_t sizes = 0;
+  for (int method = 0; method < 3; ++method) {
+    Tree base(keys.begin(), keys.end());
+    Tree incoming;
+    incoming.assign_unsorted(extra.begin(), extra.end());
+    auto start = chrono::steady_clock::now();
+    if (method == 0) {
+      for (int key : incoming) {
+        base.try_insert(key);
+      }
+    }
+    else if (method == 1) {
+      base.union_with(incoming);
+    }
+    else {
+      base.merge(std::move(incoming));
+    }
+    double ns = elapsed_ns(start);
+    const char *names[] = { "merge by insert", "union_with", "merge" };
+    report(names[method] + suffix, delta, ns);
+    sizes += base.size();
+  }
+  cout << "  sizes=" << sizes << endl;
+}
+
+// EFFECTS: Inserts 0..n-1 in ascending order into an Unbalanced tree that
+//          rebalances itself whenever it grows past 'factor' times its
+//          optimal height, and into an AVL tree for comparison, then
+//          rebalances a degenerate tree of n elements in place.
+static void bench_rebalance(size_t n, double factor) {
+  string suffix = " factor=" + to_string(factor).substr(0, 3);
+  BinarySearchTree<int> limited;
+  limited.set_rebalance_factor(factor);
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    limited.insert(static_cast<int>(i));
+  }
+  report("unbalanced sorted insert" + suffix, n, elapsed_ns(start));
+  BinarySearchTree<int, less<int>, AvlBalanced> avl;
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    avl.insert(static_cast<int>(i));
+  }
+  report("avl sorted insert", n, elapsed_ns(start));
+  limited.set_rebalance_factor(0);
+  for (size_t i = n; i < 2 * n; ++i) {
+    limited.insert(static_cast<int>(i));
+  }
+  start = chrono::steady_clock::now();
+  limited.rebalance();
+  report("rebalance after sorted run", 2 * n, elapsed_ns(start));
+  cout << "  height=" << limited.height() << " avl height=" << avl.height()
+       << endl;
+}
+
+// A Map shared the usual way: every access holds one global mutex.
+struct Locked_map {
+  Map<int, int> contents;
+  mutable mutex lock;
+
+  Locked_map() = default;
+
+  explicit Locked_map(const Map<int, int> &contents_in)
+    : contents(contents_in) { }
+
+  optional<int> find(int k) const {
+    lock_guard<mutex> guard(lock);
+    auto it = contents.find(k);
+    return it == contents.end() ? optional<int>() : optional<int>(it->second);
+  }
+
+  void insert_or_assign(int k, int v) {
+    lock_guard<mutex> guard(lock);
+    contents[k] = v;
+  }
+};
+
+// EFFECTS: Shares a Map of keys 0..n-1, loaded in random order, then runs
+//          'threads' readers that each do random lookups while one writer
+//          reassigns a key every millisecond, and prints the lookups per second
+//          over all readers.
+template <typename Shared>
+static void bench_shared_reads(const string &name, size_t n, size_t threads) {
+  vector<int> keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = static_cast<int>(i);
+  }
+  shuffle(keys.begin(), keys.end(), mt19937(12345));
+  Map<int, int> contents;
+  for (int k : keys) {
+    contents[k] = k;
+  }
+  Shared shared(contents);
+  const size_t lookups = 200000;
+  atomic<bool> done(false);
+  atomic<long long> sum(0);
+  thread writer([&]() {
+    for (unsigned key = 1; !done.load(); key = key * 1103515245u + 12345u) {
+      shared.insert_or_assign(static_cast<int>((key >> 4) % n), 0);
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+  });
+  vector<thread> readers;
+  auto start = chrono::steady_clock::now();
+  for (size_t t = 0; t < threads; ++t) {
+    readers.emplace_back([&, t]() {
+      unsigned pick = 777 + static_cast<unsigned>(t);
+      long long local = 0;
+      for (size_t i = 0; i < lookups; ++i) {
+        pick = pick * 1103515245u + 12345u;
+        local += *shared.find(static_cast<int>((pick >> 4) % n));
+      }
+      sum += local;
+    });
+  }
+  for (thread &reader : readers) {
+    reader.join();
+  }
+  double seconds = elapsed_ns(start) / 1e9;
+  done = true;
+  writer.join();
+  cout << name << " n=" << n << " threads=" << threads << " "
+       << lookups * threads / seconds / 1e6 << " Mlookups/s"
+       << " sum=" << sum.load() << endl;
+}
+
+// EFFECTS: Runs 'threads' writers that each assign values to random keys
+//          of an initially empty shared map, and prints the writes per
+//          second over all writers.
+template <typename Shared>
+static void bench_shared_writes(const string &name, size_t threads) {
+  Shared shared;
+  const size_t writes = 100000;
+  vector<thread> writers;
+  auto start = chrono::steady_clock::now();
+  for (size_t t = 0; t < threads; ++t) {
+    writers.emplace_back([&, t]() {
+      unsigned key = 12345 + static_cast<unsigned>(t);
+      for (size_t i = 0; i < writes; ++i) {
+        key = key * 1103515245u + 12345u;
+        shared.insert_or_assign(static_cast<int>((key >> 4) % 1000000), 1);
+      }
+    });
+  }
+  for (thread &writer : writers) {
+    writer.join();
+  }
+  double seconds = elapsed_ns(start) / 1e9;
+  cout << name << " threads=" << threads << " "
+       << writes * threads / seconds / 1e6 << " Mwrites/s" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  size_t max_keys = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+
+  // The unbalanced tree is quadratic on sorted input, so it is only
+  // measured at small sizes for comparison.
+  for (size_t n = 1000; n <= 10000 && n <= max_keys; n *= 10) {
+    bench_sorted_insert<Unbalanced>("unbalanced", n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_sorted_insert<AvlBalanced>("avl", n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_allocator<allocator<int>>("std::allocator", n);
+    bench_allocator<Pool_allocator<int>>("Pool_allocator", n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_insert_erase<allocator<int>>("std::allocator", n);
+    bench_insert_erase<Pool_allocator<int>>("Pool_allocator", n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_lookup_latency<TreeStorage>("map tree", n);
+    bench_lookup_latency<BTreeStorage>("map btree", n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_frozen(n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_key_search<int32_t, less<int32_t>>("btree int32 simd", n);
+    bench_key_search<int32_t, Opaque_less>("btree int32 scalar", n);
+    bench_key_search<int64_t, less<int64_t>>("btree int64 simd", n);
+    bench_key_search<int64_t, Opaque_less>("btree int64 scalar", n);
+    bench_key_search<double, less<double>>("btree double simd", n);
+    bench_key_search<double, Opaque_less>("btree double scalar", n);
+  }
+  // Map uses the unbalanced tree, so loading it by insertion is quadratic
+  // and only measured at small sizes.
+  for (size_t n = 1000; n <= max_keys * 10; n *= 10) {
+    bench_sorted_load(n, n <= 10000);
+  }
+  for (size_t n = 1000; n <= max_keys && n <= 100000; n *= 10) {
+    bench_map_insert(n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_snapshots(n);
+  }
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    bench_map_copy(n);
+  }
+  for (size_t threads = 1; threads <= 8; threads *= 2) {
+    bench_parallel(max_keys, threads);
+  }
+  for (size_t width = 10; width <= 1000 && width < max_keys; width *= 10) {
+    bench_range_scan(max_keys, width);
+  }
+  for (size_t delta = 1000; delta <= max_keys; delta *= 10) {
+    bench_set_merge(max_keys, delta);
+  }
+  for (double factor : { 1.5, 2.0, 3.0 }) {
+    bench_rebalance(min<size_t>(max_keys, 100000), factor);
+  }
+  for (size_t threads = 1; threads <= 64; threads *= 2) {
+    bench_shared_reads<Locked_map>("mutex map", 10000, threads);
+    bench_shared_reads<ConcurrentMap<int, int>>("concurrent map", 10000, threads);
+  }
+  for (size_t threads = 1; threads <= 64; threads *= 2) {
+    bench_shared_writes<Locked_map>("mutex map writes", threads);
+    bench_shared_writes<ShardedMap<int, int>>("sharded map writes", threads);
+  }
+}
@@ -1,10 +1,19 @@
 #include "BinarySearchTree.hpp"
+#include "NodePool.hpp"
 #include "unit_test_framework.hpp"
 // make BinarySearchTree_tests.exe
 // ./BinarySearchTree_tests.exe
 using namespace std;
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <sstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <pthread.h>
 TEST(test_empty) {
     BinarySearchTree<int> tree;
     ASSERT_TRUE(tree.empty());
@@ -329,7 +338,1466 @@ TEST(swap_in_greater_value_in_left_branch_check_sorts){
     *it3 = 55;
     ASSERT_FALSE(t6.check_sorting_invariant());
 }
+TEST(avl_sorted_inserts_stay_balanced){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 0; i < 1000; ++i) {
+        t.insert(i);
+    }
+    ASSERT_EQUAL(t.size(), 1000);
+    ASSERT_TRUE(t.height() <= 14);
+    ASSERT_TRUE(t.check_sorting_invariant());
+    ASSERT_TRUE(t.check_balance_invariant());
+    int expected = 0;
+    for (int elt : t) {
+        ASSERT_EQUAL(elt, expected);
+        ++expected;
+    }
+}
+TEST(avl_single_rotations){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    t.insert(1);
+    t.insert(2);
+    t.insert(3);
+    ostringstream oss;
+    t.traverse_preorder(oss);
+    ASSERT_EQUAL(oss.str(), "2 1 3 ");
+    ASSERT_EQUAL(t.height(), 2);
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t2;
+    t2.insert(3);
+    t2.insert(2);
+    t2.insert(1);
+    ostringstream oss2;
+    t2.traverse_preorder(oss2);
+    ASSERT_EQUAL(oss2.str(), "2 1 3 ");
+}
+TEST(avl_double_rotations){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    t.insert(3);
+    t.insert(1);
+    t.insert(2);
+    ostringstream oss;
+    t.traverse_preorder(oss);
+    ASSERT_EQUAL(oss.str(), "2 1 3 ");
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t2;
+    t2.insert(1);
+    t2.insert(3);
+    t2.insert(2);
+    ostringstream oss2;
+    t2.traverse_preorder(oss2);
+    ASSERT_EQUAL(oss2.str(), "2 1 3 ");
+    ASSERT_TRUE(t2.check_balance_invariant());
+}
+TEST(avl_copy_keeps_balance){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 100; i > 0; --i) {
+        t.insert(i);
+    }
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t2(t);
+    ASSERT_EQUAL(t2.height(), t.height());
+    ASSERT_TRUE(t2.check_balance_invariant());
+    t2.insert(0);
+    ASSERT_TRUE(t2.check_balance_invariant());
+    ASSERT_EQUAL(*t2.min_element(), 0);
+}
+TEST(unbalanced_check_balance_invariant){
+    BinarySearchTree<int> t;
+    t.insert(1);
+    t.insert(2);
+    t.insert(3);
+    ASSERT_EQUAL(t.height(), 3);
+    ASSERT_TRUE(t.check_balance_invariant());
+}
+// Counts every comparison made through it, to check which operations
+// touch the comparator.
+static int compare_calls = 0;
+struct CountingLess {
+    bool operator()(int a, int b) const {
+        ++compare_calls;
+        return a < b;
+    }
+};
+TEST(iteration_does_no_comparisons){
+    BinarySearchTree<int, CountingLess> t;
+    int keys[] = { 50, 30, 70, 20, 40, 60, 80, 35, 45, 65 };
+    for (int k : keys) {
+        t.insert(k);
+    }
+    compare_calls = 0;
+    int count = 0;
+    int prev = -1;
+    for (int elt : t) {
+        ASSERT_TRUE(prev < elt);
+        prev = elt;
+        ++count;
+    }
+    ASSERT_EQUAL(count, 10);
+    ASSERT_EQUAL(compare_calls, 0);
+}
+TEST(minusminusoperator){
+    BinarySearchTree<int> t;
+    int keys[] = { 50, 30, 70, 20, 40, 60, 80, 35, 45, 65 };
+    for (int k : keys) {
+        t.insert(k);
+    }
+    auto it = t.end();
+    --it;
+    ASSERT_EQUAL(*it, 80);
+    auto it2 = it--;
+    ASSERT_EQUAL(*it2, 80);
+    ASSERT_EQUAL(*it, 70);
+    int expected[] = { 65, 60, 50, 45, 40, 35, 30, 20 };
+    for (int e : expected) {
+        --it;
+        ASSERT_EQUAL(*it, e);
+    }
+    ASSERT_EQUAL(it, t.begin());
+    ++it;
+    --it;
+    ASSERT_EQUAL(*it, 20);
+}
+TEST(avl_iterators_after_rotations){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 0; i < 200; ++i) {
+        t.insert((i * 77) % 200);
+    }
+    ASSERT_TRUE(t.check_balance_invariant());
+    int expected = 199;
+    auto it = t.end();
+    while (it != t.begin()) {
+        --it;
+        ASSERT_EQUAL(*it, expected);
+        --expected;
+    }
+    ASSERT_EQUAL(expected, -1);
+    BinarySearchTree<int, std::less<int>, AvlBalanced> copy(t);
+    ASSERT_TRUE(copy.check_balance_invariant());
+    ASSERT_EQUAL(*--copy.end(), 199);
+}
+TEST(cached_size_after_inserts_and_copy){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 0; i < 100; ++i) {
+        t.insert((i * 37) % 100);
+        ASSERT_EQUAL(t.size(), i + 1);
+    }
+    t.insert(1000);
+    ASSERT_EQUAL(t.size(), 101);
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t2(t);
+    ASSERT_EQUAL(t2.size(), 101);
+    ASSERT_TRUE(t2.check_balance_invariant());
+}
+TEST(nth_element_and_rank){
+    BinarySearchTree<int> t;
+    int keys[] = { 50, 30, 70, 20, 40, 60, 80, 35, 45, 65 };
+    for (int k : keys) {
+        t.insert(k);
+    }
+    int sorted[] = { 20, 30, 35, 40, 45, 50, 60, 65, 70, 80 };
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_EQUAL(*t.nth_element(i), sorted[i]);
+        ASSERT_EQUAL(t.rank(sorted[i]), i);
+    }
+    ASSERT_EQUAL(t.nth_element(10), t.end());
+    ASSERT_EQUAL(t.rank(0), 0);
+    ASSERT_EQUAL(t.rank(36), 3);
+    ASSERT_EQUAL(t.rank(1000), 10);
+    BinarySearchTree<int> empty;
+    ASSERT_EQUAL(empty.nth_element(0), empty.end());
+    ASSERT_EQUAL(empty.rank(5), 0);
+}
+TEST(avl_nth_element_after_rotations){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 0; i < 500; ++i) {
+        t.insert(i);
+    }
+    for (size_t i = 0; i < 500; i += 7) {
+        ASSERT_EQUAL(*t.nth_element(i), static_cast<int>(i));
+        ASSERT_EQUAL(t.rank(static_cast<int>(i)), i);
+    }
+}
+TEST(pool_allocator_tree){
+    using PoolTree =
+        BinarySearchTree<int, std::less<int>, AvlBalanced, Pool_allocator<int>>;
+    Pool_allocator<int> pool(4096);
+    PoolTree t(pool);
+    for (int i = 0; i < 1000; ++i) {
+        t.insert((i * 7) % 1000);
+    }
+    ASSERT_EQUAL(t.size(), 1000);
+    ASSERT_TRUE(t.check_balance_invariant());
+    ASSERT_TRUE(t.get_allocator() == pool);
+    size_t reserved = pool.bytes_reserved();
+    ASSERT_TRUE(reserved >= 1000 * sizeof(int));
+    PoolTree copy(t);
+    ASSERT_TRUE(copy.get_allocator() == pool);
+    ASSERT_EQUAL(copy.size(), 1000);
+    ASSERT_EQUAL(*copy.nth_element(500), 500);
+    ASSERT_TRUE(pool.bytes_reserved() > reserved);
+    PoolTree other;
+    ASSERT_TRUE(other.get_allocator() != pool);
+}
+TEST(pool_allocator_reuses_freed_nodes){
+    using PoolTree = BinarySearchTree<std::string, std::less<std::string>,
+                                      Unbalanced, Pool_allocator<std::string>>;
+    PoolTree t;
+    t.insert("m");
+    t.insert("c");
+    t.insert("x");
+    PoolTree t2;
+    t2 = t;
+    size_t reserved = t2.get_allocator().bytes_reserved();
+    for (int i = 0; i < 10; ++i) {
+        t2 = t;
+    }
+    ASSERT_EQUAL(t2.get_allocator().bytes_reserved(), reserved);
+    ostringstream oss;
+    t2.traverse_inorder(oss);
+    ASSERT_EQUAL(oss.str(), "c m x ");
+}
+TEST(pool_allocator_reclaims_nodes_of_destroyed_trees){
+    using PoolTree =
+        BinarySearchTree<int, std::less<int>, AvlBalanced, Pool_allocator<int>>;
+    Pool_allocator<int> pool(4096);
+    size_t reserved = 0;
+    for (int round = 0; round < 100; ++round) {
+        PoolTree t(pool);
+        for (int i = 0; i < 1000; ++i) {
+            t.insert(i);
+        }
+        if (round == 0) {
+            reserved = pool.bytes_reserved();
+        }
+    }
+    ASSERT_EQUAL(pool.bytes_reserved(), reserved);
+    ASSERT_TRUE(pool.releases_in_bulk());
+    PoolTree last(pool);
+    ASSERT_FALSE(pool.releases_in_bulk());
+}
 
+TEST(try_insert){
+    BinarySearchTree<int> t;
+    auto result = t.try_insert(5);
+    ASSERT_TRUE(result.second);
+    ASSERT_EQUAL(*result.first, 5);
+    t.insert(3);
+    t.insert(8);
+    auto again = t.try_insert(3);
+    ASSERT_FALSE(again.second);
+    ASSERT_EQUAL(again.first, t.find(3));
+    ASSERT_EQUAL(t.size(), 3);
+}
+TEST(try_insert_single_descent){
+    BinarySearchTree<int, CountingLess, AvlBalanced> t;
+    for (int i = 0; i < 1023; ++i) {
+        t.insert(i);
+    }
+    ASSERT_EQUAL(t.height(), 10);
+    compare_calls = 0;
+    auto result = t.try_insert(2000);
+    ASSERT_TRUE(result.second);
+    ASSERT_EQUAL(*result.first, 2000);
+    // at most two comparisons per level on one root-to-leaf path
+    ASSERT_TRUE(compare_calls <= 2 * 11);
+    ASSERT_TRUE(t.check_balance_invariant());
+    compare_calls = 0;
+    ASSERT_FALSE(t.try_insert(500).second);
+    ASSERT_TRUE(compare_calls <= 2 * 11);
+}
+TEST(transparent_find){
+    BinarySearchTree<std::string, std::less<>> t;
+    t.insert("pear");
+    t.insert("apple");
+    t.insert("plum");
+    ASSERT_EQUAL(*t.find("plum"), "plum");
+    ASSERT_EQUAL(t.find("fig"), t.end());
+    ASSERT_EQUAL(t.rank("peach"), 1);
+}
+// Counts copies and moves, to check that elements are built in place.
+struct Tracked {
+    static int copies;
+    static int moves;
+    int value;
+    explicit Tracked(int value_in) : value(value_in) {}
+    Tracked(const Tracked &other) : value(other.value) { ++copies; }
+    Tracked(Tracked &&other) : value(other.value) { ++moves; }
+    Tracked &operator=(const Tracked &other) {
+        value = other.value;
+        ++copies;
+        return *this;
+    }
+    bool operator<(const Tracked &rhs) const { return value < rhs.value; }
+};
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+TEST(emplace_constructs_in_place){
+    BinarySearchTree<Tracked, std::less<Tracked>, AvlBalanced> t;
+    Tracked::copies = 0;
+    Tracked::moves = 0;
+    for (int i = 0; i < 50; ++i) {
+        ASSERT_TRUE(t.emplace(i).second);
+    }
+    ASSERT_FALSE(t.emplace(7).second);
+    ASSERT_EQUAL(t.size(), 50);
+    ASSERT_EQUAL(Tracked::copies, 0);
+    ASSERT_EQUAL(Tracked::moves, 0);
+    ASSERT_TRUE(t.check_balance_invariant());
+}
+TEST(insert_rvalue_moves){
+    BinarySearchTree<Tracked> t;
+    Tracked::copies = 0;
+    Tracked::moves = 0;
+    t.insert(Tracked(2));
+    t.insert(Tracked(1));
+    ASSERT_EQUAL(Tracked::copies, 0);
+    ASSERT_EQUAL(Tracked::moves, 2);
+    Tracked dup(2);
+    ASSERT_FALSE(t.try_insert(std::move(dup)).second);
+    ASSERT_EQUAL(Tracked::moves, 2);
+}
+static BinarySearchTree<Tracked> make_tree() {
+    BinarySearchTree<Tracked> t;
+    t.emplace(5);
+    t.emplace(3);
+    t.emplace(8);
+    return t;
+}
+TEST(move_construct_and_assign){
+    Tracked::copies = 0;
+    BinarySearchTree<Tracked> t(make_tree());
+    ASSERT_EQUAL(t.size(), 3);
+    BinarySearchTree<Tracked> t2(std::move(t));
+    ASSERT_TRUE(t.empty());
+    ASSERT_EQUAL(t2.size(), 3);
+    BinarySearchTree<Tracked> t3;
+    t3.emplace(100);
+    t3 = std::move(t2);
+    ASSERT_TRUE(t2.empty());
+    ASSERT_EQUAL(t3.size(), 3);
+    ASSERT_EQUAL(t3.min_element()->value, 3);
+    t3 = make_tree();
+    ASSERT_EQUAL(t3.size(), 3);
+    ASSERT_EQUAL(Tracked::copies, 0);
+}
+TEST(pool_move_assign_between_pools){
+    using PoolTree =
+        BinarySearchTree<int, std::less<int>, AvlBalanced, Pool_allocator<int>>;
+    PoolTree a;
+    PoolTree b;
+    a.insert(1);
+    a.insert(2);
+    b.insert(9);
+    b = std::move(a);
+    ASSERT_TRUE(a.empty());
+    ASSERT_EQUAL(b.size(), 2);
+    ASSERT_EQUAL(*b.max_element(), 2);
+    ASSERT_TRUE(b.check_balance_invariant());
+}
+// Results of degenerate_tree_workout, checked on the main thread
+struct Degenerate_result {
+    int count;
+    size_t height;
+    size_t copy_size;
+    bool sorted;
+    bool balanced;
+    size_t printed;
+};
+static const int degenerate_nodes = 10000;
+
+// Builds, walks, copies and destroys a tree shaped like a linked list.
+static void *degenerate_tree_workout(void *out) {
+    Degenerate_result *result = static_cast<Degenerate_result *>(out);
+    BinarySearchTree<int> *t = new BinarySearchTree<int>;
+    for (int i = 0; i < degenerate_nodes; ++i) {
+        t->insert(i);
+    }
+    result->height = t->height();
+    result->count = 0;
+    for (auto it = t->begin(); it != t->end(); ++it) {
+        ++result->count;
+    }
+    result->sorted = t->check_sorting_invariant();
+    result->balanced = t->check_balance_invariant();
+    ostringstream oss;
+    t->traverse_preorder(oss);
+    t->traverse_inorder(oss);
+    result->printed = oss.str().size();
+    BinarySearchTree<int> *copy = new BinarySearchTree<int>(*t);
+    delete t;
+    result->copy_size = copy->size();
+    delete copy;
+    return nullptr;
+}
+TEST(degenerate_tree_on_small_stack){
+    // A 64 KiB stack is far too small for any operation that recurses once
+    // per level of a 10000-node chain.
+    Degenerate_result result = {};
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    pthread_t thread;
+    ASSERT_EQUAL(pthread_create(&thread, &attr, degenerate_tree_workout,
+                                &result), 0);
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+    ASSERT_EQUAL(result.count, degenerate_nodes);
+    ASSERT_EQUAL(result.height, degenerate_nodes);
+    ASSERT_EQUAL(result.copy_size, degenerate_nodes);
+    ASSERT_TRUE(result.sorted);
+    ASSERT_TRUE(result.balanced);
+    ASSERT_TRUE(result.printed > 2 * degenerate_nodes);
+}
+TEST(copy_keeps_exact_structure){
+    BinarySearchTree<int> t;
+    int keys[] = { 50, 30, 70, 20, 40, 60, 80, 35, 45, 65, 10, 90 };
+    for (int k : keys) {
+        t.insert(k);
+    }
+    BinarySearchTree<int> copy(t);
+    ostringstream original;
+    ostringstream copied;
+    t.traverse_preorder(original);
+    copy.traverse_preorder(copied);
+    ASSERT_EQUAL(original.str(), copied.str());
+    ASSERT_EQUAL(original.str(), "50 30 20 10 40 35 45 70 60 65 80 90 ");
+    ASSERT_TRUE(copy.check_balance_invariant());
+}
+
+TEST(erase_leaf_one_child_and_two_children){
+    BinarySearchTree<int> t;
+    int keys[] = { 50, 30, 70, 20, 40, 60, 80, 35, 45, 65 };
+    for (int k : keys) {
+        t.insert(k);
+    }
+    ASSERT_EQUAL(t.erase(99), 0);
+    ASSERT_EQUAL(t.erase(35), 1);  // leaf
+    ASSERT_EQUAL(t.erase(60), 1);  // one child
+    ASSERT_EQUAL(t.erase(30), 1);  // two children, successor deeper down
+    ASSERT_EQUAL(t.erase(50), 1);  // root
+    ostringstream oss;
+    t.traverse_preorder(oss);
+    ASSERT_EQUAL(oss.str(), "65 40 20 45 70 80 ");
+    ASSERT_EQUAL(t.size(), 6);
+    ASSERT_TRUE(t.check_sorting_invariant());
+    ASSERT_TRUE(t.check_balance_invariant());
+    ASSERT_EQUAL(t.find(50), t.end());
+}
+
+TEST(erase_returns_next_and_keeps_other_iterators){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 0; i < 100; ++i) {
+        t.insert(i);
+    }
+    auto keep = t.find(63);
+    const int *keep_addr = &*keep;
+    auto it = t.erase(t.find(31));
+    ASSERT_EQUAL(*it, 32);
+    ASSERT_EQUAL(t.erase(t.find(99)), t.end());
+    // Erase every even key still present
+    for (it = t.begin(); it != t.end(); ) {
+        it = *it % 2 == 0 ? t.erase(it) : ++it;
+    }
+    ASSERT_EQUAL(t.size(), 48);
+    ASSERT_EQUAL(&*keep, keep_addr);
+    ASSERT_EQUAL(*keep, 63);
+    ASSERT_EQUAL(*++keep, 65);
+    ASSERT_TRUE(t.check_sorting_invariant());
+    ASSERT_TRUE(t.check_balance_invariant());
+    ASSERT_EQUAL(*t.nth_element(0), 1);
+    ASSERT_EQUAL(t.rank(65), 31);
+}
+
+TEST(erase_range){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 0; i < 20; ++i) {
+        t.insert(i);
+    }
+    auto last = t.find(15);
+    ASSERT_EQUAL(t.erase(t.find(5), last), last);
+    ASSERT_EQUAL(t.size(), 10);
+    ostringstream oss;
+    t.traverse_inorder(oss);
+    ASSERT_EQUAL(oss.str(), "0 1 2 3 4 15 16 17 18 19 ");
+    ASSERT_EQUAL(t.erase(t.begin(), t.end()), t.end());
+    ASSERT_TRUE(t.empty());
+    ASSERT_EQUAL(t.height(), 0);
+}
+
+TEST(avl_erase_stays_balanced){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    for (int i = 0; i < 1000; ++i) {
+        t.insert((i * 389) % 1000);
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        ASSERT_EQUAL(t.erase((i * 211) % 1000), 1);
+        ASSERT_TRUE(t.check_balance_invariant());
+    }
+    ASSERT_TRUE(t.check_sorting_invariant());
+    ASSERT_EQUAL(t.size(), 666);
+    ASSERT_TRUE(t.height() <= 14);
+}
+
+TEST(transparent_erase){
+    BinarySearchTree<std::string, std::less<>> t;
+    t.insert("pear");
+    t.insert("apple");
+    ASSERT_EQUAL(t.erase("pear"), 1);
+    ASSERT_EQUAL(t.erase("fig"), 0);
+    ASSERT_EQUAL(t.size(), 1);
+    ASSERT_EQUAL(*t.begin(), "apple");
+}
+
+TEST(pool_allocator_reuses_erased_nodes){
+    Pool_allocator<int> pool;
+    BinarySearchTree<int, std::less<int>, AvlBalanced,
+                     Pool_allocator<int>> t(pool);
+    for (int round = 0; round < 50; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            t.insert(i);
+        }
+        t.erase(t.begin(), t.end());
+    }
+    ASSERT_TRUE(pool.bytes_reserved() < 2 * 64 * 1024 + 1024);
+}
 
+TEST(assign_sorted_builds_perfectly_balanced){
+    int keys[1000];
+    for (int i = 0; i < 1000; ++i) {
+        keys[i] = 2 * i;
+    }
+    for (int n : { 0, 1, 2, 3, 7, 8, 100, 1000 }) {
+        BinarySearchTree<int> t;
+        t.insert(-5);
+        t.assign_sorted(keys, keys + n);
+        int expected_height = 0;
+        while ((1 << expected_height) <= n) {
+            ++expected_height;
+        }
+        ASSERT_EQUAL(t.size(), n);
+        ASSERT_EQUAL(t.height(), expected_height);
+        ASSERT_TRUE(t.check_sorting_invariant());
+        ASSERT_TRUE(t.check_balance_invariant());
+    }
+    BinarySearchTree<int, std::less<int>, AvlBalanced> avl;
+    avl.assign_sorted(keys, keys + 1000);
+    ASSERT_TRUE(avl.check_balance_invariant());
+    ASSERT_EQUAL(*avl.nth_element(500), 1000);
+    ASSERT_EQUAL(*--avl.end(), 1998);
+    avl.insert(1001);
+    ASSERT_EQUAL(avl.erase(0), 1);
+    ASSERT_TRUE(avl.check_balance_invariant());
+}
+
+TEST(range_constructor){
+    int sorted[] = { 1, 2, 3, 4, 5, 6, 7 };
+    BinarySearchTree<int> built(sorted, sorted + 7);
+    ASSERT_EQUAL(built.height(), 3);
+    int unsorted[] = { 4, 1, 4, 7, 2 };
+    BinarySearchTree<int, std::less<int>, AvlBalanced> inserted(unsorted,
+                                                                unsorted + 5);
+    ostringstream oss;
+    inserted.traverse_inorder(oss);
+    ASSERT_EQUAL(oss.str(), "1 2 4 7 ");
+    ASSERT_TRUE(inserted.check_balance_invariant());
+    istringstream input("3 1 2");
+    BinarySearchTree<int> streamed((istream_iterator<int>(input)),
+                                   istream_iterator<int>());
+    ASSERT_EQUAL(streamed.size(), 3);
+    ASSERT_TRUE(streamed.check_sorting_invariant());
+}
+
+// Throws from its copy constructor once copies_left runs out.
+struct Fragile {
+    static int copies_left;
+    int value;
+    Fragile(int value_in) : value(value_in) {}
+    Fragile(const Fragile &other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw runtime_error("copy failed");
+        }
+    }
+    bool operator<(const Fragile &rhs) const { return value < rhs.value; }
+};
+int Fragile::copies_left = 0;
+
+TEST(assign_sorted_keeps_tree_when_a_copy_throws){
+    Fragile keys[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    BinarySearchTree<Fragile> t;
+    Fragile::copies_left = 1;
+    t.insert(keys[0]);
+    for (int budget = 0; budget < 10; ++budget) {
+        Fragile::copies_left = budget;
+        bool threw = false;
+        try {
+            t.assign_sorted(keys, keys + 10);
+        }
+        catch (const runtime_error &) {
+            threw = true;
+        }
+        ASSERT_TRUE(threw);
+        ASSERT_EQUAL(t.size(), 1);
+    }
+    Fragile::copies_left = 10;
+    t.assign_sorted(keys, keys + 10);
+    ASSERT_EQUAL(t.size(), 10);
+    ASSERT_TRUE(t.check_balance_invariant());
+}
+
+TEST(copies_share_nodes_until_changed){
+    BinarySearchTree<int> a;
+    for (int i = 0; i < 100; ++i) {
+        a.insert((i * 37) % 100);
+    }
+    BinarySearchTree<int> b(a.share());
+    BinarySearchTree<int> c;
+    c = b.share();
+    // cfind reads the shared nodes
+    ASSERT_EQUAL(&*a.cfind(42), &*b.cfind(42));
+    ASSERT_EQUAL(&*a.cfind(42), &*c.cfind(42));
+    b.insert(100);
+    c.erase(c.find(42));
+    ASSERT_EQUAL(a.size(), 100);
+    ASSERT_EQUAL(b.size(), 101);
+    ASSERT_EQUAL(c.size(), 99);
+    ASSERT_TRUE(a.find(42) != a.end());
+    ASSERT_TRUE(b.find(100) != b.end());
+    ASSERT_TRUE(a.find(100) == a.end());
+    ASSERT_TRUE(c.find(42) == c.end());
+    ASSERT_TRUE(a.check_sorting_invariant() && b.check_sorting_invariant());
+    ASSERT_TRUE(c.check_balance_invariant());
+}
+
+TEST(non_const_access_detaches_before_writes){
+    BinarySearchTree<pair<int, int>> a;
+    for (int i = 0; i < 10; ++i) {
+        a.insert({ i, 0 });
+    }
+    BinarySearchTree<pair<int, int>> b = a.share();
+    b.find({ 3, 0 })->second = 7;
+    b.begin()->second = 8;
+    b.max_element()->second = 9;
+    ASSERT_EQUAL(a.cfind({ 3, 0 })->second, 0);
+    ASSERT_EQUAL(a.cbegin()->second, 0);
+    ASSERT_EQUAL((--a.cend())->second, 0);
+    ASSERT_TRUE(b.cfind({ 3, 7 }) != b.cend());
+    ASSERT_EQUAL(b.cbegin()->second, 8);
+    ASSERT_EQUAL((--b.cend())->second, 9);
+}
+
+TEST(const_iterators_leave_copies_unchanged){
+    BinarySearchTree<pair<int, int>> a;
+    a.insert({ 1, 10 });
+    a.insert({ 2, 20 });
+    BinarySearchTree<pair<int, int>> b = a.share();
+    auto found = b.cfind({ 1, 10 });
+    static_assert(is_same<decltype(*found), const pair<int, int> &>::value,
+                  "cfind must hand out read-only elements");
+    BinarySearchTree<pair<int, int>>::Iterator writable = b.find(*found);
+    writable->second = 99;
+    ASSERT_EQUAL(b.begin()->second, 99);
+    ASSERT_EQUAL(a.cbegin()->second, 10);
+    // A Const_iterator and an Iterator compare equal at the same element
+    ASSERT_TRUE(b.cbegin() == b.begin());
+    ASSERT_TRUE(b.find({ 3, 0 }) == b.cend());
+}
+
+// EFFECTS: Returns the sum of the elements of 'by_value', reading it only
+//          through cbegin, cend and cfind.
+static int read_only_sum(BinarySearchTree<int> shared, const int **seen) {
+    int sum = 0;
+    for (auto it = shared.cbegin(); it != shared.cend(); ++it) {
+        sum += *it;
+    }
+    *seen = &*shared.cfind(7);
+    return sum;
+}
+
+TEST(reading_a_copy_keeps_sharing){
+    BinarySearchTree<int> a;
+    for (int i = 0; i < 10; ++i) {
+        a.insert(i);
+    }
+    const int *seen = nullptr;
+    ASSERT_EQUAL(read_only_sum(a.share(), &seen), 45);
+    ASSERT_EQUAL(seen, &*a.cfind(7));
+
+    BinarySearchTree<int> b = a.share();
+    ASSERT_EQUAL(&*b.cbegin(), &*a.cbegin());
+    ASSERT_TRUE(b.cfind(3) != b.cend());
+    ASSERT_EQUAL(&*b.cfind(3), &*a.cfind(3));
+    // Asking for an Iterator that can change elements stops sharing
+    ASSERT_NOT_EQUAL(&*b.find(3), &*a.cfind(3));
+
+    BinarySearchTree<int> empty;
+    ASSERT_TRUE(empty.begin() == empty.end());
+    BinarySearchTree<int> empty_copy = empty.share();
+    empty_copy.insert(1);
+    ASSERT_TRUE(empty.empty());
+}
+
+TEST(erase_through_shared_iterators){
+    BinarySearchTree<int> a;
+    for (int i = 0; i < 50; ++i) {
+        a.insert(i);
+    }
+    BinarySearchTree<int> b = a.share();
+    // Const_iterators still point into the shared nodes; erase maps them
+    // onto this tree's own copy.
+    auto first = b.cfind(10);
+    auto last = b.cfind(20);
+    auto after = b.erase(first, last);
+    ASSERT_EQUAL(*after, 20);
+    ASSERT_EQUAL(b.size(), 40);
+    ASSERT_EQUAL(a.size(), 50);
+    BinarySearchTree<int> c = b.share();
+    ASSERT_EQUAL(*c.erase(c.cfind(30)), 31);
+    ASSERT_EQUAL(c.erase(25), 1);
+    ASSERT_EQUAL(c.size(), 38);
+    ASSERT_EQUAL(b.size(), 40);
+    ASSERT_TRUE(b.find(30) != b.end() && b.find(25) != b.end());
+    ASSERT_TRUE(c.check_balance_invariant());
+}
+
+TEST(shared_nodes_outlive_the_original){
+    BinarySearchTree<string> *a = new BinarySearchTree<string>;
+    for (int i = 0; i < 100; ++i) {
+        a->insert(to_string(i));
+    }
+    BinarySearchTree<string> b(a->share());
+    BinarySearchTree<string> c(move(*a));
+    delete a;
+    ASSERT_EQUAL(b.size(), 100);
+    c.insert("x");
+    b = c.share();
+    c = BinarySearchTree<string>();
+    ASSERT_EQUAL(b.size(), 101);
+    ASSERT_TRUE(b.find("x") != b.end());
+    ASSERT_TRUE(c.empty());
+}
+
+TEST(failed_detach_leaves_both_copies_unchanged){
+    Fragile::copies_left = 1000;
+    BinarySearchTree<Fragile> a;
+    for (int i = 0; i < 20; ++i) {
+        a.insert(Fragile(i));
+    }
+    BinarySearchTree<Fragile> b = a.share();
+    Fragile::copies_left = 5;
+    bool threw = false;
+    try {
+        b.insert(Fragile(100));
+    }
+    catch (const runtime_error &) {
+        threw = true;
+    }
+    Fragile::copies_left = 1000;
+    ASSERT_TRUE(threw);
+    ASSERT_EQUAL(a.size(), 20);
+    ASSERT_EQUAL(b.size(), 20);
+    ASSERT_EQUAL(&*a.cbegin(), &*b.cbegin());
+    b.insert(Fragile(100));
+    ASSERT_EQUAL(a.size(), 20);
+    ASSERT_EQUAL(b.size(), 21);
+}
+
+TEST(pool_allocated_copies_share_nodes){
+    Pool_allocator<int> pool;
+    BinarySearchTree<int, std::less<int>, AvlBalanced,
+                     Pool_allocator<int>> a(pool);
+    for (int i = 0; i < 100; ++i) {
+        a.insert(i);
+    }
+    auto b = a.share();
+    ASSERT_EQUAL(&*a.cbegin(), &*b.cbegin());
+    b.erase(b.begin(), b.end());
+    ASSERT_EQUAL(a.size(), 100);
+    ASSERT_TRUE(b.empty());
+}
+
+// EFFECTS: Returns the preorder listing of t.
+template <typename Tree>
+static string preorder(const Tree &t) {
+    ostringstream out;
+    t.traverse_preorder(out);
+    return out.str();
+}
+
+TEST(parallel_copy_keeps_exact_structure){
+    // A spine of small keys above a large random subtree, so the copy
+    // first walks down the spine and then forks
+    BinarySearchTree<int> t;
+    for (int i = 0; i < 100; ++i) {
+        t.insert(i);
+    }
+    unsigned key = 7;
+    for (int i = 0; i < 100000; ++i) {
+        key = key * 1103515245u + 12345u;
+        t.try_insert(100 + static_cast<int>(key >> 8));
+    }
+    t.set_parallelism(4);
+    BinarySearchTree<int> copy(t);  // copies the nodes on several threads
+    ASSERT_EQUAL(copy.parallelism(), 4);
+    ASSERT_NOT_EQUAL(&*copy.cbegin(), &*t.cbegin());
+    ASSERT_EQUAL(preorder(copy), preorder(t));
+    ASSERT_TRUE(copy.check_balance_invariant());
+    t = BinarySearchTree<int>();  // frees the original on several threads
+    ASSERT_EQUAL(copy.size(), t.size() + copy.size());
+}
+
+TEST(assignment_keeps_parallelism_and_rebalance_factor){
+    BinarySearchTree<int> t;
+    t.set_parallelism(4);
+    t.set_rebalance_factor(2);
+    t.insert(1);
+    BinarySearchTree<int> copied;
+    copied = t;
+    ASSERT_EQUAL(copied.parallelism(), 4);
+    ASSERT_EQUAL(copied.rebalance_factor(), 2);
+    BinarySearchTree<int> moved;
+    moved = std::move(t);
+    ASSERT_EQUAL(moved.parallelism(), 4);
+    ASSERT_EQUAL(moved.rebalance_factor(), 2);
+    ASSERT_EQUAL(moved.size(), 1);
+}
+
+// Orders pairs by their first member only.
+struct First_less {
+    bool operator()(const pair<int, int> &a, const pair<int, int> &b) const {
+        return a.first < b.first;
+    }
+};
+
+TEST(assign_unsorted_keeps_earliest_of_equivalent_elements){
+    vector<pair<int, int>> input;
+    vector<int> first_seen(50000, -1);
+    unsigned key = 3;
+    for (int i = 0; i < 120000; ++i) {
+        key = key * 1103515245u + 12345u;
+        int k = static_cast<int>((key >> 8) % 50000);
+        input.push_back({ k, i });
+        if (first_seen[k] < 0) {
+            first_seen[k] = i;
+        }
+    }
+    BinarySearchTree<pair<int, int>, First_less, AvlBalanced> serial;
+    BinarySearchTree<pair<int, int>, First_less, AvlBalanced> parallel;
+    serial.insert({ -1, -1 });
+    parallel.set_parallelism(3);
+    serial.assign_unsorted(input.begin(), input.end());
+    parallel.assign_unsorted(input.begin(), input.end());
+    size_t distinct = 0;
+    for (int k = 0; k < 50000; ++k) {
+        distinct += first_seen[k] >= 0;
+    }
+    ASSERT_EQUAL(parallel.size(), distinct);
+    ASSERT_EQUAL(parallel.height(), 16);  // perfectly balanced
+    ASSERT_TRUE(parallel.check_balance_invariant());
+    ASSERT_TRUE(parallel.check_sorting_invariant());
+    for (auto &entry : as_const(parallel)) {
+        ASSERT_EQUAL(entry.second, first_seen[entry.first]);
+    }
+    ASSERT_EQUAL(serial.height(), parallel.height());
+    ASSERT_TRUE(equal(serial.begin(), serial.end(), parallel.begin()));
+}
+
+// Like Fragile, but its copy budget may be spent on several threads.
+struct Shared_fragile {
+    static atomic<int> copies_left;
+    int value;
+    Shared_fragile(int value_in) : value(value_in) {}
+    Shared_fragile(const Shared_fragile &other) : value(other.value) {
+        if (copies_left.fetch_sub(1) <= 0) {
+            throw runtime_error("copy failed");
+        }
+    }
+    bool operator<(const Shared_fragile &rhs) const {
+        return value < rhs.value;
+    }
+};
+atomic<int> Shared_fragile::copies_left(0);
+
+TEST(failed_parallel_copy_or_build_changes_nothing){
+    Shared_fragile::copies_left = 1000000;
+    vector<Shared_fragile> input;
+    for (int i = 0; i < 100000; ++i) {
+        input.push_back(Shared_fragile((i * 7919) % 100000));
+    }
+    BinarySearchTree<Shared_fragile> a;
+    a.set_parallelism(4);
+    a.assign_unsorted(input.begin(), input.end());
+    BinarySearchTree<Shared_fragile> b = a.share();
+    for (int budget : { 0, 20000, 60000, 99999 }) {
+        Shared_fragile::copies_left = budget;
+        bool copy_threw = false;
+        try {
+            b.insert(Shared_fragile(-1));
+        }
+        catch (const runtime_error &) {
+            copy_threw = true;
+        }
+        Shared_fragile::copies_left = budget;
+        bool build_threw = false;
+        try {
+            a.assign_unsorted(input.begin(), input.end());
+        }
+        catch (const runtime_error &) {
+            build_threw = true;
+        }
+        ASSERT_TRUE(copy_threw && build_threw);
+        ASSERT_EQUAL(b.size(), 100000);
+        ASSERT_EQUAL(&*a.cbegin(), &*b.cbegin());
+    }
+}
+
+// Checks lower_bound, upper_bound, equal_range, range and count_range
+// against a scan of the sorted keys, for bounds all around the even keys
+// 0, 2, ..., 2n - 2 that the tree holds.
+template <typename Tree>
+static void check_range_queries(Tree &tree, int n) {
+    vector<int> keys;
+    for (int i = 0; i < n; ++i) {
+        tree.try_insert(2 * (i * 7 % n));
+        keys.push_back(2 * i);
+    }
+    auto key_at = [&](typename Tree::Const_iterator it) {
+        return it == tree.end() ? -1 : *it;
+    };
+    auto key_or_end = [&](vector<int>::iterator it) {
+        return it == keys.end() ? -1 : *it;
+    };
+    for (int lo = -2; lo <= 2 * n; ++lo) {
+        auto lower = as_const(tree).lower_bound(lo);
+        auto upper = as_const(tree).upper_bound(lo);
+        ASSERT_EQUAL(key_at(lower),
+                     key_or_end(lower_bound(keys.begin(), keys.end(), lo)));
+        ASSERT_EQUAL(key_at(upper),
+                     key_or_end(upper_bound(keys.begin(), keys.end(), lo)));
+        ASSERT_TRUE(as_const(tree).equal_range(lo).first == lower);
+        ASSERT_TRUE(as_const(tree).equal_range(lo).second == upper);
+        for (int hi : { lo - 1, lo, lo + 1, lo + 2, lo + 9, lo + 2 * n }) {
+            vector<int> expected;
+            if (lo < hi) {
+                expected.assign(lower_bound(keys.begin(), keys.end(), lo),
+                                lower_bound(keys.begin(), keys.end(), hi));
+            }
+            vector<int> seen(as_const(tree).range(lo, hi).begin(),
+                             as_const(tree).range(lo, hi).end());
+            ASSERT_TRUE(seen == expected);
+            ASSERT_EQUAL(tree.count_range(lo, hi), expected.size());
+        }
+    }
+}
+
+TEST(bound_and_range_queries){
+    BinarySearchTree<int> unbalanced;
+    check_range_queries(unbalanced, 500);
+    BinarySearchTree<int, std::less<int>, AvlBalanced> avl;
+    check_range_queries(avl, 500);
+    BinarySearchTree<string, less<>> words;
+    words.insert("apple");
+    words.insert("cherry");
+    words.insert("pear");
+    ASSERT_EQUAL(*words.lower_bound("banana"), "cherry");
+    ASSERT_EQUAL(*words.upper_bound("cherry"), "pear");
+    ASSERT_EQUAL(words.count_range("b", "q"), 2);
+    ASSERT_TRUE(words.range("q", "b").empty());
+    ASSERT_TRUE(words.equal_range("fig").first == words.equal_range("fig").second);
+}
+
+TEST(writes_through_a_range_do_not_reach_copies){
+    BinarySearchTree<pair<int, int>> a;
+    for (int i = 0; i < 20; ++i) {
+        a.insert({ i, 0 });
+    }
+    BinarySearchTree<pair<int, int>> b = a.share();
+    for (auto &entry : b.range({ 5, 0 }, { 10, 0 })) {
+        entry.second = 1;
+    }
+    int changed = 0;
+    for (auto &entry : as_const(b)) {
+        changed += entry.second;
+    }
+    ASSERT_EQUAL(changed, 5);
+    for (auto &entry : as_const(a)) {
+        ASSERT_EQUAL(entry.second, 0);
+    }
+}
+
+// EFFECTS: Returns the elements of t in order.
+template <typename Tree>
+static vector<int> contents(const Tree &t) {
+    return vector<int>(t.begin(), t.end());
+}
+
+// EFFECTS: Checks the set operations of Tree on sets of a and b elements
+//          whose ranges overlap, against the std:: set algorithms.
+template <typename Tree>
+static void check_set_algebra(int a, int b) {
+    Tree left, right;
+    for (int i = 0; i < a; ++i) {
+        left.insert((i * 7919) % (3 * a));
+    }
+    for (int i = 0; i < b; ++i) {
+        right.try_insert((i * 104729 + a) % (3 * a + 2 * b));
+    }
+    vector<int> x = contents(left);
+    vector<int> y = contents(right);
+    vector<int> expected;
+    set_union(x.begin(), x.end(), y.begin(), y.end(), back_inserter(expected));
+    Tree t = left;
+    t.union_with(right);
+    ASSERT_TRUE(contents(t) == expected);
+    ASSERT_TRUE(t.check_sorting_invariant());
+    ASSERT_TRUE(t.check_balance_invariant());
+    if (!expected.empty()) {
+        ASSERT_EQUAL(t.rank(expected.back()), expected.size() - 1);
+    }
+    ASSERT_TRUE(contents(left) == x);
+    ASSERT_TRUE(contents(right) == y);
+
+    Tree moved_from = right;
+    t = left;
+    t.merge(std::move(moved_from));
+    ASSERT_TRUE(contents(t) == expected);
+    ASSERT_TRUE(t.check_balance_invariant());
+    ASSERT_TRUE(moved_from.empty());
+    ASSERT_TRUE(contents(right) == y);
+
+    expected.clear();
+    set_intersection(x.begin(), x.end(), y.begin(), y.end(),
+                     back_inserter(expected));
+    t = left;
+    t.intersect_with(right);
+    ASSERT_TRUE(contents(t) == expected);
+    ASSERT_TRUE(t.check_balance_invariant());
+    ASSERT_EQUAL(t.size(), expected.size());
+
+    expected.clear();
+    set_difference(x.begin(), x.end(), y.begin(), y.end(),
+                   back_inserter(expected));
+    t = left;
+    t.difference_with(right);
+    ASSERT_TRUE(contents(t) == expected);
+    ASSERT_TRUE(t.check_balance_invariant());
+    ASSERT_EQUAL(t.size(), expected.size());
+}
+
+TEST(set_algebra_matches_std_algorithms){
+    // Both sizes alike (merge walks) and one much smaller (per element)
+    int sizes[][2] = { { 0, 0 }, { 0, 50 }, { 50, 0 }, { 1, 1 },
+                       { 500, 400 }, { 2000, 10 }, { 10, 2000 } };
+    for (auto &size : sizes) {
+        check_set_algebra<BinarySearchTree<int>>(size[0], size[1]);
+        check_set_algebra<BinarySearchTree<int, std::less<int>, AvlBalanced>>(
+            size[0], size[1]);
+    }
+}
+
+TEST(set_algebra_with_itself){
+    BinarySearchTree<int> t;
+    for (int i = 0; i < 10; ++i) {
+        t.insert(i);
+    }
+    t.union_with(t);
+    t.intersect_with(t);
+    t.merge(std::move(t));
+    ASSERT_EQUAL(t.size(), 10);
+    t.difference_with(t);
+    ASSERT_TRUE(t.empty());
+}
+
+TEST(merge_relinks_nodes_and_keeps_iterators){
+    for (int small : { 0, 1 }) {
+        BinarySearchTree<int> base, delta;
+        for (int i = 0; i < 1000; i += 2) {
+            base.insert(i);
+        }
+        for (int i = 0; i < (small ? 20 : 1000); ++i) {
+            delta.insert(i);
+        }
+        const int *kept = &*as_const(base).find(500);
+        const int *spliced = &*as_const(delta).find(7);
+        base.merge(std::move(delta));
+        ASSERT_TRUE(delta.empty());
+        ASSERT_EQUAL(&*as_const(base).find(7), spliced);
+        ASSERT_EQUAL(&*as_const(base).find(500), kept);
+        ASSERT_EQUAL(base.size(), small ? 510 : 1000);
+        ASSERT_TRUE(base.check_sorting_invariant());
+        ASSERT_TRUE(base.check_balance_invariant());
+    }
+}
+
+TEST(set_algebra_leaves_copies_unchanged){
+    BinarySearchTree<int> a, b;
+    for (int i = 0; i < 100; ++i) {
+        a.insert(i);
+        b.insert(i + 50);
+    }
+    BinarySearchTree<int> a_copy = a.share();
+    BinarySearchTree<int> b_copy = b.share();
+    a.merge(std::move(b));
+    ASSERT_EQUAL(a.size(), 150);
+    ASSERT_TRUE(b.empty());
+    ASSERT_EQUAL(a_copy.size(), 100);
+    ASSERT_EQUAL(b_copy.size(), 100);
+    ASSERT_EQUAL(*b_copy.cbegin(), 50);
+    a.difference_with(b_copy);
+    ASSERT_EQUAL(a.size(), 50);
+    ASSERT_EQUAL(a_copy.size(), 100);
+}
+
+TEST(failed_union_leaves_tree_unchanged){
+    Fragile::copies_left = 1000;
+    BinarySearchTree<Fragile> a, b;
+    for (int i = 0; i < 50; ++i) {
+        a.insert(Fragile(2 * i));
+        b.insert(Fragile(2 * i + 1));
+    }
+    Fragile::copies_left = 10;
+    bool threw = false;
+    try {
+        a.union_with(b);
+    }
+    catch (const runtime_error &) {
+        threw = true;
+    }
+    Fragile::copies_left = 1000;
+    ASSERT_TRUE(threw);
+    ASSERT_EQUAL(a.size(), 50);
+    ASSERT_TRUE(a.check_sorting_invariant());
+    a.union_with(b);
+    ASSERT_EQUAL(a.size(), 100);
+}
+
+TEST(search_stats){
+    BinarySearchTree<int, std::less<int>, AvlBalanced> t;
+    int keys[] = { 1, 2, 3, 4, 5, 6, 7 };
+    t.assign_sorted(keys, keys + 7);
+    t.find(4);
+    t.find(1);
+    for (int key : t) {
+        ASSERT_TRUE(key > 0);
+    }
+    Search_stats s = t.stats();
+#if TREE_STATS
+    // 4 is the root; 1 is found after going left twice
+    ASSERT_EQUAL(s.searches, 2);
+    ASSERT_EQUAL(s.nodes_visited, 4);
+    ASSERT_EQUAL(s.comparisons, 6);
+    ASSERT_EQUAL(s.depths[1], 1);
+    ASSERT_EQUAL(s.depths[3], 1);
+    ASSERT_ALMOST_EQUAL(s.mean_depth(), 2.0, 1e-9);
+    t.insert(8);
+    t.lower_bound(0);
+    ASSERT_EQUAL(t.stats().searches, 4);
+    ASSERT_EQUAL(t.stats().depths[3], 3);
+    BinarySearchTree<int, std::less<int>, AvlBalanced> copy = t;
+    ASSERT_EQUAL(copy.stats().searches, 0);
+    t.reset_stats();
+    s = t.stats();
+#endif
+    ASSERT_EQUAL(s.searches, 0);
+    ASSERT_EQUAL(s.comparisons, 0);
+    ASSERT_EQUAL(s.nodes_visited, 0);
+    ASSERT_EQUAL(s.depths[1], 0);
+}
+
+TEST(shape_reports_degradation){
+    BinarySearchTree<int> chain;
+    for (int i = 0; i < 100; ++i) {
+        chain.insert(i);
+    }
+    Tree_shape s = chain.shape();
+    ASSERT_EQUAL(s.size, 100);
+    ASSERT_EQUAL(s.height, 100);
+    ASSERT_EQUAL(s.optimal_height, 7);
+    ASSERT_ALMOST_EQUAL(s.mean_depth, 50.5, 1e-9);
+    ASSERT_EQUAL(s.degenerate_chains, 1);
+    ASSERT_TRUE(s.height_ratio() > 14);
+
+    // Two runs of single-child nodes: 40, 20 (zig-zag) and 100, 101
+    BinarySearchTree<int> zigzag;
+    for (int key : { 50, 10, 40, 20, 30, 0, 100, 101, 102 }) {
+        zigzag.insert(key);
+    }
+    ASSERT_EQUAL(zigzag.shape().degenerate_chains, 2);
+    zigzag.erase(101);
+    ASSERT_EQUAL(zigzag.shape().degenerate_chains, 1);
+    ASSERT_TRUE(zigzag.check_balance_invariant());
+
+    BinarySearchTree<int, std::less<int>, AvlBalanced> avl;
+    int keys[] = { 1, 2, 3, 4, 5, 6, 7 };
+    avl.assign_sorted(keys, keys + 7);
+    s = avl.shape();
+    ASSERT_EQUAL(s.height, 3);
+    ASSERT_ALMOST_EQUAL(s.mean_depth, 17.0 / 7, 1e-9);
+    ASSERT_ALMOST_EQUAL(s.height_ratio(), 1.0, 1e-9);
+    for (int i = 8; i < 1000; ++i) {
+        avl.insert(i);
+    }
+    ASSERT_EQUAL(avl.shape().degenerate_chains, 0);
+    ASSERT_TRUE(avl.shape().height_ratio() < 1.45);
+    ASSERT_TRUE(avl.check_balance_invariant());
+
+    BinarySearchTree<int> mixed;
+    unsigned key = 1;
+    for (int i = 0; i < 3000; ++i) {
+        key = key * 1103515245u + 12345u;
+        int value = static_cast<int>((key >> 8) % 500);
+        if (i % 3 == 2) {
+            mixed.erase(value);
+        }
+        else {
+            mixed.try_insert(value);
+        }
+    }
+    ASSERT_TRUE(mixed.check_balance_invariant());
+
+    BinarySearchTree<int> empty;
+    ASSERT_EQUAL(empty.shape().mean_depth, 0);
+    ASSERT_EQUAL(empty.shape().height_ratio(), 1);
+}
+
+TEST(rebalance_in_place){
+    for (int n : { 0, 1, 2, 3, 7, 8, 100, 1000 }) {
+        BinarySearchTree<int> t;
+        for (int i = 0; i < n; ++i) {
+            t.insert(i);
+        }
+        const int *last = n ? &*as_const(t).max_element() : nullptr;
+        t.rebalance();
+        ASSERT_EQUAL(t.size(), n);
+        ASSERT_EQUAL(t.height(), t.shape().optimal_height);
+        ASSERT_EQUAL(t.shape().degenerate_chains, 0);
+        ASSERT_TRUE(t.check_sorting_invariant());
+        ASSERT_TRUE(t.check_balance_invariant());
+        if (n) {
+            ASSERT_EQUAL(&*as_const(t).max_element(), last);
+            ASSERT_EQUAL(*t.nth_element(n / 2), n / 2);
+        }
+    }
+    BinarySearchTree<int, std::less<int>, AvlBalanced> avl;
+    for (int i = 0; i < 1000; ++i) {
+        avl.insert(i);
+    }
+    avl.rebalance();
+    ASSERT_EQUAL(avl.height(), 10);
+    ASSERT_TRUE(avl.check_balance_invariant());
+}
+
+TEST(rebalance_leaves_copies_unchanged){
+    BinarySearchTree<int> a;
+    for (int i = 0; i < 50; ++i) {
+        a.insert(i);
+    }
+    BinarySearchTree<int> b = a;
+    b.rebalance();
+    ASSERT_EQUAL(a.height(), 50);
+    ASSERT_EQUAL(b.height(), 6);
+    ASSERT_TRUE(contents(a) == contents(b));
+}
+
+TEST(rebalance_factor_bounds_height){
+    BinarySearchTree<int> sorted;
+    sorted.set_rebalance_factor(2);
+    ASSERT_EQUAL(sorted.rebalance_factor(), 2);
+    for (int i = 0; i < 5000; ++i) {
+        sorted.insert(i);
+        ASSERT_TRUE(sorted.height() <= 2 * sorted.shape().optimal_height);
+    }
+    ASSERT_TRUE(sorted.check_balance_invariant());
+
+    BinarySearchTree<int> mixed;
+    mixed.set_rebalance_factor(1.5);
+    unsigned key = 7;
+    for (int i = 0; i < 5000; ++i) {
+        key = key * 1103515245u + 12345u;
+        int value = static_cast<int>((key >> 8) % 2000);
+        if (i % 4 == 3) {
+            mixed.erase(value);
+        }
+        else if (i % 4 == 2) {
+            mixed.emplace(value);
+        }
+        else {
+            mixed.try_insert(-value);
+        }
+    }
+    ASSERT_TRUE(mixed.height() <= 1.5 * mixed.shape().optimal_height);
+    ASSERT_TRUE(mixed.check_sorting_invariant());
+    ASSERT_TRUE(mixed.check_balance_invariant());
+
+    // Turning the limit on rebalances a tree that is already too tall
+    BinarySearchTree<int> chain;
+    for (int i = 0; i < 100; ++i) {
+        chain.insert(i);
+    }
+    BinarySearchTree<int> copy = chain;
+    chain.set_rebalance_factor(3);
+    ASSERT_EQUAL(chain.height(), 7);
+    ASSERT_EQUAL(copy.height(), 100);
+}
+
+// A type encoded by a user-supplied codec, as TreeSerialize.hpp describes
+struct Version {
+    int major;
+    int minor;
+};
+
+bool operator<(const Version &a, const Version &b) {
+    return a.major != b.major ? a.major < b.major : a.minor < b.minor;
+}
+
+template <>
+struct Binary_codec<Version> {
+    static const size_t fixed_size = 2 * sizeof(int);
+    static size_t size(const Version &) {
+        return fixed_size;
+    }
+    static char *encode(const Version &v, char *out) {
+        out = Binary_codec<int>::encode(v.major, out);
+        return Binary_codec<int>::encode(v.minor, out);
+    }
+    static Version decode(Byte_reader &in) {
+        int major = Binary_codec<int>::decode(in);
+        return Version{ major, Binary_codec<int>::decode(in) };
+    }
+};
+
+TEST(save_and_load_round_trip){
+    BinarySearchTree<int> ints;
+    for (int i = 0; i < 1000; ++i) {
+        ints.insert(i);
+    }
+    stringstream bytes;
+    ints.save(bytes);
+    ASSERT_EQUAL(bytes.str().size(), 48 + 1000 * sizeof(int));
+    BinarySearchTree<int> loaded;
+    loaded.insert(-1);
+    ASSERT_TRUE(loaded.load(bytes));
+    ASSERT_TRUE(contents(loaded) == contents(ints));
+    ASSERT_EQUAL(loaded.height(), 10);
+    ASSERT_TRUE(loaded.check_sorting_invariant());
+    ASSERT_TRUE(loaded.check_balance_invariant());
+
+    BinarySearchTree<int> empty;
+    stringstream none;
+    empty.save(none);
+    ASSERT_TRUE(loaded.load(none));
+    ASSERT_TRUE(loaded.empty());
+
+    BinarySearchTree<pair<string, double>> mixed;
+    mixed.insert({ "", 0.5 });
+    mixed.insert({ "beta", 2 });
+    mixed.insert({ "alpha", -1 });
+    stringstream text;
+    mixed.save(text);
+    BinarySearchTree<pair<string, double>> mixed_loaded;
+    ASSERT_TRUE(mixed_loaded.load(text));
+    using Entries = vector<pair<string, double>>;
+    ASSERT_TRUE(Entries(mixed_loaded.begin(), mixed_loaded.end())
+                == Entries(mixed.begin(), mixed.end()));
+
+    BinarySearchTree<Version> versions;
+    versions.insert({ 2, 1 });
+    versions.insert({ 1, 9 });
+    stringstream custom;
+    versions.save(custom);
+    BinarySearchTree<Version> versions_loaded;
+    ASSERT_TRUE(versions_loaded.load(custom));
+    ASSERT_EQUAL(versions_loaded.min_element()->minor, 9);
+    ASSERT_EQUAL(versions_loaded.max_element()->major, 2);
+}
+
+TEST(snapshots_back_to_back_in_one_stream){
+    BinarySearchTree<string> a;
+    a.insert("one");
+    BinarySearchTree<string> b;
+    b.insert("two");
+    b.insert("three");
+    stringstream bytes;
+    a.save(bytes);
+    b.save(bytes);
+    BinarySearchTree<string> a_loaded;
+    BinarySearchTree<string> b_loaded;
+    ASSERT_TRUE(a_loaded.load(bytes));
+    ASSERT_TRUE(b_loaded.load(bytes));
+    ASSERT_EQUAL(*a_loaded.begin(), "one");
+    ASSERT_TRUE(vector<string>(b_loaded.begin(), b_loaded.end())
+                == vector<string>(b.begin(), b.end()));
+}
+
+// EFFECTS: Returns whether loading 'bytes' into a tree holding 42 fails
+//          and leaves the tree as it was.
+template <typename T, typename Compare = less<T>>
+static bool load_is_rejected(const string &bytes) {
+    BinarySearchTree<T, Compare> tree;
+    tree.insert(42);
+    stringstream in(bytes);
+    return !tree.load(in) && tree.size() == 1 && *tree.begin() == 42;
+}
+
+TEST(load_rejects_damaged_snapshots){
+    BinarySearchTree<int> ints;
+    for (int i = 0; i < 100; ++i) {
+        ints.insert(i);
+    }
+    stringstream out;
+    ints.save(out);
+    const string good = out.str();
+
+    ASSERT_TRUE(load_is_rejected<int>(""));
+    ASSERT_TRUE(load_is_rejected<int>(good.substr(0, 20)));
+    ASSERT_TRUE(load_is_rejected<int>(good.substr(0, good.size() - 1)));
+    for (size_t at : { size_t(0), size_t(5), size_t(30), size_t(100),
+                       good.size() - 1 }) {
+        string damaged = good;
+        damaged[at] ^= 0x10;
+        ASSERT_TRUE(load_is_rejected<int>(damaged));
+    }
+    // The wrong element type, and elements out of order for the comparator
+    ASSERT_TRUE(load_is_rejected<long long>(good));
+    ASSERT_TRUE((load_is_rejected<int, greater<int>>(good)));
+}
+
+// EFFECTS: Returns an intact header for elements of type T that claims
+//          'count' elements in 'payload_bytes' bytes, followed by 'payload'.
+template <typename T>
+static string crafted_snapshot(uint64_t count, uint64_t payload_bytes,
+                               const string &payload) {
+    Snapshot_header header = make_snapshot_header<T>(0, payload.data(),
+                                                     payload.size());
+    header.count = count;
+    header.payload_bytes = payload_bytes;
+    header.header_checksum = snapshot_checksum(
+        reinterpret_cast<const char *>(&header),
+        offsetof(Snapshot_header, header_checksum));
+    return string(reinterpret_cast<const char *>(&header), sizeof(header))
+           + payload;
+}
+
+// EFFECTS: Returns whether loading 'bytes' into a tree of strings succeeds.
+static bool loads_strings(const string &bytes) {
+    BinarySearchTree<string> tree;
+    stringstream in(bytes);
+    return tree.load(in);
+}
+
+TEST(load_rejects_counts_the_payload_cannot_hold){
+    // 2^61 eight-byte elements in 0 bytes: count * 8 wraps around to 0
+    ASSERT_TRUE(load_is_rejected<long long>(
+        crafted_snapshot<long long>(uint64_t(1) << 61, 0, "")));
+    ASSERT_TRUE(load_is_rejected<long long>(
+        crafted_snapshot<long long>(1, 8, string(4, '\0'))));
+
+    // An empty string is 8 bytes, so 8 bytes hold one string and no more
+    const string empty_string(sizeof(uint64_t), '\0');
+    ASSERT_TRUE(loads_strings(crafted_snapshot<string>(1, 8, empty_string)));
+    ASSERT_FALSE(loads_strings(crafted_snapshot<string>(2, 8, empty_string)));
+    ASSERT_FALSE(loads_strings(
+        crafted_snapshot<string>(uint64_t(1) << 40, 8, empty_string)));
+
+    // A terabyte payload is claimed but only 8 bytes follow
+    ASSERT_FALSE(loads_strings(
+        crafted_snapshot<string>(1, uint64_t(1) << 40, empty_string)));
+}
 
 TEST_MAIN()
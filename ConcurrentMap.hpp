@@ -0,0 +1,321 @@
+#ifndef CONCURRENT_MAP_HPP
+#define CONCURRENT_MAP_HPP
+/* ConcurrentMap.hpp
+ *
+ * A Map that many threads can read while others write, without readers
+ * ever waiting for a writer.
+ *
+ * Each version of the contents is an immutable PersistentTree of
+ * key-value pairs, published through an atomic pointer. A reader loads
+ * the pointer and searches that version; it never sees a write in
+ * progress and takes no lock and no shared reference count. A writer
+ * takes a mutex (so writers are serialized), builds the next version by
+ * path copying, which copies O(log n) nodes and shares the rest, and
+ * publishes it with an atomic store.
+ *
+ * A replaced version is retired rather than freed, since readers may
+ * still be searching it. Reclamation is epoch based: a reader announces
+ * the global epoch in a slot of its own before loading the pointer, and
+ * each write stamps the version it retires with the epoch and then
+ * advances it. A retired version is freed once every announced epoch is
+ * newer than its stamp, which plays the part of the grace period in
+ * read-copy-update. Retired versions are freed in batches, so writes
+ * scan the reader slots only now and then.
+ *
+ * Example:
+ *   ConcurrentMap<string, int> counts;
+ *   counts.insert_or_assign("apple", 3);     // any thread
+ *   std::optional<int> n = counts.find("apple");  // any thread
+ *   for (auto &entry : counts.snapshot()) { ... }  // a consistent view
+ */
+
+#include "Map.hpp"
+#include "PersistentTree.hpp"
+#include <algorithm> //remove_if
+#include <atomic>   //atomic
+#include <cstdint>  //uint64_t, UINT64_MAX
+#include <functional> //hash, less
+#include <memory>   //unique_ptr
+#include <mutex>    //mutex, lock_guard
+#include <optional> //optional
+#include <thread>   //this_thread
+#include <utility>  //pair, move, forward
+#include <vector>   //vector
+
+template <typename Key_type, typename Value_type,
+          typename Key_compare=std::less<Key_type>
+         >
+class ConcurrentMap {
+
+  // OVERVIEW: A thread-safe map of unique keys to values. All member
+  //           functions may be called concurrently from any thread.
+
+public:
+  // Type alias for an element, a key and the value it maps to
+  using Pair_type = std::pair<Key_type, Value_type>;
+
+  // Orders elements by key alone. It also compares an element with a
+  // bare key, so that versions can be searched by key.
+  class Entry_less {
+  public:
+    using is_transparent = void;
+
+    bool operator()(const Pair_type &a, const Pair_type &b) const {
+      return less(a.first, b.first);
+    }
+
+    bool operator()(const Pair_type &a, const Key_type &k) const {
+      return less(a.first, k);
+    }
+
+    bool operator()(const Key_type &k, const Pair_type &b) const {
+      return less(k, b.first);
+    }
+
+  private:
+    Key_compare less;
+  };
+
+  // Type alias for a read-only version of the contents, ordered by key.
+  // A Snapshot stays valid and unchanged for as long as it is held, and
+  // copying one is O(1).
+  using Snapshot = PersistentTree<Pair_type, Entry_less>;
+
+  // EFFECTS : Creates an empty ConcurrentMap.
+  ConcurrentMap()
+    : current(new Snapshot()) { }
+
+  // EFFECTS : Creates a ConcurrentMap holding a copy of contents.
+  template <typename Storage>
+  explicit ConcurrentMap(const Map<Key_type, Value_type, Key_compare,
+                                   Storage> &contents)
+    : ConcurrentMap() {
+    Snapshot loaded;
+    for (const auto &entry : contents) {
+      loaded = loaded.insert(entry);
+    }
+    *current.load() = std::move(loaded);
+  }
+
+  // A ConcurrentMap is shared by reference between threads; copy its
+  // snapshot() instead.
+  ConcurrentMap(const ConcurrentMap &) = delete;
+  ConcurrentMap &operator=(const ConcurrentMap &) = delete;
+
+  // REQUIRES: No other thread is using this map.
+  // EFFECTS : Frees the current version and every retired one.
+  ~ConcurrentMap() {
+    delete current.load();
+    for (const Retired &old : retired) {
+      delete old.version;
+    }
+  }
+
+  // EFFECTS : Returns the current contents. Later writes do not change
+  //           the returned Snapshot.
+  // NOTE    : Takes a reference to the version's root, which every
+  //           snapshot of that version shares. find, contains and size do
+  //           not, so prefer them for single lookups.
+  Snapshot snapshot() const {
+    Read_guard guard(*this);
+    return *guard.version;
+  }
+
+  // EFFECTS : Returns whether this map is empty.
+  bool empty() const {
+    Read_guard guard(*this);
+    return guard.version->empty();
+  }
+
+  // EFFECTS : Returns the number of elements in this map.
+  size_t size() const {
+    Read_guard guard(*this);
+    return guard.version->size();
+  }
+
+  // EFFECTS : Returns a copy of the value mapped to k, or an empty
+  //           optional if k is not present.
+  std::optional<Value_type> find(const Key_type &k) const {
+    Read_guard guard(*this);
+    auto it = guard.version->find(k);
+    if (it == guard.version->end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  // EFFECTS : Returns whether k is present.
+  bool contains(const Key_type &k) const {
+    Read_guard guard(*this);
+    return guard.version->find(k) != guard.version->end();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Inserts val if its key is not present. Returns whether it
+  //           was inserted.
+  bool insert(const Pair_type &val) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    const Snapshot &contents = *current.load();
+    Snapshot next = contents.insert(val);
+    if (next.size() == contents.size()) {
+      return false;
+    }
+    publish(std::move(next));
+    return true;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Maps k to v, replacing any value k had. Returns whether k
+  //           was newly inserted.
+  bool insert_or_assign(const Key_type &k, const Value_type &v) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    const Snapshot &contents = *current.load();
+    Snapshot next = contents.insert_or_assign(Pair_type(k, v));
+    bool inserted = next.size() != contents.size();
+    publish(std::move(next));
+    return inserted;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the element with key k, if there is one. Returns the
+  //           number of elements removed (0 or 1).
+  size_t erase(const Key_type &k) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    const Snapshot &contents = *current.load();
+    Snapshot next = contents.erase(k);
+    if (next.size() == contents.size()) {
+      return 0;
+    }
+    publish(std::move(next));
+    return 1;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Calls change(s) on the current contents s and publishes the
+  //           Snapshot it returns, so readers see all of the changes made
+  //           by change or none of them. If change throws, nothing is
+  //           published.
+  // NOTE    : s is immutable; change builds the new version from it with
+  //           insert, insert_or_assign and erase, each O(log n).
+  template <typename Change>
+  void update(Change &&change) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    publish(std::forward<Change>(change)(*current.load()));
+  }
+
+private:
+  // A version that has been replaced, and the epoch it was retired in
+  struct Retired {
+    const Snapshot *version;
+    uint64_t epoch;
+  };
+
+  // Where a reader announces the epoch it started in, or 0 if the slot
+  // is free. Each slot has a cache line to itself, so readers on
+  // different slots do not contend.
+  struct alignas(64) Reader_slot {
+    std::atomic<uint64_t> epoch{ 0 };
+  };
+
+  // Claims a reader slot from construction until destruction and holds
+  // the version that was published when it started
+  class Read_guard {
+  public:
+    explicit Read_guard(const ConcurrentMap &map)
+      : slot(map.enter()), version(map.current.load()) { }
+
+    ~Read_guard() {
+      slot->store(0, std::memory_order_release);
+    }
+
+    Read_guard(const Read_guard &) = delete;
+    Read_guard &operator=(const Read_guard &) = delete;
+
+    std::atomic<uint64_t> *const slot;
+    const Snapshot *const version;
+  };
+
+  // The number of reader slots. More concurrent readers than this wait
+  // for a slot to come free.
+  static const size_t reader_slots = 128;
+
+  // The number of retired versions that triggers a reclamation pass
+  static const size_t retire_batch = 64;
+
+  // The published contents, never null
+  std::atomic<Snapshot *> current;
+
+  // The current epoch. Starts at 1, since 0 marks a free reader slot.
+  std::atomic<uint64_t> epoch{ 1 };
+
+  mutable Reader_slot slots[reader_slots];
+
+  // Held by a writer from reading the current contents until its new
+  // version is published, so that no write is lost. Also guards retired.
+  std::mutex write_mutex;
+
+  // Versions that have been replaced but may still be in use by readers
+  std::vector<Retired> retired;
+
+  // EFFECTS : Announces the current epoch in a free reader slot and
+  //           returns the slot. Waits if every slot is in use.
+  // NOTE    : The announcement comes before the reader loads current, so
+  //           a writer that retires the version the reader loads is sure
+  //           to see it, with an epoch no newer than the version's stamp.
+  std::atomic<uint64_t> *enter() const {
+    static thread_local size_t hint =
+      std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (size_t tried = 1; ; ++tried) {
+      std::atomic<uint64_t> &slot = slots[hint % reader_slots].epoch;
+      uint64_t idle = 0;
+      if (slot.load(std::memory_order_relaxed) == 0 &&
+          slot.compare_exchange_strong(idle, epoch.load())) {
+        return &slot;
+      }
+      ++hint;
+      if (tried % reader_slots == 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // REQUIRES: write_mutex is held.
+  // MODIFIES: this
+  // EFFECTS : Publishes next as the current contents and retires the
+  //           version it replaces.
+  void publish(Snapshot &&next) {
+    std::unique_ptr<Snapshot> fresh(new Snapshot(std::move(next)));
+    retired.push_back({ current.load(), 0 });
+    current.store(fresh.release());
+    retired.back().epoch = epoch.fetch_add(1);
+    if (retired.size() >= retire_batch) {
+      reclaim();
+    }
+  }
+
+  // REQUIRES: write_mutex is held.
+  // MODIFIES: this
+  // EFFECTS : Frees every retired version that no reader can still hold:
+  //           those retired before the oldest announced epoch.
+  void reclaim() {
+    uint64_t oldest = UINT64_MAX;
+    for (const Reader_slot &slot : slots) {
+      uint64_t announced = slot.epoch.load();
+      if (announced != 0 && announced < oldest) {
+        oldest = announced;
+      }
+    }
+    auto done = std::remove_if(retired.begin(), retired.end(),
+                               [oldest](const Retired &old) {
+      if (old.epoch >= oldest) {
+        return false;
+      }
+      delete old.version;
+      return true;
+    });
+    retired.erase(done, retired.end());
+  }
+
+}; // END of ConcurrentMap class
+
+#endif // CONCURRENT_MAP_HPP
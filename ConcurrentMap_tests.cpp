@@ -0,0 +1,146 @@
+#include "ConcurrentMap.hpp"
+#include "unit_test_framework.hpp"
+// make ConcurrentMap_tests.exe
+// ./ConcurrentMap_tests.exe
+using namespace std;
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(single_thread_operations){
+    ConcurrentMap<string, int> map;
+    ASSERT_TRUE(map.empty());
+    ASSERT_TRUE(map.insert({ "apple", 1 }));
+    ASSERT_FALSE(map.insert({ "apple", 2 }));
+    ASSERT_EQUAL(*map.find("apple"), 1);
+    ASSERT_FALSE(map.insert_or_assign("apple", 3));
+    ASSERT_TRUE(map.insert_or_assign("banana", 4));
+    ASSERT_EQUAL(*map.find("apple"), 3);
+    ASSERT_EQUAL(map.size(), 2);
+    ASSERT_FALSE(map.find("cherry").has_value());
+    ASSERT_TRUE(map.contains("banana"));
+    ASSERT_EQUAL(map.erase("banana"), 1);
+    ASSERT_EQUAL(map.erase("banana"), 0);
+    ASSERT_FALSE(map.contains("banana"));
+}
+
+TEST(snapshot_is_unaffected_by_writes){
+    ConcurrentMap<int, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map.insert({ i, i });
+    }
+    auto before = map.snapshot();
+    map.erase(50);
+    map.insert_or_assign(10, -1);
+    ASSERT_EQUAL(before.size(), 100);
+    ASSERT_EQUAL(before.find(10)->second, 10);
+    ASSERT_EQUAL(map.size(), 99);
+    ASSERT_EQUAL(*map.find(10), -1);
+}
+
+TEST(noop_writes_do_not_copy){
+    ConcurrentMap<int, int> map;
+    map.insert({ 1, 1 });
+    auto before = map.snapshot();
+    ASSERT_FALSE(map.insert({ 1, 2 }));
+    ASSERT_EQUAL(map.erase(7), 0);
+    ASSERT_EQUAL(&*map.snapshot().begin(), &*before.begin());
+}
+
+TEST(writes_share_unchanged_elements){
+    ConcurrentMap<int, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map.insert({ i, i });
+    }
+    auto before = map.snapshot();
+    map.insert_or_assign(99, -1);
+    auto after = map.snapshot();
+    ASSERT_EQUAL(&*after.find(0), &*before.find(0));
+    ASSERT_NOT_EQUAL(&*after.find(99), &*before.find(99));
+    ASSERT_EQUAL(before.find(99)->second, 99);
+}
+
+TEST(loads_a_map){
+    Map<int, int> contents;
+    for (int i = 0; i < 50; ++i) {
+        contents[i] = -i;
+    }
+    ConcurrentMap<int, int> map(contents);
+    ASSERT_EQUAL(map.size(), 50);
+    ASSERT_EQUAL(*map.find(7), -7);
+}
+
+TEST(update_is_all_or_nothing){
+    using Snapshot = ConcurrentMap<int, int>::Snapshot;
+    ConcurrentMap<int, int> map;
+    map.update([](const Snapshot &contents) {
+        Snapshot next = contents;
+        for (int i = 0; i < 1000; ++i) {
+            next = next.insert_or_assign({ i, i });
+        }
+        return next;
+    });
+    ASSERT_EQUAL(map.size(), 1000);
+    bool threw = false;
+    try {
+        map.update([](const Snapshot &contents) -> Snapshot {
+            Snapshot next = contents.erase(5);
+            throw runtime_error("abandon");
+        });
+    }
+    catch (const runtime_error &) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    ASSERT_TRUE(map.contains(5));
+}
+
+// Writers insert keys 0..n-1 with value 2k, then erase the odd keys.
+// Readers check that every snapshot they see is consistent: all values
+// are 2k and the keys are sorted.
+TEST(readers_see_consistent_snapshots){
+    const int n = 400;
+    ConcurrentMap<int, int> map;
+    atomic<bool> done(false);
+    atomic<int> bad(0);
+    vector<thread> readers;
+    for (int r = 0; r < 4; ++r) {
+        readers.emplace_back([&]() {
+            while (!done.load()) {
+                auto contents = map.snapshot();
+                int prev = -1;
+                for (auto &entry : contents) {
+                    bad += entry.second != 2 * entry.first || entry.first <= prev;
+                    prev = entry.first;
+                }
+                auto value = map.find(n / 2);
+                bad += value.has_value() && *value != n;
+            }
+        });
+    }
+    vector<thread> writers;
+    for (int w = 0; w < 2; ++w) {
+        writers.emplace_back([&, w]() {
+            for (int k = w; k < n; k += 2) {
+                map.insert({ k, 2 * k });
+            }
+        });
+    }
+    for (thread &writer : writers) {
+        writer.join();
+    }
+    ASSERT_EQUAL(map.size(), n);
+    for (int k = 1; k < n; k += 2) {
+        map.erase(k);
+    }
+    done = true;
+    for (thread &reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQUAL(bad.load(), 0);
+    ASSERT_EQUAL(map.size(), n / 2);
+}
+
+TEST_MAIN()
@@ -0,0 +1,79 @@
+#ifndef FORK_JOIN_HPP
+#define FORK_JOIN_HPP
+/* ForkJoin.hpp
+ *
+ * Runs two halves of a divide-and-conquer job at the same time.
+ *
+ * The trees split whole-tree work (copying, destruction, bulk builds) into
+ * two subtrees whose sizes they already know, so they can divide a thread
+ * budget between the halves up front and need no scheduler to balance the
+ * load afterwards. Each split starts one thread, which runs one half while
+ * the calling thread runs the other.
+ *
+ * Example:
+ *   size_t left_count, right_count;
+ *   fork_join([&]() { left_count = count(left); },
+ *             [&]() { right_count = count(right); });
+ */
+
+#include <cstddef>      //size_t
+#include <exception>    //exception_ptr, current_exception, rethrow_exception
+#include <system_error> //system_error
+#include <thread>       //thread
+
+// EFFECTS: Runs first() on a new thread and second() on this one, and
+//          returns once both have finished. If either threw, rethrows the
+//          exception from first(), or else the one from second(). If no
+//          thread can be started, runs first() and then second() on this
+//          thread.
+template <typename First, typename Second>
+void fork_join(First &&first, Second &&second) {
+  std::exception_ptr first_error;
+  std::exception_ptr second_error;
+  auto run_first = [&]() {
+    try {
+      first();
+    }
+    catch (...) {
+      first_error = std::current_exception();
+    }
+  };
+  std::thread worker;
+  try {
+    worker = std::thread(run_first);
+  }
+  catch (const std::system_error &) {
+    run_first();
+  }
+  try {
+    second();
+  }
+  catch (...) {
+    second_error = std::current_exception();
+  }
+  if (worker.joinable()) {
+    worker.join();
+  }
+  if (first_error) {
+    std::rethrow_exception(first_error);
+  }
+  if (second_error) {
+    std::rethrow_exception(second_error);
+  }
+}
+
+// REQUIRES: threads >= 2, left_size + right_size > 0
+// EFFECTS : Returns how many of 'threads' threads to give the first of
+//           two jobs whose sizes are left_size and right_size, in
+//           proportion to its size, leaving at least one for each job.
+inline size_t split_threads(size_t threads, size_t left_size,
+                            size_t right_size) {
+  double share = static_cast<double>(left_size) / (left_size + right_size);
+  size_t left = static_cast<size_t>(share * threads + 0.5);
+  if (left < 1) {
+    return 1;
+  }
+  return left < threads - 1 ? left : threads - 1;
+}
+
+#endif // FORK_JOIN_HPP
@@ -0,0 +1,379 @@
+#ifndef FROZEN_TREE_HPP
+#define FROZEN_TREE_HPP
+/* FrozenTree.hpp
+ *
+ * An immutable, pointer-free snapshot of a sorted set of elements, for
+ * data that is built once and then only queried.
+ *
+ * The elements are stored in one contiguous, cache-line aligned array in
+ * Eytzinger (breadth-first) order: the root of a perfectly balanced search
+ * tree is at index 1 and the children of the element at index k are at
+ * 2k and 2k + 1. A search walks down the array by index arithmetic with
+ * no pointers to chase and no data-dependent branches, and prefetches the
+ * cache line holding the elements a few levels below the current one.
+ *
+ * A FrozenTree is usually obtained from freeze() on a BinarySearchTree,
+ * BTree or Map.
+ *
+ * Example:
+ *   BinarySearchTree<int> tree;
+ *   ...
+ *   FrozenTree<int> frozen = tree.freeze();
+ *   cout << *frozen.find(3) << endl; // prints 3
+ */
+
+#include <cstddef>  //size_t, ptrdiff_t
+#include <functional> //less
+#include <iterator> //bidirectional_iterator_tag
+#include <new>      //operator new, align_val_t
+#include <utility>  //swap
+
+#if defined(__GNUC__)
+#define FROZEN_TREE_BUILTINS 1
+#else
+#define FROZEN_TREE_BUILTINS 0
+#endif
+
+template <typename T, typename Compare=std::less<T>>
+class FrozenTree {
+
+  // OVERVIEW: A read-only ordered set of elements of type T, ordered by
+  //           Compare, laid out in Eytzinger order.
+
+public:
+
+  // Default constructor: an empty snapshot
+  FrozenTree()
+    : data(nullptr), count(0) { }
+
+  // REQUIRES: [first, last) is strictly increasing according to Compare
+  // EFFECTS:  Creates a snapshot holding copies of the elements in
+  //           [first, last), in linear time.
+  template <typename Iter>
+  FrozenTree(Iter first, Iter last)
+    : data(nullptr), count(0) {
+    size_t n = 0;
+    for (Iter it = first; it != last; ++it) {
+      ++n;
+    }
+    data = allocate_impl(n);
+    fill(first, n);
+  }
+
+  // Copy constructor
+  FrozenTree(const FrozenTree &other)
+    : data(allocate_impl(other.count)), count(0) {
+    fill(other.begin(), other.count);
+  }
+
+  // Move constructor
+  FrozenTree(FrozenTree &&other) noexcept
+    : data(other.data), count(other.count) {
+    other.data = nullptr;
+    other.count = 0;
+  }
+
+  // Assignment operator (copy and move, through the constructors)
+  FrozenTree &operator=(FrozenTree rhs) {
+    std::swap(data, rhs.data);
+    std::swap(count, rhs.count);
+    std::swap(less, rhs.less);
+    return *this;
+  }
+
+  // Destructor
+  ~FrozenTree() {
+    destroy_impl(data, count, count);
+  }
+
+  // EFFECTS: Returns whether this snapshot is empty.
+  bool empty() const {
+    return count == 0;
+  }
+
+  // EFFECTS: Returns the number of elements in this snapshot.
+  size_t size() const {
+    return count;
+  }
+
+  class Iterator {
+    // OVERVIEW: Iterates over the elements of a FrozenTree in ascending
+    //           order. An Iterator holds an index into the array and steps
+    //           to the next element in sorted order by index arithmetic.
+    //           It also holds the index of the next element, found on
+    //           the previous step, so each step prefetches the element
+    //           after the next one without finding it twice.
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator()
+      : tree(nullptr), index(0), successor(0) { }
+
+    const T &operator*() const {
+      return tree->data[index];
+    }
+
+    const T *operator->() const {
+      return &tree->data[index];
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      index = successor;
+      successor = index ? next_impl(index, tree->count) : 0;
+      prefetch_impl(tree->data + successor);
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    // Prefix --
+    // REQUIRES: this Iterator does not refer to the minimum element
+    Iterator &operator--() {
+      successor = index;
+      index = index ? prev_impl(index, tree->count) : last_impl(tree->count);
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Iterator operator--(int) {
+      Iterator result(*this);
+      --(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return index == rhs.index;
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return index != rhs.index;
+    }
+
+  private:
+    friend class FrozenTree;
+
+    const FrozenTree *tree;
+    // Position in the array, or 0 for past-the-end
+    size_t index;
+    // Position of the next element in sorted order, or 0 if there is none
+    size_t successor;
+
+    Iterator(const FrozenTree *tree_in, size_t index_in)
+      : tree(tree_in), index(index_in),
+        successor(index_in ? next_impl(index_in, tree_in->count) : 0) { }
+  }; // FrozenTree::Iterator
+
+  // EFFECTS: Returns an iterator to the smallest element, or an end
+  //          Iterator if the snapshot is empty.
+  Iterator begin() const {
+    return Iterator(this, first_impl(count));
+  }
+
+  // EFFECTS: Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator(this, 0);
+  }
+
+  // EFFECTS: Returns an iterator to the element equivalent to query, or an
+  //          end Iterator if there is none.
+  Iterator find(const T &query) const {
+    return find_key(query);
+  }
+
+  // EFFECTS: Same as find(const T &), for a value of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return find_key(query);
+  }
+
+  // EFFECTS: Returns an iterator to the smallest element greater than val,
+  //          or an end Iterator if there is none.
+  Iterator min_greater_than(const T &val) const {
+    return Iterator(this, search_impl(val, false));
+  }
+
+  // EFFECTS: Same as min_greater_than(const T &), for a value of another
+  //          type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator min_greater_than(const K &val) const {
+    return Iterator(this, search_impl(val, false));
+  }
+
+private:
+  // The array of elements. Index 0 is unused, so that the children of
+  // index k are at 2k and 2k + 1.
+  T *data;
+
+  // The number of elements, which occupy indices 1 through count
+  size_t count;
+
+  // An instance of the Compare type. Use this to compare elements.
+  Compare less;
+
+  // The array is aligned to a cache line, and a search prefetches the
+  // line holding the descendants of the current element this many times
+  // its index. Those descendants are contiguous and line-aligned when
+  // elements evenly divide a line.
+  static constexpr size_t line_bytes = 64;
+  static constexpr size_t prefetch_stride =
+    sizeof(T) >= line_bytes ? 2 : line_bytes / sizeof(T);
+
+  template <typename K>
+  Iterator find_key(const K &query) const {
+    size_t k = search_impl(query, true);
+    return Iterator(this, k && !less(query, data[k]) ? k : 0);
+  }
+
+  // EFFECTS: Returns the index of the smallest element not less than key
+  //          (or, if or_equal is false, greater than key), or 0 if there
+  //          is none.
+  // NOTE:    The loop turns right exactly when the current element is
+  //          before the one sought, so the bits of k record the path. The
+  //          answer is the last element where it turned left: strip the
+  //          trailing right turns, then that left turn.
+  template <typename K>
+  size_t search_impl(const K &key, bool or_equal) const {
+    size_t k = 1;
+    while (k <= count) {
+      prefetch_impl(data + k * prefetch_stride);
+      bool right = or_equal ? less(data[k], key) : !less(key, data[k]);
+      k = 2 * k + right;
+    }
+    return k >> (trailing_ones_impl(k) + 1);
+  }
+
+  // EFFECTS: Asks the processor to start loading the cache line holding
+  //          'address', if the compiler offers a way to.
+  static void prefetch_impl(const T *address) {
+#if FROZEN_TREE_BUILTINS
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+  }
+
+  // EFFECTS: Returns the number of consecutive 1 bits at the bottom of k.
+  static unsigned trailing_ones_impl(size_t k) {
+#if FROZEN_TREE_BUILTINS
+    return __builtin_ctzll(~static_cast<unsigned long long>(k));
+#else
+    unsigned ones = 0;
+    for (; k & 1; k >>= 1) {
+      ++ones;
+    }
+    return ones;
+#endif
+  }
+
+  // REQUIRES: data has room for n elements
+  // EFFECTS:  Copies n elements from 'first' into data in Eytzinger order
+  //           and sets count. If a copy throws, destroys the elements
+  //           copied so far, frees data and rethrows.
+  template <typename Iter>
+  void fill(Iter first, size_t n) {
+    size_t done = 0;
+    try {
+      for (size_t k = first_impl(n); k; k = next_impl(k, n), ++first) {
+        new (data + k) T(*first);
+        ++done;
+      }
+    }
+    catch (...) {
+      destroy_impl(data, done, n);
+      data = nullptr;
+      throw;
+    }
+    count = n;
+  }
+
+  // REQUIRES: array has room for n elements in Eytzinger order, of which
+  //           the done smallest are constructed
+  // EFFECTS:  Destroys those elements and frees array.
+  static void destroy_impl(T *array, size_t done, size_t n) {
+    for (size_t k = first_impl(n); done > 0; k = next_impl(k, n), --done) {
+      array[k].~T();
+    }
+    ::operator delete(array, std::align_val_t(line_bytes));
+  }
+
+  // EFFECTS: Returns storage for indices 0 through n, aligned to a cache
+  //          line.
+  static T *allocate_impl(size_t n) {
+    size_t bytes = (n + 1) * sizeof(T);
+    return static_cast<T *>(::operator new(bytes,
+                                           std::align_val_t(line_bytes)));
+  }
+
+  // EFFECTS: Returns the index of the smallest of n elements, or 0 if
+  //          n is 0.
+  static size_t first_impl(size_t n) {
+    size_t k = n ? 1 : 0;
+    while (2 * k <= n && k) {
+      k *= 2;
+    }
+    return k;
+  }
+
+  // EFFECTS: Returns the index of the largest of n elements.
+  static size_t last_impl(size_t n) {
+    size_t k = 1;
+    while (2 * k + 1 <= n) {
+      k = 2 * k + 1;
+    }
+    return k;
+  }
+
+  // EFFECTS: Returns the index of the element after the one at k in
+  //          sorted order, or 0 if k is the largest of n elements.
+  static size_t next_impl(size_t k, size_t n) {
+    if (2 * k + 1 <= n) {
+      // Leftmost element of the right subtree
+      k = 2 * k + 1;
+      while (2 * k <= n) {
+        k *= 2;
+      }
+      return k;
+    }
+    // Closest ancestor that has k in its left subtree
+    while (k & 1) {
+      k >>= 1;
+    }
+    return k >> 1;
+  }
+
+  // EFFECTS: Returns the index of the element before the one at k in
+  //          sorted order, or 0 if k is the smallest of n elements.
+  static size_t prev_impl(size_t k, size_t n) {
+    if (2 * k <= n) {
+      // Rightmost element of the left subtree
+      k = 2 * k;
+      while (2 * k + 1 <= n) {
+        k = 2 * k + 1;
+      }
+      return k;
+    }
+    // Closest ancestor that has k in its right subtree
+    while (k && !(k & 1)) {
+      k >>= 1;
+    }
+    return k >> 1;
+  }
+
+}; // END of FrozenTree class
+
+#endif // FROZEN_TREE_HPP
@@ -0,0 +1,171 @@
+#include "FrozenTree.hpp"
+#include "BinarySearchTree.hpp"
+#include "BTree.hpp"
+#include "unit_test_framework.hpp"
+// make FrozenTree_tests.exe
+// ./FrozenTree_tests.exe
+using namespace std;
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Larger than a cache line, so a search prefetches by children rather
+// than by whole lines of descendants.
+struct Wide {
+    int key;
+    char padding[120];
+    Wide(int key_in) : key(key_in) {}
+    bool operator<(const Wide &rhs) const { return key < rhs.key; }
+};
+
+// EFFECTS: Returns the even numbers 0, 2, ..., 2(n - 1).
+static vector<int> evens(int n) {
+    vector<int> result;
+    for (int i = 0; i < n; ++i) {
+        result.push_back(2 * i);
+    }
+    return result;
+}
+
+TEST(empty_snapshot){
+    FrozenTree<int> frozen;
+    ASSERT_TRUE(frozen.empty());
+    ASSERT_EQUAL(frozen.size(), 0);
+    ASSERT_TRUE(frozen.begin() == frozen.end());
+    ASSERT_TRUE(frozen.find(3) == frozen.end());
+    ASSERT_TRUE(frozen.min_greater_than(3) == frozen.end());
+    BinarySearchTree<int> tree;
+    ASSERT_TRUE(tree.freeze().empty());
+}
+
+// Every size up to a few levels, so that both full and partly filled
+// bottom levels are covered.
+TEST(find_and_min_greater_than_every_size){
+    for (int n = 0; n < 70; ++n) {
+        vector<int> items = evens(n);
+        FrozenTree<int> frozen(items.begin(), items.end());
+        ASSERT_EQUAL(frozen.size(), n);
+        for (int query = -1; query <= 2 * n; ++query) {
+            auto found = frozen.find(query);
+            if (query >= 0 && query % 2 == 0 && query < 2 * n) {
+                ASSERT_EQUAL(*found, query);
+            }
+            else {
+                ASSERT_TRUE(found == frozen.end());
+            }
+            auto next = frozen.min_greater_than(query);
+            int expected = query < 0 ? 0 : query + 2 - query % 2;
+            if (expected < 2 * n) {
+                ASSERT_EQUAL(*next, expected);
+            }
+            else {
+                ASSERT_TRUE(next == frozen.end());
+            }
+        }
+    }
+}
+
+TEST(iterates_in_order_both_ways){
+    for (int n = 1; n < 70; ++n) {
+        vector<int> items = evens(n);
+        FrozenTree<int> frozen(items.begin(), items.end());
+        vector<int> forward(frozen.begin(), frozen.end());
+        ASSERT_TRUE(forward == items);
+        auto it = frozen.end();
+        for (int i = n - 1; i >= 0; --i) {
+            ASSERT_EQUAL(*--it, 2 * i);
+        }
+        ASSERT_TRUE(it == frozen.begin());
+        for (int i = 0; i < n; ++i) {
+            ASSERT_EQUAL(*it++, 2 * i);
+        }
+        ASSERT_TRUE(it == frozen.end());
+        // Steps forward from a found element after turning around
+        auto mid = frozen.find(2 * (n / 2));
+        if (n / 2 > 0) {
+            --mid;
+            ASSERT_EQUAL(*++mid, 2 * (n / 2));
+        }
+        if (++mid != frozen.end()) {
+            ASSERT_EQUAL(*mid, 2 * (n / 2 + 1));
+        }
+        else {
+            ASSERT_EQUAL(n / 2 + 1, n);
+        }
+    }
+}
+
+TEST(freeze_binary_search_tree){
+    BinarySearchTree<int> tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert((i * 7919) % 1000);
+    }
+    FrozenTree<int> frozen = tree.freeze();
+    tree.insert(5000);
+    ASSERT_EQUAL(frozen.size(), 1000);
+    ASSERT_TRUE(frozen.find(5000) == frozen.end());
+    ASSERT_EQUAL(*frozen.find(617), 617);
+    ASSERT_EQUAL(*frozen.min_greater_than(998), 999);
+    ASSERT_TRUE(vector<int>(frozen.begin(), frozen.end())
+                == vector<int>(tree.begin(), tree.min_greater_than(999)));
+}
+
+TEST(freeze_btree_wide){
+    BTree<Wide> tree;
+    for (int i = 0; i < 300; ++i) {
+        tree.try_insert(Wide((i * 37) % 300));
+    }
+    FrozenTree<Wide> frozen = tree.freeze();
+    ASSERT_EQUAL(frozen.size(), 300);
+    ASSERT_EQUAL(frozen.find(Wide(150))->key, 150);
+    ASSERT_EQUAL(frozen.min_greater_than(Wide(150))->key, 151);
+    int expected = 0;
+    for (const Wide &item : frozen) {
+        ASSERT_EQUAL(item.key, expected++);
+    }
+}
+
+TEST(copy_move_and_transparent_lookup){
+    vector<string> words = {"apple", "banana", "cherry", "date", "fig"};
+    FrozenTree<string, less<>> frozen(words.begin(), words.end());
+    FrozenTree<string, less<>> copy(frozen);
+    FrozenTree<string, less<>> moved(std::move(frozen));
+    ASSERT_TRUE(frozen.empty());
+    frozen = copy;
+    ASSERT_EQUAL(*frozen.find("date"), "date");
+    ASSERT_EQUAL(*moved.min_greater_than("c"), "cherry");
+    ASSERT_TRUE(copy.find("grape") == copy.end());
+    ASSERT_EQUAL(moved.size(), 5);
+}
+
+struct Fragile {
+    static int copies_left;
+    int value;
+    Fragile(int value_in) : value(value_in) {}
+    Fragile(const Fragile &other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw runtime_error("copy failed");
+        }
+    }
+    bool operator<(const Fragile &rhs) const { return value < rhs.value; }
+};
+int Fragile::copies_left = 0;
+
+TEST(failed_copy_frees_partial_snapshot){
+    Fragile::copies_left = 1000;
+    vector<Fragile> items;
+    for (int i = 0; i < 100; ++i) {
+        items.push_back(Fragile(i));
+    }
+    Fragile::copies_left = 37;
+    bool threw = false;
+    try {
+        FrozenTree<Fragile> frozen(items.begin(), items.end());
+    }
+    catch (const runtime_error &) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+}
+
+TEST_MAIN()
@@ -0,0 +1,50 @@
+#ifndef ITERATOR_RANGE_HPP
+#define ITERATOR_RANGE_HPP
+/* IteratorRange.hpp
+ *
+ * A pair of iterators that can be used in a range-based for loop.
+ *
+ * The trees return one from range(lo, hi) to visit the elements in an
+ * interval without a second lookup per step.
+ *
+ * Example:
+ *   for (const auto &entry : map.range("apple", "banana")) {
+ *     std::cout << entry.first << std::endl;
+ *   }
+ */
+
+template <typename Iterator>
+class Iterator_range {
+
+  // OVERVIEW: A view of the elements from one iterator up to (but not
+  //           including) another. It does not own the elements, and is
+  //           invalidated along with its iterators.
+
+public:
+  // REQUIRES: last is reachable from first by incrementing
+  // EFFECTS : Creates a view of [first, last).
+  Iterator_range(Iterator first_in, Iterator last_in)
+    : first(first_in), last(last_in) { }
+
+  // EFFECTS: Returns an iterator to the first element of the view.
+  Iterator begin() const {
+    return first;
+  }
+
+  // EFFECTS: Returns an iterator just past the last element of the view.
+  Iterator end() const {
+    return last;
+  }
+
+  // EFFECTS: Returns whether the view holds no elements.
+  bool empty() const {
+    return first == last;
+  }
+
+private:
+  Iterator first;
+  Iterator last;
+
+}; // END of Iterator_range class
+
+#endif // ITERATOR_RANGE_HPP
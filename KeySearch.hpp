@@ -0,0 +1,139 @@
+#ifndef KEY_SEARCH_HPP
+#define KEY_SEARCH_HPP
+/* KeySearch.hpp
+ *
+ * Search of a short sorted array of arithmetic keys, as found in a BTree
+ * node, that compares the query against many keys at once.
+ *
+ * count_keys_less(keys, n, query) returns the number of keys less than
+ * query, which for a strictly increasing array is the lower bound of
+ * query. For int32_t, int64_t, float and double keys on x86-64 it uses
+ * AVX2 when the processor supports it, checked once at run time, and
+ * otherwise a branch-free scalar loop. No compiler flags are needed: the
+ * AVX2 code is compiled through a function target attribute.
+ */
+
+#include <cstddef>  //size_t
+#include <cstdint>  //int32_t, int64_t
+#include <type_traits>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KEY_SEARCH_AVX2 1
+#include <immintrin.h>
+#else
+#define KEY_SEARCH_AVX2 0
+#endif
+
+// EFFECTS: Is true for the key types count_keys_less is vectorized for.
+template <typename K>
+struct is_vector_key
+  : std::integral_constant<bool, std::is_same<K, int32_t>::value
+                                 || std::is_same<K, int64_t>::value
+                                 || std::is_same<K, float>::value
+                                 || std::is_same<K, double>::value> { };
+
+// REQUIRES: keys[0..n) is sorted in increasing order
+// EFFECTS:  Returns the number of keys less than query.
+template <typename K>
+inline size_t count_keys_less_scalar(const K *keys, size_t n, K query) {
+  size_t result = 0;
+  for (size_t i = 0; i < n; ++i) {
+    result += keys[i] < query;
+  }
+  return result;
+}
+
+#if KEY_SEARCH_AVX2
+
+// EFFECTS: Returns whether the processor supports AVX2.
+inline bool key_search_has_avx2() {
+  static const bool has_avx2 = (__builtin_cpu_init(),
+                                __builtin_cpu_supports("avx2"));
+  return has_avx2;
+}
+
+// Each overload below compares the query against a vector of keys at a
+// time and counts the lanes that are less. Because the keys are sorted,
+// the first vector that is not entirely less ends the search.
+
+__attribute__((target("avx2")))
+inline size_t count_keys_less_avx2(const int32_t *keys, size_t n,
+                                   int32_t query) {
+  __m256i q = _mm256_set1_epi32(query);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i k = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i *>(keys + i));
+    __m256i less = _mm256_cmpgt_epi32(q, k);
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(less));
+    if (mask != 0xff) {
+      return i + __builtin_popcount(mask);
+    }
+  }
+  return i + count_keys_less_scalar(keys + i, n - i, query);
+}
+
+__attribute__((target("avx2")))
+inline size_t count_keys_less_avx2(const int64_t *keys, size_t n,
+                                   int64_t query) {
+  __m256i q = _mm256_set1_epi64x(query);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i k = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i *>(keys + i));
+    __m256i less = _mm256_cmpgt_epi64(q, k);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(less));
+    if (mask != 0xf) {
+      return i + __builtin_popcount(mask);
+    }
+  }
+  return i + count_keys_less_scalar(keys + i, n - i, query);
+}
+
+__attribute__((target("avx2")))
+inline size_t count_keys_less_avx2(const float *keys, size_t n, float query) {
+  __m256 q = _mm256_set1_ps(query);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 k = _mm256_loadu_ps(keys + i);
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(k, q, _CMP_LT_OQ));
+    if (mask != 0xff) {
+      return i + __builtin_popcount(mask);
+    }
+  }
+  return i + count_keys_less_scalar(keys + i, n - i, query);
+}
+
+__attribute__((target("avx2")))
+inline size_t count_keys_less_avx2(const double *keys, size_t n,
+                                   double query) {
+  __m256d q = _mm256_set1_pd(query);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d k = _mm256_loadu_pd(keys + i);
+    int mask = _mm256_movemask_pd(_mm256_cmp_pd(k, q, _CMP_LT_OQ));
+    if (mask != 0xf) {
+      return i + __builtin_popcount(mask);
+    }
+  }
+  return i + count_keys_less_scalar(keys + i, n - i, query);
+}
+
+#endif // KEY_SEARCH_AVX2
+
+// REQUIRES: keys[0..n) is sorted in increasing order
+// EFFECTS:  Returns the number of keys less than query, using AVX2 when
+//           it is available for this key type and processor.
+template <typename K>
+inline size_t count_keys_less(const K *keys, size_t n, K query) {
+#if KEY_SEARCH_AVX2
+  if constexpr (is_vector_key<K>::value) {
+    if (key_search_has_avx2()) {
+      return count_keys_less_avx2(keys, n, query);
+    }
+  }
+#endif
+  return count_keys_less_scalar(keys, n, query);
+}
+
+#endif // KEY_SEARCH_HPP
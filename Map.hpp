@@ -16,11 +16,54 @@
  */
 
 #include "BinarySearchTree.hpp"
+#include "BTree.hpp"
 #include <cassert>  //assert
-#include <utility>  //pair
+#include <iterator> //iterator_traits
+#include <utility>  //pair, move, forward, piecewise_construct
+#include <tuple>    //forward_as_tuple
+#include <type_traits>
+
+// STORAGE POLICIES
+// The Storage parameter of Map selects the ordered container that holds
+// its key-value pairs.
+//
+// TreeStorage:  a BinarySearchTree with one node per pair. Iterators and
+//               references stay valid until their element is erased.
+// BTreeStorage: a BTree, which packs many pairs into each node so that
+//               lookups in large maps take far fewer cache misses. Any
+//               insertion or erasure invalidates iterators and references.
+struct TreeStorage {
+  template <typename T, typename Compare>
+  using container = BinarySearchTree<T, Compare>;
+};
+
+struct BTreeStorage {
+  template <typename T, typename Compare>
+  using container = BTree<T, Compare>;
+};
+
+// EFFECTS: Gives the pair comparator of a Map a search key (see
+//          btree_search_key in BTree.hpp) when the keys are ordered by the
+//          built-in < and can be searched with vector instructions.
+template <typename Pair_type, typename Key_compare, typename = void>
+struct pair_search_key { };
+
+template <typename Key_type, typename Value_type, typename Key_compare>
+struct pair_search_key<
+  std::pair<Key_type, Value_type>, Key_compare,
+  std::enable_if_t<is_vector_key<Key_type>::value
+                   && (std::is_same<Key_compare, std::less<Key_type>>::value
+                       || std::is_same<Key_compare, std::less<>>::value)>> {
+  using search_key_type = Key_type;
+
+  static Key_type search_key(const std::pair<Key_type, Value_type> &item) {
+    return item.first;
+  }
+};
 
 template <typename Key_type, typename Value_type,
-          typename Key_compare=std::less<Key_type> // default argument
+          typename Key_compare=std::less<Key_type>, // default argument
+          typename Storage=TreeStorage
          >
 class Map {
 
@@ -30,15 +73,35 @@ private:
   // See http://www.cplusplus.com/reference/utility/pair/
   using Pair_type = std::pair<Key_type, Value_type>;
 
-  // A custom comparator
-  class PairComp {
+  // A custom comparator. It is transparent: besides two pairs, it can
+  // compare a pair with a bare key (in either order), so lookups do not
+  // have to build a dummy pair. Keys of types other than Key_type are only
+  // passed in when Key_compare is itself transparent.
+  class PairComp : public pair_search_key<Pair_type, Key_compare> {
     public:
+      using is_transparent = void;
+
       bool operator()(const Pair_type &lhs, const Pair_type &rhs) const {
-        Key_compare compare;
         return compare(lhs.first, rhs.first);
       }
+
+      template <typename K>
+      bool operator()(const Pair_type &lhs, const K &rhs) const {
+        return compare(lhs.first, rhs);
+      }
+
+      template <typename K>
+      bool operator()(const K &lhs, const Pair_type &rhs) const {
+        return compare(lhs, rhs.first);
+      }
+
+    private:
+      Key_compare compare;
   };
 
+  // The container that holds the elements, as chosen by Storage
+  using Entries = typename Storage::template container<Pair_type, PairComp>;
+
 public:
 
   // OVERVIEW: Maps are associative containers that store elements
@@ -54,9 +117,13 @@ public:
   //       both the key and the value stored in first/second of the pair.
 
   // Type alias for iterator type. It is sufficient to use the Iterator
-  // from BinarySearchTree<Pair_type> since it will yield elements of Pair_type
+  // of the underlying container since it will yield elements of Pair_type
   // in the appropriate order for the Map.
-  using Iterator = typename BinarySearchTree<Pair_type, PairComp>::Iterator;
+  using Iterator = typename Entries::Iterator;
+
+  // Type alias for an iterator through which pairs may only be read, as
+  // cfind, cbegin and cend return.
+  using Const_iterator = typename Entries::Const_iterator;
 
   // You should add in a default constructor, destructor, copy
   // constructor, and overloaded assignment operator, if appropriate.
@@ -64,6 +131,29 @@ public:
   // you should omit them. A user of the class must be able to create,
   // copy, assign, and destroy Maps.
 
+  // EFFECTS : Creates an empty Map.
+  Map() = default;
+
+  // EFFECTS : Creates a Map holding the key-value pairs in [first, last).
+  //           If a key appears more than once, its first pair is kept. A
+  //           range sorted by strictly increasing key is loaded in linear
+  //           time, as by assign_sorted.
+  template <typename Iter,
+            typename = typename std::iterator_traits<Iter>::iterator_category>
+  Map(Iter first, Iter last)
+    : entries(first, last) { }
+
+  // REQUIRES: Iterators and references into this Map obtained before the
+  //           call, and Iterators from find, begin and end of a const Map,
+  //           are not used to change values.
+  // EFFECTS : Returns a copy of this Map in constant time. The copy
+  //           shares the pairs of this Map until either Map changes (see
+  //           BinarySearchTree::share).
+  // NOTE :    Only available with TreeStorage
+  Map share() const{
+    return Map(entries.share());
+  }
+
   // EFFECTS : Returns whether this Map is empty.
   bool empty() const{
     return entries.empty();
@@ -79,13 +169,130 @@ public:
   //           to k and returns an Iterator to the associated value if found,
   //           otherwise returns an end Iterator.
   //
-  // HINT: Since Map is implemented using a BinarySearchTree that stores
-  //       (key, value) pairs, you'll need to construct a dummy value
-  //       using "Value_type()".
+  // NOTE: PairComp compares the stored pairs directly against k, so no
+  //       dummy pair (and no Value_type) is constructed.
   Iterator find(const Key_type& k) const{
-    Pair_type dummy(k, Value_type());
-    Iterator it = entries.find(dummy);
-    return it;
+    return entries.find(k);
+  }
+
+  // NOTE : On a non-const Map, find, nth_element and begin first make sure
+  //        the Map is not sharing its elements with another tree (see
+  //        BinarySearchTree::share), since the returned Iterator may be
+  //        used to change a value. cfind, cbegin and cend return a
+  //        Const_iterator and never copy the elements.
+  Iterator find(const Key_type& k){
+    return entries.find(k);
+  }
+
+  // EFFECTS : Same as find(const Key_type&), but accepts any key type K
+  //           that Key_compare can compare with Key_type, such as a
+  //           std::string_view against std::string keys.
+  // NOTE :    Only available when Key_compare defines is_transparent
+  //           (for example std::less<>).
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K& k) const{
+    return entries.find(k);
+  }
+
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K& k){
+    return entries.find(k);
+  }
+
+  // EFFECTS : Same as find, but returns a Const_iterator.
+  Const_iterator cfind(const Key_type& k) const{
+    return find(k);
+  }
+
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Const_iterator cfind(const K& k) const{
+    return find(k);
+  }
+
+  // EFFECTS : Returns an Iterator to the element whose key has exactly k
+  //           smaller keys in this Map (k = 0 is the smallest key), or an
+  //           end Iterator if k >= size(). Runs in O(log n) when the
+  //           underlying tree is balanced.
+  Const_iterator nth_element(size_t k) const{
+    return entries.nth_element(k);
+  }
+
+  Iterator nth_element(size_t k){
+    return entries.nth_element(k);
+  }
+
+  // EFFECTS : Returns the number of keys in this Map that are less than
+  //           k. If k is in the Map, this is its index in sorted order.
+  size_t rank(const Key_type& k) const{
+    return entries.rank(k);
+  }
+
+  // Type alias for a view of the pairs whose keys lie in an interval
+  using Range = Iterator_range<Iterator>;
+  using Const_range = Iterator_range<Const_iterator>;
+
+  // EFFECTS : Returns an Iterator to the pair with the smallest key not
+  //           less than k, or an end Iterator if there is none.
+  Const_iterator lower_bound(const Key_type& k) const{
+    return entries.lower_bound(k);
+  }
+
+  Iterator lower_bound(const Key_type& k){
+    return entries.lower_bound(k);
+  }
+
+  // EFFECTS : Returns an Iterator to the pair with the smallest key
+  //           greater than k, or an end Iterator if there is none.
+  Const_iterator upper_bound(const Key_type& k) const{
+    return entries.upper_bound(k);
+  }
+
+  Iterator upper_bound(const Key_type& k){
+    return entries.upper_bound(k);
+  }
+
+  // EFFECTS : Returns the pair of lower_bound(k) and upper_bound(k), which
+  //           bound the pair with key k if there is one.
+  std::pair<Const_iterator, Const_iterator>
+  equal_range(const Key_type& k) const{
+    return entries.equal_range(k);
+  }
+
+  std::pair<Iterator, Iterator> equal_range(const Key_type& k){
+    return entries.equal_range(k);
+  }
+
+  // EFFECTS : Returns a view of the pairs whose keys are not less than lo
+  //           and are less than hi, in ascending key order. The view is
+  //           empty if hi is not greater than lo. Takes O(log n) to find
+  //           its ends and O(1) amortized per pair visited.
+  Const_range range(const Key_type& lo, const Key_type& hi) const{
+    return entries.range(lo, hi);
+  }
+
+  Range range(const Key_type& lo, const Key_type& hi){
+    return entries.range(lo, hi);
+  }
+
+  // EFFECTS : Returns the number of keys not less than lo and less than
+  //           hi, in O(log n) without visiting the pairs.
+  size_t count_range(const Key_type& lo, const Key_type& hi) const{
+    return entries.count_range(lo, hi);
+  }
+
+  // Type alias for a read-only snapshot of a Map. Its find and
+  // min_greater_than accept a Key_type as well as a Pair_type.
+  using Frozen = FrozenTree<Pair_type, PairComp>;
+
+  // EFFECTS : Returns an immutable snapshot of the key-value pairs in this
+  //           Map, laid out for fast read-only lookup (see FrozenTree.hpp).
+  //           Runs in linear time. Later changes to this Map do not affect
+  //           the snapshot.
+  Frozen freeze() const{
+    return entries.freeze();
   }
 
   // MODIFIES: this
@@ -105,17 +312,15 @@ public:
   //
   // HINT: http://www.cplusplus.com/reference/map/map/operator[]/
   Value_type& operator[](const Key_type& k){
-    auto it = find(k);
-    if(it!=end()){
-      return it->second;
-    }else{
-      Pair_type toPut(k, Value_type());
-      auto answer = insert(toPut);
-      return answer.first->second;
-    }
+    return try_emplace(k).first->second;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Same as operator[](const Key_type&), but if a new element is
+  //           inserted, k is moved into it.
+  Value_type& operator[](Key_type&& k){
+    return try_emplace(std::move(k)).first->second;
   }
-  
-  
 
   // MODIFIES: this
   // EFFECTS : Inserts the given element into this Map if the given key
@@ -125,14 +330,215 @@ public:
   //           false. Otherwise, inserts the given element and returns
   //           an iterator to the newly inserted element, along with
   //           the value true.
+  //
+  // NOTE:     The lookup and the insertion share a single descent of the
+  //           underlying tree.
   std::pair<Iterator, bool> insert(const Pair_type &val){
-    auto it = find(val.first);
-    if(it!=end()){//already in
-      return std::pair(find(val.first), false);
-    }else{
-      entries.insert(val);
-      return std::pair(find(val.first), true);
-    }
+    return entries.try_insert(val);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Same as insert(const Pair_type &), but moves val into the
+  //           new element. If the key is already present, val is not moved.
+  std::pair<Iterator, bool> insert(Pair_type &&val){
+    return entries.try_insert(std::move(val));
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Constructs a Pair_type in place from args and inserts it if
+  //           its key is not already in the Map. Returns the same as
+  //           insert(). If the key is present, the constructed pair is
+  //           discarded.
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args&&... args){
+    return entries.emplace(std::forward<Args>(args)...);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : If k is already in the Map, returns an iterator to its
+  //           element along with the value false, and args are left
+  //           untouched. Otherwise, inserts an element whose key is a copy
+  //           of k and whose mapped value is constructed in place from
+  //           args, and returns an iterator to it along with the value true.
+  template <typename... Args>
+  std::pair<Iterator, bool> try_emplace(const Key_type& k, Args&&... args){
+    return entries.try_emplace(k, std::piecewise_construct,
+                               std::forward_as_tuple(k),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Same as try_emplace(const Key_type&, ...), but if a new
+  //           element is inserted, k is moved into it.
+  template <typename... Args>
+  std::pair<Iterator, bool> try_emplace(Key_type&& k, Args&&... args){
+    // k is only moved from after the descent is done comparing it
+    return entries.try_emplace(k, std::piecewise_construct,
+                               std::forward_as_tuple(std::move(k)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  // REQUIRES: [first, last) is sorted by strictly increasing key
+  // MODIFIES: this
+  // EFFECTS : Replaces the contents of this Map with the key-value pairs in
+  //           [first, last), arranged as a perfectly balanced tree in
+  //           linear time.
+  template <typename Forward_iterator>
+  void assign_sorted(Forward_iterator first, Forward_iterator last){
+    entries.assign_sorted(first, last);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Replaces the contents of this Map with the key-value pairs in
+  //           [first, last), which may be in any order. Of pairs with
+  //           equivalent keys, only the earliest is kept. Sorts and builds
+  //           on the threads allowed by set_parallelism, in O(n log n) time.
+  // NOTE :    Only available with TreeStorage
+  template <typename Forward_iterator>
+  void assign_unsorted(Forward_iterator first, Forward_iterator last){
+    entries.assign_unsorted(first, last);
+  }
+
+  // REQUIRES: Different keys and values may be copied, destroyed and
+  //           compared on different threads at the same time.
+  // MODIFIES: this
+  // EFFECTS : Lets this Map use up to 'threads' threads (0 meaning one per
+  //           hardware thread) to copy, free and build large trees (see
+  //           BinarySearchTree::set_parallelism).
+  // NOTE :    Only available with TreeStorage
+  void set_parallelism(size_t threads){
+    entries.set_parallelism(threads);
+  }
+
+  // EFFECTS : Returns the number of threads this Map may use.
+  // NOTE :    Only available with TreeStorage
+  size_t parallelism() const{
+    return entries.parallelism();
+  }
+
+  // MODIFIES: os
+  // EFFECTS : Writes this Map's pairs to os as a binary snapshot, in
+  //           sorted order (see BinarySearchTree::save). Key_type and
+  //           Value_type each need a Binary_codec (see TreeSerialize.hpp).
+  // NOTE :    Only available with TreeStorage
+  void save(std::ostream &os) const{
+    entries.save(os);
+  }
+
+  // MODIFIES: this, is
+  // EFFECTS : Replaces the contents of this Map with the pairs of the
+  //           snapshot that save wrote to is, in linear time. Returns
+  //           false, leaving this Map unchanged, if is does not hold an
+  //           intact snapshot of this Map's pair type.
+  // NOTE :    Only available with TreeStorage
+  bool load(std::istream &is){
+    return entries.load(is);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Rearranges the tree holding this Map's pairs into a perfectly
+  //           balanced shape in O(n) time, without allocating or moving any
+  //           pair (see BinarySearchTree::rebalance).
+  // NOTE :    Only available with TreeStorage
+  void rebalance(){
+    entries.rebalance();
+  }
+
+  // REQUIRES: factor == 0 or factor > 1
+  // MODIFIES: this
+  // EFFECTS : Makes insertions keep the height of the tree within 'factor'
+  //           times the optimum, by rebalancing the smallest subtree that
+  //           grew too tall, or stops doing so if factor is 0 (see
+  //           BinarySearchTree::set_rebalance_factor).
+  // NOTE :    Only available with TreeStorage
+  void set_rebalance_factor(double factor){
+    entries.set_rebalance_factor(factor);
+  }
+
+  // EFFECTS : Returns the height limit that insertions keep, or 0 if none.
+  // NOTE :    Only available with TreeStorage
+  double rebalance_factor() const{
+    return entries.rebalance_factor();
+  }
+
+  // EFFECTS : Returns the height, mean element depth and number of
+  //           degenerate chains of the tree holding this Map's pairs, in
+  //           constant time (see Tree_shape).
+  // NOTE :    Only available with TreeStorage
+  Tree_shape shape() const{
+    return entries.shape();
+  }
+
+  // EFFECTS : Returns the searches this Map has made, with their
+  //           comparisons, nodes visited and depths. All zero unless
+  //           compiled with TREE_STATS=1 (see TreeStats.hpp).
+  // NOTE :    Only available with TreeStorage
+  Search_stats stats() const{
+    return entries.stats();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Sets the counts that stats reports back to zero.
+  // NOTE :    Only available with TreeStorage
+  void reset_stats(){
+    entries.reset_stats();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the element with key k, if there is one. Returns the
+  //           number of elements removed (0 or 1).
+  size_t erase(const Key_type& k){
+    return entries.erase(k);
+  }
+
+  // REQUIRES: pos refers to an element of this Map
+  // MODIFIES: this
+  // EFFECTS : Removes the element at pos and returns an iterator to the
+  //           element that followed it. With TreeStorage, iterators to
+  //           other elements remain valid.
+  Iterator erase(Const_iterator pos){
+    return entries.erase(pos);
+  }
+
+  // REQUIRES: [first, last) is a range of elements of this Map
+  // MODIFIES: this
+  // EFFECTS : Removes the elements in [first, last) and returns an
+  //           iterator to the element that followed them.
+  Iterator erase(Const_iterator first, Const_iterator last){
+    return entries.erase(first, last);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Adds copies of the pairs of other whose keys are not in this
+  //           Map. Where both have a key, this Map's value is kept; to let
+  //           other's values win, merge this Map into other instead. Takes
+  //           O(m log n) time for a small other and O(n + m) otherwise.
+  // NOTE :    Only available with TreeStorage
+  void union_with(const Map &other){
+    entries.union_with(other.entries);
+  }
+
+  // MODIFIES: this, other
+  // EFFECTS : Moves the pairs of other whose keys are not in this Map into
+  //           it without copying them, and leaves other empty. Where both
+  //           have a key, this Map's value is kept.
+  // NOTE :    Only available with TreeStorage
+  void merge(Map &&other){
+    entries.merge(std::move(other.entries));
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the pairs whose keys are not in other.
+  // NOTE :    Only available with TreeStorage
+  void intersect_with(const Map &other){
+    entries.intersect_with(other.entries);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the pairs whose keys are in other.
+  // NOTE :    Only available with TreeStorage
+  void difference_with(const Map &other){
+    entries.difference_with(other.entries);
   }
 
   // EFFECTS : Returns an iterator to the first key-value pair in this Map.
@@ -140,14 +546,31 @@ public:
     return entries.begin();
   }
 
+  Iterator begin(){
+    return entries.begin();
+  }
+
   // EFFECTS : Returns an iterator to "past-the-end".
   Iterator end() const{
     return entries.end();
   }
 
+  // EFFECTS : Same as begin() and end(), but return a Const_iterator.
+  Const_iterator cbegin() const{
+    return begin();
+  }
+
+  Const_iterator cend() const{
+    return end();
+  }
+
 private:
   // Add a BinarySearchTree private member HERE.
-  BinarySearchTree<Pair_type,PairComp> entries;
+  Entries entries;
+
+  // Creates a Map holding the pairs of entries_in
+  explicit Map(Entries &&entries_in)
+    : entries(std::move(entries_in)) { }
   
 
 };
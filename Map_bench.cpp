@@ -0,0 +1,320 @@
+#include "Map.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+// make bench
+// ./Map_bench.exe [max keys]
+//
+// Times insert, find, iterate, copy and destroy on Map and on the standard
+// containers, for random, sorted, reverse-sorted and Zipfian key streams,
+// and reports the bytes each container allocates per entry.
+
+// Bytes currently allocated through Counting_allocator.
+static size_t live_bytes = 0;
+
+// An allocator that keeps live_bytes up to date, so that every container
+// is charged for exactly what it allocates, buckets and headers included.
+template <typename T>
+struct Counting_allocator {
+  using value_type = T;
+
+  Counting_allocator() = default;
+
+  template <typename U>
+  Counting_allocator(const Counting_allocator<U> &) { }
+
+  T *allocate(size_t n) {
+    live_bytes += n * sizeof(T);
+    return allocator<T>().allocate(n);
+  }
+
+  void deallocate(T *p, size_t n) {
+    live_bytes -= n * sizeof(T);
+    allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(const Counting_allocator<U> &) const {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const Counting_allocator<U> &) const {
+    return false;
+  }
+};
+
+// Map storage policies that count their allocations. Avl_tree_storage
+// differs from TreeStorage in balancing its tree, so that sorted streams
+// do not make it quadratic.
+struct Counted_tree_storage {
+  template <typename T, typename Compare>
+  using container = BinarySearchTree<T, Compare, Unbalanced,
+                                     Counting_allocator<T>>;
+};
+
+struct Avl_tree_storage {
+  template <typename T, typename Compare>
+  using container = BinarySearchTree<T, Compare, AvlBalanced,
+                                     Counting_allocator<T>>;
+};
+
+struct Counted_btree_storage {
+  template <typename T, typename Compare>
+  using container = BTree<T, Compare, Counting_allocator<T>>;
+};
+
+using Std_map = map<int, int, less<int>, Counting_allocator<pair<const int, int>>>;
+using Std_unordered_map = unordered_map<int, int, hash<int>, equal_to<int>,
+                                        Counting_allocator<pair<const int, int>>>;
+
+// EFFECTS: Returns the nanoseconds elapsed since 'start'.
+static double elapsed_ns(chrono::steady_clock::time_point start) {
+  chrono::duration<double, nano> d = chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+// EFFECTS: Prints one result line: name, number of keys, ns/op.
+static void report(const string &name, size_t n, double ns_per_op) {
+  cout << name << " n=" << n << " " << ns_per_op << " ns/op" << endl;
+}
+
+// EFFECTS: Returns a distinct, scattered key for each rank, so that keys
+//          that are close in rank are not close in order.
+static int scatter(size_t rank) {
+  return static_cast<int>((rank * 2654435761u) & 0x7fffffff);
+}
+
+// EFFECTS: Returns n keys drawn from a Zipf distribution with exponent
+//          0.99 over n distinct keys, so a few keys repeat very often.
+static vector<int> zipf_stream(size_t n) {
+  vector<double> cdf(n);
+  double total = 0;
+  for (size_t rank = 0; rank < n; ++rank) {
+    total += 1 / pow(rank + 1.0, 0.99);
+    cdf[rank] = total;
+  }
+  mt19937_64 pick(42);
+  uniform_real_distribution<double> draw(0, total);
+  vector<int> keys(n);
+  for (int &key : keys) {
+    size_t rank = lower_bound(cdf.begin(), cdf.end(), draw(pick)) - cdf.begin();
+    key = scatter(min(rank, n - 1));
+  }
+  return keys;
+}
+
+// EFFECTS: Returns n keys in the named order: "random" (distinct, in random
+//          order), "sorted", "reverse" or "zipf".
+static vector<int> key_stream(const string &order, size_t n) {
+  if (order == "zipf") {
+    return zipf_stream(n);
+  }
+  vector<int> keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = static_cast<int>(i);
+  }
+  if (order == "random") {
+    shuffle(keys.begin(), keys.end(), mt19937_64(7));
+  }
+  else if (order == "reverse") {
+    reverse(keys.begin(), keys.end());
+  }
+  return keys;
+}
+
+// Totals for one container over one or more repetitions.
+struct Timings {
+  double insert = 0;
+  double find = 0;
+  double iterate = 0;
+  double copy = 0;
+  double copy_write = 0;
+  double destroy = 0;
+  size_t bytes = 0;
+  size_t entries = 0;
+  long long check = 0;
+};
+
+// MODIFIES: t
+// EFFECTS : Inserts the keys of 'stream' into a new Container, looks each
+//           one up, walks the container, copies it (and, separately,
+//           copies it and then changes the copy, which is what a copy
+//           costs for containers that share nodes until written), and
+//           destroys it, adding each time to t.
+template <typename Container>
+static void measure(const vector<int> &stream, Timings &t) {
+  size_t before = live_bytes;
+  auto start = chrono::steady_clock::now();
+  auto original = make_unique<Container>();
+  Container &c = *original;
+  for (size_t i = 0; i < stream.size(); ++i) {
+    c.insert({ stream[i], static_cast<int>(i) });
+  }
+  t.insert += elapsed_ns(start);
+  t.bytes += live_bytes - before;
+  t.entries += c.size();
+
+  const Container &reader = c;
+  start = chrono::steady_clock::now();
+  for (int key : stream) {
+    t.check += reader.find(key)->second;
+  }
+  t.find += elapsed_ns(start);
+
+  start = chrono::steady_clock::now();
+  for (const auto &entry : reader) {
+    t.check += entry.first;
+  }
+  t.iterate += elapsed_ns(start);
+
+  start = chrono::steady_clock::now();
+  {
+    Container copy(reader);
+    t.copy += elapsed_ns(start);
+    t.check += copy.size();
+  }
+  start = chrono::steady_clock::now();
+  {
+    Container copy(reader);
+    copy.insert({ -1, 0 });
+    t.copy_write += elapsed_ns(start);
+    t.check += copy.size();
+  }
+
+  start = chrono::steady_clock::now();
+  original.reset();
+  t.destroy += elapsed_ns(start);
+}
+
+// EFFECTS: Measures Container on 'stream', repeating small sizes so that
+//          each figure covers at least a million operations, and prints
+//          ns per stream key (per entry for iterate, copy and destroy)
+//          and bytes allocated per entry.
+template <typename Container>
+static void bench_container(const string &name, const vector<int> &stream) {
+  size_t n = stream.size();
+  size_t reps = max<size_t>(1, 1000000 / n);
+  Timings t;
+  for (size_t rep = 0; rep < reps; ++rep) {
+    measure<Container>(stream, t);
+  }
+  size_t ops = n * reps;
+  size_t entries = t.entries;
+  report(name + " insert", n, t.insert / ops);
+  report(name + " find", n, t.find / ops);
+  report(name + " iterate", n, t.iterate / entries);
+  report(name + " copy", n, t.copy / entries);
+  report(name + " copy+write", n, t.copy_write / entries);
+  report(name + " destroy", n, t.destroy / entries);
+  cout << "  entries=" << entries / reps << " bytes/entry="
+       << static_cast<double>(t.bytes) / entries << " check=" << t.check
+       << endl;
+}
+
+// EFFECTS: Prints one throughput line: name, number of keys, MB/s.
+static void report_rate(const string &name, size_t n, double bytes, double ns) {
+  cout << name << " n=" << n << " " << bytes / ns * 1000 << " MB/s" << endl;
+}
+
+// EFFECTS: Saves a Map of n random int keys to a file and loads it back,
+//          and does the same as text, one "key value " pair at a time as
+//          traverse_inorder prints, reporting the snapshot's throughput
+//          and the ns per entry of both.
+static void bench_snapshot(size_t n) {
+  const char *path = "Map_bench.snapshot";
+  vector<int> keys = key_stream("random", n);
+  Map<int, int> map;
+  for (size_t i = 0; i < n; ++i) {
+    map[keys[i]] = static_cast<int>(i);
+  }
+
+  auto start = chrono::steady_clock::now();
+  {
+    ofstream out(path, ios::binary);
+    map.save(out);
+  }
+  double save_ns = elapsed_ns(start);
+
+  Map<int, int> loaded;
+  start = chrono::steady_clock::now();
+  {
+    ifstream in(path, ios::binary);
+    if (!loaded.load(in)) {
+      cout << "snapshot load failed" << endl;
+    }
+  }
+  double load_ns = elapsed_ns(start);
+
+  start = chrono::steady_clock::now();
+  {
+    ofstream out(path);
+    for (const auto &entry : map) {
+      out << entry.first << " " << entry.second << " ";
+    }
+  }
+  double text_save_ns = elapsed_ns(start);
+  // The text is in sorted order, which an Unbalanced Map would take
+  // quadratic time to insert
+  Map<int, int> parsed;
+  parsed.set_rebalance_factor(2);
+  start = chrono::steady_clock::now();
+  {
+    ifstream in(path);
+    int key, value;
+    while (in >> key >> value) {
+      parsed[key] = value;
+    }
+  }
+  double text_load_ns = elapsed_ns(start);
+  double bytes = sizeof(Snapshot_header) + n * 2 * sizeof(int);
+  report_rate("snapshot save", n, bytes, save_ns);
+  report_rate("snapshot load", n, bytes, load_ns);
+  report("snapshot save", n, save_ns / n);
+  report("snapshot load", n, load_ns / n);
+  report("text save", n, text_save_ns / n);
+  report("text load", n, text_load_ns / n);
+  cout << "  loaded=" << loaded.size() << " parsed=" << parsed.size()
+       << " height=" << loaded.shape().height << endl;
+  remove(path);
+}
+
+int main(int argc, char *argv[]) {
+  size_t max_keys = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+
+  for (const string order : { "random", "sorted", "reverse", "zipf" }) {
+    for (size_t n = 1000; n <= max_keys; n *= 10) {
+      vector<int> stream = key_stream(order, n);
+      string prefix = order + " ";
+      bench_container<Std_map>(prefix + "std::map", stream);
+      bench_container<Std_unordered_map>(prefix + "std::unordered_map", stream);
+      bench_container<Map<int, int, less<int>, Avl_tree_storage>>(
+          prefix + "map avl tree", stream);
+      bench_container<Map<int, int, less<int>, Counted_btree_storage>>(
+          prefix + "map btree", stream);
+      // The default TreeStorage does not balance, so sorted streams would
+      // take quadratic time; it is only measured on unordered ones.
+      if (order == "random" || order == "zipf") {
+        bench_container<Map<int, int, less<int>, Counted_tree_storage>>(
+            prefix + "map tree", stream);
+      }
+    }
+  }
+  for (size_t n = 1000000; n <= max_keys; n *= 10) {
+    bench_snapshot(n);
+  }
+}
@@ -1,5 +1,12 @@
 #include "Map.hpp"
 #include "unit_test_framework.hpp"
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 
 TEST(test_stuff) {
@@ -7,4 +14,483 @@ TEST(test_stuff) {
     
 }
 
+TEST(test_size) {
+    Map<int, double> nums;
+    ASSERT_EQUAL(nums.size(), 0);
+    nums[3] = 1.5;
+    nums[1] = 2.5;
+    nums.insert({ 3, 9.0 });
+    ASSERT_EQUAL(nums.size(), 2);
+}
+
+TEST(test_nth_element_and_rank) {
+    Map<std::string, int> words;
+    words["kiwi"] = 3;
+    words["apple"] = 1;
+    words["fig"] = 2;
+    ASSERT_EQUAL(words.nth_element(0)->first, "apple");
+    ASSERT_EQUAL(words.nth_element(2)->second, 3);
+    ASSERT_EQUAL(words.nth_element(3), words.end());
+    ASSERT_EQUAL(words.rank("fig"), 1);
+    ASSERT_EQUAL(words.rank("banana"), 1);
+    ASSERT_EQUAL(words.rank("zebra"), 3);
+}
+
+static int compare_calls = 0;
+struct CountingLess {
+    bool operator()(int a, int b) const {
+        ++compare_calls;
+        return a < b;
+    }
+};
+
+TEST(test_insert_and_subscript) {
+    Map<int, double> nums;
+    auto first = nums.insert({ 4, 1.5 });
+    ASSERT_TRUE(first.second);
+    ASSERT_EQUAL(first.first->second, 1.5);
+    auto again = nums.insert({ 4, 9.0 });
+    ASSERT_FALSE(again.second);
+    ASSERT_EQUAL(again.first, first.first);
+    ASSERT_EQUAL(again.first->second, 1.5);
+    nums[4] += 1;
+    ASSERT_EQUAL(nums[4], 2.5);
+    ASSERT_EQUAL(nums[7], 0.0);
+    ASSERT_EQUAL(nums.size(), 2);
+}
+
+TEST(test_insert_descends_once) {
+    Map<int, int, CountingLess> nums;
+    nums.insert({ 2, 0 });
+    nums.insert({ 1, 0 });
+    compare_calls = 0;
+    nums.insert({ 3, 0 });
+    // two comparisons to pass the root, then the new leaf is linked in
+    ASSERT_EQUAL(compare_calls, 2);
+    compare_calls = 0;
+    nums[1] = 5;
+    ASSERT_EQUAL(compare_calls, 3);
+}
+
+TEST(test_transparent_find) {
+    Map<std::string, int, std::less<>> words;
+    words["apple"] = 1;
+    words["kiwi"] = 2;
+    std::string_view key = "kiwi";
+    ASSERT_EQUAL(words.find(key)->second, 2);
+    ASSERT_EQUAL(words.find("apple")->second, 1);
+    ASSERT_EQUAL(words.find(std::string_view("fig")), words.end());
+    ASSERT_EQUAL(words.rank(std::string("kiwi")), 1);
+}
+
+// A mapped type that cannot be default constructed
+class Record {
+public:
+    explicit Record(int id_in) : id(id_in) {}
+    int get_id() const { return id; }
+private:
+    int id;
+};
+
+TEST(test_value_without_default_constructor) {
+    Map<int, Record> records;
+    records.insert({ 2, Record(20) });
+    records.insert({ 1, Record(10) });
+    ASSERT_EQUAL(records.find(2)->second.get_id(), 20);
+    ASSERT_EQUAL(records.find(3), records.end());
+    ASSERT_EQUAL(records.rank(2), 1);
+    Map<int, Record> copy(records);
+    ASSERT_EQUAL(copy.begin()->second.get_id(), 10);
+}
+
+// Counts constructions, copies and moves of mapped values
+struct Heavy {
+    static int constructions;
+    static int copies;
+    static int moves;
+    std::string payload;
+    Heavy() { ++constructions; }
+    explicit Heavy(const std::string &payload_in)
+        : payload(payload_in) { ++constructions; }
+    Heavy(const Heavy &other) : payload(other.payload) { ++copies; }
+    Heavy(Heavy &&other) : payload(std::move(other.payload)) { ++moves; }
+    static void reset() { constructions = copies = moves = 0; }
+};
+int Heavy::constructions = 0;
+int Heavy::copies = 0;
+int Heavy::moves = 0;
+
+TEST(test_try_emplace_and_emplace) {
+    Map<int, Heavy> heavy;
+    Heavy::reset();
+    ASSERT_TRUE(heavy.try_emplace(1, "one").second);
+    ASSERT_FALSE(heavy.try_emplace(1, "uno").second);
+    ASSERT_EQUAL(heavy.find(1)->second.payload, "one");
+    ASSERT_EQUAL(Heavy::constructions, 1);
+    ASSERT_TRUE(heavy.emplace(std::piecewise_construct, std::forward_as_tuple(2),
+                              std::forward_as_tuple("two")).second);
+    ASSERT_EQUAL(Heavy::constructions, 2);
+    ASSERT_EQUAL(Heavy::copies, 0);
+    ASSERT_EQUAL(Heavy::moves, 0);
+}
+
+TEST(test_subscript_no_extra_values) {
+    Map<std::string, Heavy> heavy;
+    Heavy::reset();
+    heavy["a"].payload = "x";
+    ASSERT_EQUAL(Heavy::constructions, 1);
+    ASSERT_EQUAL(heavy["a"].payload, "x");
+    ASSERT_EQUAL(Heavy::constructions, 1);
+    ASSERT_EQUAL(Heavy::copies, 0);
+    ASSERT_EQUAL(Heavy::moves, 0);
+}
+
+TEST(test_insert_rvalue_and_move_map) {
+    Map<std::string, Heavy> heavy;
+    heavy.insert({ "k", Heavy("v") });
+    Heavy::reset();
+    Map<std::string, Heavy> moved(std::move(heavy));
+    ASSERT_TRUE(heavy.empty());
+    ASSERT_EQUAL(moved["k"].payload, "v");
+    Map<std::string, Heavy> assigned;
+    assigned = std::move(moved);
+    ASSERT_EQUAL(assigned.size(), 1);
+    ASSERT_EQUAL(Heavy::copies, 0);
+    ASSERT_EQUAL(Heavy::moves, 0);
+}
+
+TEST(test_erase) {
+    Map<std::string, int> m;
+    m["a"] = 1;
+    m["b"] = 2;
+    m["c"] = 3;
+    m["d"] = 4;
+    ASSERT_EQUAL(m.erase("b"), 1);
+    ASSERT_EQUAL(m.erase("z"), 0);
+    auto it = m.erase(m.find("a"));
+    ASSERT_EQUAL(it->first, "c");
+    ASSERT_EQUAL(m.erase(it, m.end()), m.end());
+    ASSERT_TRUE(m.empty());
+    m["e"] = 5;
+    ASSERT_EQUAL(m.size(), 1);
+}
+
+TEST(test_range_constructor_and_assign_sorted) {
+    std::pair<int, std::string> sorted[] = { {1, "a"}, {2, "b"}, {3, "c"} };
+    Map<int, std::string> m(sorted, sorted + 3);
+    ASSERT_EQUAL(m.size(), 3);
+    ASSERT_EQUAL(m[2], "b");
+    std::pair<int, std::string> unsorted[] = { {5, "x"}, {4, "y"}, {5, "z"} };
+    Map<int, std::string> n(unsorted, unsorted + 3);
+    ASSERT_EQUAL(n.size(), 2);
+    ASSERT_EQUAL(n[5], "x");
+    n.assign_sorted(sorted, sorted + 2);
+    ASSERT_EQUAL(n.size(), 2);
+    ASSERT_EQUAL(n.begin()->second, "a");
+    ASSERT_TRUE(n.find(5) == n.end());
+}
+
+TEST(test_btree_storage) {
+    Map<std::string, int, std::less<std::string>, BTreeStorage> m;
+    for (int i = 0; i < 1000; ++i) {
+        m[std::to_string(i)] = i;
+    }
+    ASSERT_EQUAL(m.size(), 1000);
+    ASSERT_EQUAL(m["517"], 517);
+    ASSERT_FALSE(m.insert({ "517", 0 }).second);
+    ASSERT_TRUE(m.try_emplace("1000", 1000).second);
+    ASSERT_EQUAL(m.erase("0"), 1);
+    ASSERT_EQUAL(m.begin()->first, "1");
+    ASSERT_EQUAL(m.nth_element(m.rank("517"))->second, 517);
+    static_assert(std::is_same<decltype((m.cfind("517")->second)),
+                               const int &>::value,
+                  "cfind must hand out read-only pairs with BTreeStorage");
+    ASSERT_EQUAL(m.erase(m.cfind("517"))->first, "518");
+    m["517"] = 517;
+    std::string prev;
+    for (auto &entry : m) {
+        ASSERT_TRUE(prev < entry.first);
+        prev = entry.first;
+    }
+    Map<std::string, int, std::less<std::string>, BTreeStorage> copy(m);
+    ASSERT_EQUAL(copy.erase(copy.begin(), copy.end()), copy.end());
+    ASSERT_TRUE(copy.empty());
+    ASSERT_EQUAL(m.size(), 1000);
+}
+
+TEST(test_btree_storage_vector_keys) {
+    Map<int64_t, std::string, std::less<int64_t>, BTreeStorage> by_id;
+    Map<double, int, std::less<>, BTreeStorage> by_score;
+    for (int i = 0; i < 1000; ++i) {
+        by_id[(i * 7919) % 1000] = std::to_string(i);
+        by_score[i * 0.5] = i;
+    }
+    ASSERT_EQUAL(by_id.size(), 1000);
+    ASSERT_EQUAL(by_id.begin()->first, 0);
+    ASSERT_EQUAL(by_id.rank(500), 500);
+    ASSERT_EQUAL(by_id.erase(500), 1);
+    ASSERT_TRUE(by_id.find(500) == by_id.end());
+    ASSERT_EQUAL(by_id.nth_element(500)->first, 501);
+    ASSERT_EQUAL(by_score.find(250.0)->second, 500);
+    ASSERT_TRUE(by_score.find(250.25) == by_score.end());
+}
+
+TEST(test_freeze) {
+    Map<int, std::string> tree_map;
+    Map<int, std::string, std::less<int>, BTreeStorage> btree_map;
+    for (int i = 0; i < 500; ++i) {
+        tree_map[i * 3] = std::to_string(i);
+        btree_map[i * 3] = std::to_string(i);
+    }
+    Map<int, std::string>::Frozen frozen = tree_map.freeze();
+    auto from_btree = btree_map.freeze();
+    tree_map.erase(30);
+    ASSERT_EQUAL(frozen.size(), 500);
+    ASSERT_EQUAL(frozen.find(30)->second, "10");
+    ASSERT_TRUE(frozen.find(31) == frozen.end());
+    ASSERT_EQUAL(frozen.min_greater_than(31)->first, 33);
+    ASSERT_EQUAL(from_btree.find(1497)->second, "499");
+    ASSERT_TRUE(from_btree.min_greater_than(1497) == from_btree.end());
+    int expected = 0;
+    for (auto &entry : from_btree) {
+        ASSERT_EQUAL(entry.first, expected);
+        expected += 3;
+    }
+}
+
+TEST(test_shared_copies_split_when_changed) {
+    Map<std::string, int> original;
+    for (int i = 0; i < 100; ++i) {
+        original[std::to_string(i)] = i;
+    }
+    Map<std::string, int> copy = original.share();
+    ASSERT_EQUAL(&copy.cfind("7")->second, &original.cfind("7")->second);
+    copy.find("7")->second = -7;
+    copy["8"] = -8;
+    for (auto &entry : copy) {
+        entry.second += 1000;
+    }
+    ASSERT_EQUAL(original.find("7")->second, 7);
+    ASSERT_EQUAL(original["8"], 8);
+    ASSERT_EQUAL(copy["7"], 993);
+    ASSERT_EQUAL(copy["8"], 992);
+}
+
+TEST(test_copies_ignore_writes_through_earlier_iterators) {
+    Map<int, int> a;
+    for (int i = 0; i < 10; ++i) {
+        a[i] = i;
+    }
+    auto it = a.find(1);
+    Map<int, int> b(a);
+    it->second = 42;
+    ASSERT_EQUAL(a.cfind(1)->second, 42);
+    ASSERT_EQUAL(b.cfind(1)->second, 1);
+
+    int &r = a[2];
+    Map<int, int> c(a);
+    r = 99;
+    ASSERT_EQUAL(a[2], 99);
+    ASSERT_EQUAL(c[2], 2);
+
+    Map<int, int> d(a);
+    auto p = d.find(5);
+    Map<int, int> e(d);
+    d[16] = 16;
+    p->second = 7;
+    ASSERT_EQUAL(d[5], 7);
+    ASSERT_EQUAL(e[5], 5);
+    ASSERT_TRUE(e.cfind(16) == e.cend());
+}
+
+// Threads take copies of one map and change them, so the count of trees
+// sharing its nodes changes from many threads at once.
+TEST(test_copies_shared_across_threads) {
+    Map<int, int> base;
+    for (int i = 0; i < 1000; ++i) {
+        base[i] = i;
+    }
+    std::vector<std::thread> workers;
+    std::vector<int> sums(4, 0);
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int round = 0; round < 20; ++round) {
+                Map<int, int> mine = base.share();
+                const Map<int, int> &view = base;
+                sums[t] += view.find(round)->second;
+                mine[round] = -1;
+                mine.erase(round + 1);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    for (int t = 0; t < 4; ++t) {
+        ASSERT_EQUAL(sums[t], 190);
+    }
+    ASSERT_EQUAL(base.size(), 1000);
+}
+
+TEST(test_parallel_build_copy_and_destroy) {
+    std::vector<std::pair<int, std::string>> input;
+    for (int i = 0; i < 60000; ++i) {
+        int k = (i * 7919) % 40000;
+        input.push_back({ k, std::to_string(i) });
+    }
+    Map<int, std::string> map;
+    map.set_parallelism(4);
+    map.assign_unsorted(input.begin(), input.end());
+    ASSERT_EQUAL(map.size(), 40000);
+    ASSERT_EQUAL(map.find(7919)->second, "1");
+    Map<int, std::string> copy = map;
+    copy[7919] = "changed";
+    map = Map<int, std::string>();
+    ASSERT_EQUAL(copy.size(), 40000);
+    ASSERT_EQUAL(copy.find(7919)->second, "changed");
+    ASSERT_EQUAL(copy.parallelism(), 4);
+}
+
+// EFFECTS: Fills a map with the keys 0, 10, ..., 990 and checks its range
+//          queries.
+template <typename Storage>
+static void check_map_ranges() {
+    Map<int, std::string, std::less<int>, Storage> map;
+    for (int k = 0; k < 1000; k += 10) {
+        map[k] = std::to_string(k);
+    }
+    ASSERT_EQUAL(map.lower_bound(35)->first, 40);
+    ASSERT_EQUAL(map.lower_bound(40)->first, 40);
+    ASSERT_EQUAL(map.upper_bound(40)->first, 50);
+    ASSERT_TRUE(map.upper_bound(990) == map.end());
+    auto found = map.equal_range(70);
+    ASSERT_EQUAL(found.first->second, "70");
+    ASSERT_EQUAL(found.second->first, 80);
+    auto missing = map.equal_range(75);
+    ASSERT_TRUE(missing.first == missing.second);
+    int visited = 0;
+    for (const auto &entry : map.range(95, 150)) {
+        ASSERT_EQUAL(entry.first, 100 + 10 * visited);
+        ++visited;
+    }
+    ASSERT_EQUAL(visited, 5);
+    ASSERT_EQUAL(map.count_range(95, 150), 5);
+    ASSERT_EQUAL(map.count_range(150, 95), 0);
+    ASSERT_TRUE(map.range(150, 95).empty());
+    ASSERT_EQUAL(map.count_range(-5, 5000), 100);
+}
+
+TEST(test_range_queries) {
+    check_map_ranges<TreeStorage>();
+    check_map_ranges<BTreeStorage>();
+}
+
+TEST(test_set_algebra) {
+    Map<int, std::string> base;
+    Map<int, std::string> delta;
+    for (int k = 0; k < 100; ++k) {
+        base[k] = "base";
+        delta[k + 50] = "delta";
+    }
+    Map<int, std::string> both = base;
+    both.union_with(delta);
+    ASSERT_EQUAL(both.size(), 150);
+    ASSERT_EQUAL(both[60], "base");
+    ASSERT_EQUAL(both[120], "delta");
+
+    Map<int, std::string> common = base;
+    common.intersect_with(delta);
+    ASSERT_EQUAL(common.size(), 50);
+    ASSERT_EQUAL(common.begin()->first, 50);
+
+    Map<int, std::string> only_base = base;
+    only_base.difference_with(delta);
+    ASSERT_EQUAL(only_base.size(), 50);
+    ASSERT_TRUE(only_base.find(50) == only_base.end());
+
+    // Merging base into delta lets base's values win over delta's
+    delta.merge(std::move(base));
+    ASSERT_TRUE(base.empty());
+    ASSERT_EQUAL(delta.size(), 150);
+    ASSERT_EQUAL(delta[60], "delta");
+    ASSERT_EQUAL(delta[10], "base");
+}
+
+TEST(test_rebalance) {
+    Map<int, int> map;
+    for (int k = 0; k < 200; ++k) {
+        map[k] = k;
+    }
+    const int *value = &map.find(150)->second;
+    ASSERT_EQUAL(map.shape().height, 200);
+    map.rebalance();
+    ASSERT_EQUAL(map.shape().height, 8);
+    ASSERT_EQUAL(&map.find(150)->second, value);
+    map.set_rebalance_factor(2);
+    for (int k = 200; k < 2000; ++k) {
+        map[k] = k;
+    }
+    ASSERT_TRUE(map.shape().height_ratio() <= 2);
+    ASSERT_EQUAL(map.rebalance_factor(), 2);
+}
+
+TEST(test_save_and_load) {
+    Map<std::string, int> map;
+    for (int k = 0; k < 100; ++k) {
+        map[std::to_string(k)] = k;
+    }
+    std::stringstream bytes;
+    map.save(bytes);
+    Map<std::string, int> loaded;
+    loaded["stale"] = 1;
+    ASSERT_TRUE(loaded.load(bytes));
+    ASSERT_EQUAL(loaded.size(), 100);
+    ASSERT_EQUAL(loaded["42"], 42);
+    ASSERT_TRUE(loaded.find("stale") == loaded.end());
+    ASSERT_EQUAL(loaded.shape().height, 7);
+
+    std::stringstream wrong_type(bytes.str());
+    Map<int, int> ints;
+    ASSERT_FALSE(ints.load(wrong_type));
+}
+
+TEST(test_const_iterators_leave_copies_unchanged) {
+    Map<int, int> a;
+    a[1] = 10;
+    a[2] = 20;
+    Map<int, int> b(a.share());
+    Map<int, int>::Const_iterator found = b.cfind(1);
+    // Pairs reached through cfind cannot be changed through the iterator,
+    // since they may be shared with copies
+    static_assert(std::is_same<decltype((found->second)), const int &>::value,
+                  "cfind must hand out read-only pairs");
+    ASSERT_EQUAL(found->second, 10);
+    b.find(found->first)->second = 99;
+    ASSERT_EQUAL(b[1], 99);
+    ASSERT_EQUAL(a[1], 10);
+    b.erase(b.cfind(2));
+    ASSERT_EQUAL(b.size(), 1);
+    ASSERT_EQUAL(a.size(), 2);
+    ASSERT_EQUAL(a[2], 20);
+}
+
+// EFFECTS: Returns the address of the value of key 1 in 'shared'.
+static const int *find_in_copy(Map<int, int> shared) {
+    return &shared.cfind(1)->second;
+}
+
+TEST(test_cfind_keeps_sharing) {
+    Map<int, int> map;
+    map[1] = 10;
+    map[2] = 20;
+    ASSERT_EQUAL(find_in_copy(map.share()), &map.cfind(1)->second);
+    int sum = 0;
+    Map<int, int> copy = map.share();
+    for (auto it = copy.cbegin(); it != copy.cend(); ++it) {
+        sum += it->second;
+    }
+    ASSERT_EQUAL(sum, 30);
+    ASSERT_EQUAL(&copy.cbegin()->second, &map.cbegin()->second);
+}
+
 TEST_MAIN()
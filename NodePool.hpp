@@ -0,0 +1,207 @@
+#ifndef NODE_POOL_HPP
+#define NODE_POOL_HPP
+/* NodePool.hpp
+ *
+ * A std::allocator-compatible pool allocator for tree nodes.
+ *
+ * Pool_allocator carves objects out of large contiguous blocks instead of
+ * asking the global heap for each one. Objects that are deallocated are
+ * kept on a free list and reused by later allocations of the same size.
+ * All blocks are returned to the heap at once, when the last allocator
+ * sharing the pool is destroyed.
+ *
+ * Example:
+ *   BinarySearchTree<int, std::less<int>, AvlBalanced,
+ *                    Pool_allocator<int>> tree;
+ */
+
+#include <cstddef>  //size_t, max_align_t
+#include <memory>   //shared_ptr
+#include <new>      //operator new
+
+class Pool_arena {
+  // OVERVIEW: The storage shared by all copies of a Pool_allocator.
+  //           Memory is handed out by bumping a cursor through the current
+  //           block. Freed objects go onto a free list for their size.
+
+public:
+  // EFFECTS: Creates an empty arena that requests blocks of at least
+  //          block_bytes_in bytes from the heap.
+  explicit Pool_arena(size_t block_bytes_in)
+    : block_bytes(block_bytes_in), blocks(nullptr), cursor(nullptr),
+      limit(nullptr), free_lists(nullptr), reserved(0) { }
+
+  Pool_arena(const Pool_arena &) = delete;
+  Pool_arena &operator=(const Pool_arena &) = delete;
+
+  // EFFECTS: Returns every block to the heap in one pass.
+  ~Pool_arena() {
+    while (blocks) {
+      Block *next = blocks->next;
+      ::operator delete(blocks);
+      blocks = next;
+    }
+  }
+
+  // EFFECTS: Returns storage for 'bytes' bytes aligned to 'align', reusing
+  //          a previously freed object of the same size if there is one.
+  void *allocate(size_t bytes, size_t align) {
+    bytes = slot_size(bytes);
+    Free_list *list = find_list(bytes);
+    if (list && list->head) {
+      Free_slot *slot = list->head;
+      list->head = slot->next;
+      return slot;
+    }
+    return carve(bytes, align);
+  }
+
+  // REQUIRES: ptr was returned by allocate(bytes, ...) on this arena
+  // EFFECTS:  Puts ptr on the free list for its size. The memory stays in
+  //           the arena until the arena is destroyed.
+  void deallocate(void *ptr, size_t bytes) {
+    bytes = slot_size(bytes);
+    Free_list *list = find_list(bytes);
+    if (!list) {
+      void *mem = carve(sizeof(Free_list), alignof(Free_list));
+      list = new (mem) Free_list{bytes, nullptr, free_lists};
+      free_lists = list;
+    }
+    Free_slot *slot = static_cast<Free_slot *>(ptr);
+    slot->next = list->head;
+    list->head = slot;
+  }
+
+  // EFFECTS: Returns the number of bytes this arena holds from the heap.
+  size_t bytes_reserved() const {
+    return reserved;
+  }
+
+private:
+  struct Block {
+    Block *next;
+  };
+
+  struct Free_slot {
+    Free_slot *next;
+  };
+
+  struct Free_list {
+    size_t bytes;
+    Free_slot *head;
+    Free_list *next;
+  };
+
+  size_t block_bytes;
+  Block *blocks;
+  char *cursor;
+  char *limit;
+  Free_list *free_lists;
+  size_t reserved;
+
+  // EFFECTS: Returns the size actually used for an object of 'bytes'
+  //          bytes, which must be able to hold a free list link.
+  static size_t slot_size(size_t bytes) {
+    return bytes < sizeof(Free_slot) ? sizeof(Free_slot) : bytes;
+  }
+
+  // EFFECTS: Returns the free list for objects of exactly 'bytes' bytes,
+  //          or a null pointer if none has been created yet.
+  Free_list *find_list(size_t bytes) const {
+    Free_list *list = free_lists;
+    while (list && list->bytes != bytes) {
+      list = list->next;
+    }
+    return list;
+  }
+
+  // EFFECTS: Bumps the cursor past 'bytes' bytes aligned to 'align',
+  //          starting a new block when the current one is full.
+  void *carve(size_t bytes, size_t align) {
+    size_t pad = (align - reinterpret_cast<size_t>(cursor) % align) % align;
+    if (!cursor || static_cast<size_t>(limit - cursor) < pad + bytes) {
+      add_block(bytes + align);
+      pad = (align - reinterpret_cast<size_t>(cursor) % align) % align;
+    }
+    void *result = cursor + pad;
+    cursor += pad + bytes;
+    return result;
+  }
+
+  // EFFECTS: Links in a new block with room for at least 'bytes' bytes
+  //          and moves the cursor to its start.
+  void add_block(size_t bytes) {
+    size_t header = sizeof(std::max_align_t);
+    size_t size = header + (bytes > block_bytes ? bytes : block_bytes);
+    Block *block = static_cast<Block *>(::operator new(size));
+    block->next = blocks;
+    blocks = block;
+    cursor = reinterpret_cast<char *>(block) + header;
+    limit = reinterpret_cast<char *>(block) + size;
+    reserved += size;
+  }
+};
+
+template <typename T>
+class Pool_allocator {
+  // OVERVIEW: An allocator that draws from a shared Pool_arena. Copies
+  //           (including copies rebound to other types) share the same
+  //           arena and compare equal. A default constructed allocator
+  //           creates a fresh arena.
+  //
+  // NOTE:     The arena is not thread safe. Trees that share a pool must
+  //           not be modified concurrently.
+
+public:
+  using value_type = T;
+
+  // EFFECTS: Creates an allocator with its own arena that requests blocks
+  //          of block_bytes bytes.
+  explicit Pool_allocator(size_t block_bytes = 64 * 1024)
+    : arena(std::make_shared<Pool_arena>(block_bytes)) { }
+
+  // EFFECTS: Creates an allocator that shares other's arena.
+  template <typename U>
+  Pool_allocator(const Pool_allocator<U> &other)
+    : arena(other.arena) { }
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    arena->deallocate(ptr, n * sizeof(T));
+  }
+
+  // EFFECTS: Returns whether this is the only allocator using its arena,
+  //          so that destroying it returns all of the arena's blocks to
+  //          the heap. Only then may a tree whose nodes come from it skip
+  //          freeing them one at a time; nodes it left behind in an arena
+  //          still in use would never be reused.
+  bool releases_in_bulk() const {
+    return arena.use_count() == 1;
+  }
+
+  // EFFECTS: Returns the number of bytes the shared arena holds.
+  size_t bytes_reserved() const {
+    return arena->bytes_reserved();
+  }
+
+  template <typename U>
+  bool operator==(const Pool_allocator<U> &rhs) const {
+    return arena == rhs.arena;
+  }
+
+  template <typename U>
+  bool operator!=(const Pool_allocator<U> &rhs) const {
+    return arena != rhs.arena;
+  }
+
+private:
+  template <typename U>
+  friend class Pool_allocator;
+
+  std::shared_ptr<Pool_arena> arena;
+};
+
+#endif // NODE_POOL_HPP
@@ -0,0 +1,469 @@
+#ifndef PERSISTENT_TREE_HPP
+#define PERSISTENT_TREE_HPP
+/* PersistentTree.hpp
+ *
+ * A persistent (immutable) balanced binary search tree.
+ *
+ * A PersistentTree never changes once built. insert, insert_or_assign and
+ * erase return a new version of the tree and leave the old one intact.
+ * The new version copies only the nodes on the path from the root to the
+ * change, O(log n) of them, and shares every other node with the old
+ * version. Nodes are reference counted, so a node is freed when the last
+ * version using it is destroyed. Copying a PersistentTree is O(1): the
+ * copy shares the root.
+ *
+ * The tree is kept AVL balanced, so its height, and with it the cost of
+ * every operation and the depth of every recursive helper below, is
+ * O(log n). Reference counts are atomic, so versions that share nodes may
+ * be used and destroyed concurrently from different threads.
+ *
+ * Example:
+ *   PersistentTree<int> v1 = PersistentTree<int>().insert(1).insert(2);
+ *   PersistentTree<int> v2 = v1.insert(3);
+ *   // v1 still holds {1, 2}; v2 holds {1, 2, 3} and shares v1's nodes
+ */
+
+#include <algorithm> //max
+#include <atomic>   //atomic
+#include <cassert>  //assert
+#include <cstddef>  //size_t, ptrdiff_t
+#include <functional> //less
+#include <iterator> //forward_iterator_tag
+#include <utility>  //swap
+
+template <typename T, typename Compare=std::less<T>>
+class PersistentTree {
+
+  // OVERVIEW: An immutable ordered set of elements of type T, ordered by
+  //           Compare. Updates return new versions that share structure
+  //           with the version they were made from.
+
+private:
+  struct Node {
+    // NOTE: The node does not take a reference to its children; see
+    //       make_impl.
+    Node(const T &datum_in, const Node *left_in, const Node *right_in)
+      : datum(datum_in), left(left_in), right(right_in),
+        size(1 + size_impl(left_in) + size_impl(right_in)),
+        height(1 + std::max(height_impl(left_in), height_impl(right_in))),
+        refs(1) { }
+
+    const T datum;
+    const Node *const left;
+    const Node *const right;
+    const size_t size;
+    const int height;
+    // The number of parents and versions that hold this node
+    mutable std::atomic<size_t> refs;
+  };
+
+  // The result of updating a subtree: whether anything changed and, if
+  // so, the new subtree, holding one reference (null if it is now empty)
+  struct Change_result {
+    const Node *node;
+    bool changed;
+  };
+
+  // Holds one reference to a node until the end of a scope, so that the
+  // nodes built during an update are freed if a later step throws
+  struct Owned {
+    const Node *node;
+
+    explicit Owned(const Node *node_in)
+      : node(node_in) { }
+
+    ~Owned() {
+      release_impl(node);
+    }
+
+    Owned(const Owned &) = delete;
+    Owned &operator=(const Owned &) = delete;
+  };
+
+public:
+
+  // An AVL tree of height h has at least fib(h + 2) - 1 nodes, so no tree
+  // that fits in memory is this tall.
+  static const int max_height = 96;
+
+  // Default constructor: the empty tree
+  PersistentTree()
+    : root(nullptr) { }
+
+  // Copy constructor: O(1), shares all nodes with other
+  PersistentTree(const PersistentTree &other)
+    : root(retain_impl(other.root)) { }
+
+  // Move constructor
+  PersistentTree(PersistentTree &&other) noexcept
+    : root(other.root) {
+    other.root = nullptr;
+  }
+
+  // Assignment operator (copy and move, through the constructors)
+  PersistentTree &operator=(PersistentTree rhs) {
+    std::swap(root, rhs.root);
+    return *this;
+  }
+
+  // Destructor: releases this version's hold on its nodes
+  ~PersistentTree() {
+    release_impl(root);
+  }
+
+  // EFFECTS: Returns whether this tree is empty.
+  bool empty() const {
+    return root == nullptr;
+  }
+
+  // EFFECTS: Returns the number of elements in this tree.
+  size_t size() const {
+    return size_impl(root);
+  }
+
+  // EFFECTS: Returns the height of this tree (0 if empty).
+  int height() const {
+    return height_impl(root);
+  }
+
+  // EFFECTS: Returns whether every node of this tree is AVL balanced and
+  //          the elements are strictly increasing in order.
+  bool check_invariants() const {
+    const T *prev = nullptr;
+    for (Iterator it = begin(); it != end(); ++it) {
+      if (prev && !less(*prev, *it)) {
+        return false;
+      }
+      prev = &*it;
+    }
+    return check_balance_impl(root);
+  }
+
+  class Iterator {
+    // OVERVIEW: Iterates over the elements of a PersistentTree in
+    //           ascending order. Nodes have no parent pointers, so an
+    //           Iterator keeps the path of nodes whose element comes after
+    //           the current one. It stays valid as long as some version
+    //           containing its node exists.
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator()
+      : depth(0) { }
+
+    const T &operator*() const {
+      return path[depth - 1]->datum;
+    }
+
+    const T *operator->() const {
+      return &path[depth - 1]->datum;
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      const Node *node = path[--depth];
+      push_left_spine(node->right);
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return depth == rhs.depth
+        && (depth == 0 || path[depth - 1] == rhs.path[depth - 1]);
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return !(*this == rhs);
+    }
+
+  private:
+    friend class PersistentTree;
+
+    // The current node is on top; below it are the ancestors that have
+    // it in their left subtree, nearest first.
+    const Node *path[max_height];
+    int depth;
+
+    void push(const Node *node) {
+      assert(depth < max_height);
+      path[depth++] = node;
+    }
+
+    void push_left_spine(const Node *node) {
+      for (; node; node = node->left) {
+        push(node);
+      }
+    }
+  }; // PersistentTree::Iterator
+
+  // EFFECTS: Returns an iterator to the smallest element, or an end
+  //          Iterator if the tree is empty.
+  Iterator begin() const {
+    Iterator it;
+    it.push_left_spine(root);
+    return it;
+  }
+
+  // EFFECTS: Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator();
+  }
+
+  // EFFECTS: Returns an iterator to the element equivalent to query, or an
+  //          end Iterator if there is none.
+  Iterator find(const T &query) const {
+    return find_key(query);
+  }
+
+  // EFFECTS: Same as find(const T &), for a value of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &query) const {
+    return find_key(query);
+  }
+
+  // EFFECTS: Returns a version of this tree that also contains item. If an
+  //          equivalent element is present, returns a copy of this
+  //          version. This version is unchanged.
+  PersistentTree insert(const T &item) const {
+    return PersistentTree(insert_impl(root, item, less, false), root);
+  }
+
+  // EFFECTS: Returns a version of this tree in which item replaces the
+  //          equivalent element, or is added if there is none. This
+  //          version is unchanged.
+  PersistentTree insert_or_assign(const T &item) const {
+    return PersistentTree(insert_impl(root, item, less, true), root);
+  }
+
+  // EFFECTS: Returns a version of this tree without the element
+  //          equivalent to value. If there is none, returns a copy of this
+  //          version. This version is unchanged.
+  PersistentTree erase(const T &value) const {
+    return erase_key(value);
+  }
+
+  // EFFECTS: Same as erase(const T &), for a value of another type K.
+  // NOTE:    Only available when Compare defines is_transparent.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  PersistentTree erase(const K &value) const {
+    return erase_key(value);
+  }
+
+private:
+  // The root of this version, holding one reference, or null if empty
+  const Node *root;
+
+  // An instance of the Compare type. Use this to compare elements.
+  Compare less;
+
+  // EFFECTS: Makes the version rooted at the result of an update, or a
+  //          version sharing unchanged if the update changed nothing.
+  PersistentTree(Change_result result, const Node *unchanged)
+    : root(result.changed ? result.node : retain_impl(unchanged)) { }
+
+  template <typename K>
+  Iterator find_key(const K &query) const {
+    Iterator it;
+    const Node *node = root;
+    while (node) {
+      if (less(query, node->datum)) {
+        it.push(node);
+        node = node->left;
+      }
+      else if (less(node->datum, query)) {
+        node = node->right;
+      }
+      else {
+        it.push(node);
+        return it;
+      }
+    }
+    it.depth = 0;
+    return it;
+  }
+
+  template <typename K>
+  PersistentTree erase_key(const K &value) const {
+    return PersistentTree(erase_impl(root, value, less), root);
+  }
+
+  static size_t size_impl(const Node *node) {
+    return node ? node->size : 0;
+  }
+
+  static int height_impl(const Node *node) {
+    return node ? node->height : 0;
+  }
+
+  // EFFECTS: Adds a reference to node, if not null, and returns it.
+  static const Node *retain_impl(const Node *node) {
+    if(node){
+      node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+  }
+
+  // EFFECTS: Drops a reference to node, if not null. When the last one is
+  //          dropped, frees node and drops its references to its children.
+  // NOTE:    Recurses at most the height of the tree deep.
+  static void release_impl(const Node *node) {
+    if(!node || node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1){
+      return;
+    }
+    const Node *left = node->left;
+    const Node *right = node->right;
+    delete node;
+    release_impl(left);
+    release_impl(right);
+  }
+
+  // EFFECTS: Returns a new node, holding one reference, with a copy of
+  //          datum and the given children. The caller keeps its own
+  //          references to left and right; the node takes new ones only
+  //          once it is built.
+  static const Node *make_impl(const T &datum, const Node *left,
+                               const Node *right) {
+    const Node *node = new Node(datum, left, right);
+    retain_impl(left);
+    retain_impl(right);
+    return node;
+  }
+
+  // REQUIRES: the heights of left and right differ by at most two, and
+  //           datum fits between their elements
+  // EFFECTS:  Returns a new AVL balanced subtree, holding one reference,
+  //           of the elements of left, datum and the elements of right,
+  //           rotating once or twice if one side is two levels taller.
+  static const Node *balance_impl(const T &datum, const Node *left,
+                                  const Node *right) {
+    int balance = height_impl(left) - height_impl(right);
+    if(balance > 1){
+      if(height_impl(left->left) >= height_impl(left->right)){
+        Owned inner(make_impl(datum, left->right, right));
+        return make_impl(left->datum, left->left, inner.node);
+      }
+      const Node *pivot = left->right;
+      Owned lower(make_impl(left->datum, left->left, pivot->left));
+      Owned upper(make_impl(datum, pivot->right, right));
+      return make_impl(pivot->datum, lower.node, upper.node);
+    }
+    if(balance < -1){
+      if(height_impl(right->right) >= height_impl(right->left)){
+        Owned inner(make_impl(datum, left, right->left));
+        return make_impl(right->datum, inner.node, right->right);
+      }
+      const Node *pivot = right->left;
+      Owned lower(make_impl(datum, left, pivot->left));
+      Owned upper(make_impl(right->datum, pivot->right, right->right));
+      return make_impl(pivot->datum, lower.node, upper.node);
+    }
+    return make_impl(datum, left, right);
+  }
+
+  // EFFECTS: Returns the subtree rooted at node with item added (or, if
+  //          replace is true, substituted for the equivalent element),
+  //          copying only the path to it.
+  static Change_result insert_impl(const Node *node, const T &item,
+                                   Compare less, bool replace) {
+    if(!node){
+      return { make_impl(item, nullptr, nullptr), true };
+    }
+    if(less(item, node->datum)){
+      Change_result left = insert_impl(node->left, item, less, replace);
+      Owned hold(left.node);
+      if(!left.changed){
+        return left;
+      }
+      return { balance_impl(node->datum, left.node, node->right), true };
+    }
+    if(less(node->datum, item)){
+      Change_result right = insert_impl(node->right, item, less, replace);
+      Owned hold(right.node);
+      if(!right.changed){
+        return right;
+      }
+      return { balance_impl(node->datum, node->left, right.node), true };
+    }
+    if(!replace){
+      return { nullptr, false };
+    }
+    return { make_impl(item, node->left, node->right), true };
+  }
+
+  // EFFECTS: Returns the subtree rooted at node without the element
+  //          equivalent to value, copying only the path to it.
+  template <typename K>
+  static Change_result erase_impl(const Node *node, const K &value,
+                                  Compare less) {
+    if(!node){
+      return { nullptr, false };
+    }
+    if(less(value, node->datum)){
+      Change_result left = erase_impl(node->left, value, less);
+      Owned hold(left.node);
+      if(!left.changed){
+        return left;
+      }
+      return { balance_impl(node->datum, left.node, node->right), true };
+    }
+    if(less(node->datum, value)){
+      Change_result right = erase_impl(node->right, value, less);
+      Owned hold(right.node);
+      if(!right.changed){
+        return right;
+      }
+      return { balance_impl(node->datum, node->left, right.node), true };
+    }
+    if(!node->left || !node->right){
+      return { retain_impl(node->left ? node->left : node->right), true };
+    }
+    // Two children: the successor's element takes this node's place
+    const Node *successor = node->right;
+    while (successor->left) {
+      successor = successor->left;
+    }
+    Owned right(erase_min_impl(node->right));
+    return { balance_impl(successor->datum, node->left, right.node), true };
+  }
+
+  // REQUIRES: node is not null
+  // EFFECTS:  Returns the subtree rooted at node without its minimum.
+  static const Node *erase_min_impl(const Node *node) {
+    if(!node->left){
+      return retain_impl(node->right);
+    }
+    Owned left(erase_min_impl(node->left));
+    return balance_impl(node->datum, left.node, node->right);
+  }
+
+  // EFFECTS: Returns whether every node below node is AVL balanced and
+  //          has the right size and height.
+  static bool check_balance_impl(const Node *node) {
+    if(!node){
+      return true;
+    }
+    int balance = height_impl(node->left) - height_impl(node->right);
+    return balance >= -1 && balance <= 1
+      && node->size == 1 + size_impl(node->left) + size_impl(node->right)
+      && node->height == 1 + std::max(height_impl(node->left),
+                                      height_impl(node->right))
+      && check_balance_impl(node->left) && check_balance_impl(node->right);
+  }
+
+}; // END of PersistentTree class
+
+#endif // PERSISTENT_TREE_HPP
@@ -0,0 +1,178 @@
+#include "PersistentTree.hpp"
+#include "unit_test_framework.hpp"
+// make PersistentTree_tests.exe
+// ./PersistentTree_tests.exe
+using namespace std;
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// EFFECTS: Returns whether tree holds exactly the elements of expected.
+template <typename T>
+static bool same_elements(const PersistentTree<T> &tree,
+                          const set<T> &expected) {
+    return tree.size() == expected.size()
+        && vector<T>(tree.begin(), tree.end())
+           == vector<T>(expected.begin(), expected.end())
+        && tree.check_invariants();
+}
+
+TEST(empty_tree){
+    PersistentTree<int> tree;
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQUAL(tree.size(), 0);
+    ASSERT_EQUAL(tree.height(), 0);
+    ASSERT_TRUE(tree.begin() == tree.end());
+    ASSERT_TRUE(tree.find(1) == tree.end());
+    ASSERT_TRUE(tree.erase(1).empty());
+}
+
+TEST(old_versions_survive_inserts){
+    vector<PersistentTree<int>> versions(1);
+    for (int i = 0; i < 200; ++i) {
+        versions.push_back(versions.back().insert((i * 37) % 200));
+    }
+    for (int v = 0; v <= 200; ++v) {
+        set<int> expected;
+        for (int i = 0; i < v; ++i) {
+            expected.insert((i * 37) % 200);
+        }
+        ASSERT_TRUE(same_elements(versions[v], expected));
+    }
+    // Sorted insertion stays balanced
+    PersistentTree<int> sorted;
+    for (int i = 0; i < 10000; ++i) {
+        sorted = sorted.insert(i);
+    }
+    ASSERT_TRUE(sorted.check_invariants());
+    ASSERT_TRUE(sorted.height() <= 15);
+}
+
+TEST(random_insert_erase_against_set){
+    PersistentTree<int> tree;
+    set<int> expected;
+    vector<pair<PersistentTree<int>, set<int>>> saved;
+    unsigned key = 99;
+    for (int i = 0; i < 4000; ++i) {
+        key = key * 1103515245u + 12345u;
+        int value = (key >> 8) % 500;
+        if ((key >> 4) % 3 == 0) {
+            tree = tree.erase(value);
+            expected.erase(value);
+        }
+        else {
+            tree = tree.insert(value);
+            expected.insert(value);
+        }
+        if (i % 500 == 0) {
+            saved.emplace_back(tree, expected);
+        }
+    }
+    ASSERT_TRUE(same_elements(tree, expected));
+    for (auto &version : saved) {
+        ASSERT_TRUE(same_elements(version.first, version.second));
+    }
+}
+
+TEST(unchanged_updates_share_the_root){
+    PersistentTree<int> tree = PersistentTree<int>().insert(1).insert(2);
+    PersistentTree<int> same = tree.insert(2).erase(7);
+    ASSERT_TRUE(same.begin() == tree.begin());
+    ASSERT_TRUE(same.find(2) == tree.find(2));
+}
+
+// Compares pairs by key only, so that insert_or_assign replaces the value.
+struct KeyLess {
+    using is_transparent = void;
+    bool operator()(const pair<string, int> &a,
+                    const pair<string, int> &b) const {
+        return a.first < b.first;
+    }
+    bool operator()(const pair<string, int> &a, const string &b) const {
+        return a.first < b;
+    }
+    bool operator()(const string &a, const pair<string, int> &b) const {
+        return a < b.first;
+    }
+};
+
+TEST(insert_or_assign_and_transparent_lookup){
+    using Config = PersistentTree<pair<string, int>, KeyLess>;
+    Config v1 = Config().insert({ "port", 80 }).insert({ "threads", 4 });
+    Config v2 = v1.insert_or_assign({ "port", 8080 });
+    Config v3 = v2.insert({ "port", 1 });
+    ASSERT_EQUAL(v1.find(string("port"))->second, 80);
+    ASSERT_EQUAL(v2.find(string("port"))->second, 8080);
+    ASSERT_EQUAL(v3.find(string("port"))->second, 8080);
+    Config v4 = v3.erase(string("threads"));
+    ASSERT_EQUAL(v4.size(), 1);
+    ASSERT_EQUAL(v3.size(), 2);
+}
+
+struct Fragile {
+    static int copies_left;
+    int value;
+    Fragile(int value_in) : value(value_in) {}
+    Fragile(const Fragile &other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw runtime_error("copy failed");
+        }
+    }
+    bool operator<(const Fragile &rhs) const { return value < rhs.value; }
+};
+int Fragile::copies_left = 0;
+
+TEST(failed_copy_leaves_version_unchanged){
+    Fragile::copies_left = 1000000;
+    PersistentTree<Fragile> tree;
+    for (int i = 0; i < 100; ++i) {
+        tree = tree.insert(Fragile(i));
+    }
+    for (int budget = 0; budget < 8; ++budget) {
+        Fragile::copies_left = budget;
+        bool threw = false;
+        try {
+            tree = tree.insert(Fragile(-1)).erase(Fragile(50));
+        }
+        catch (const runtime_error &) {
+            threw = true;
+        }
+        Fragile::copies_left = 1000000;
+        if (threw) {
+            ASSERT_EQUAL(tree.size(), 100);
+            ASSERT_TRUE(tree.check_invariants());
+        }
+    }
+}
+
+// Threads read and extend their own copies of one shared version, so the
+// reference counts of its nodes change from many threads at once.
+TEST(versions_shared_across_threads){
+    PersistentTree<int> base;
+    for (int i = 0; i < 1000; ++i) {
+        base = base.insert(i);
+    }
+    vector<thread> workers;
+    vector<int> found(4, 0);
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&, t]() {
+            PersistentTree<int> mine = base;
+            for (int i = 0; i < 1000; ++i) {
+                mine = mine.insert(1000 + t * 1000 + i).erase(i);
+                found[t] += base.find(i) != base.end();
+            }
+        });
+    }
+    for (thread &worker : workers) {
+        worker.join();
+    }
+    for (int t = 0; t < 4; ++t) {
+        ASSERT_EQUAL(found[t], 1000);
+    }
+    ASSERT_EQUAL(base.size(), 1000);
+}
+
+TEST_MAIN()
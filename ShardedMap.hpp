@@ -0,0 +1,302 @@
+#ifndef SHARDED_MAP_HPP
+#define SHARDED_MAP_HPP
+/* ShardedMap.hpp
+ *
+ * A Map that many threads can write at once.
+ *
+ * The keys are partitioned by hash among a fixed number of shards, each
+ * a Map guarded by its own mutex. An operation on one key locks only the
+ * shard that key hashes to, so threads working on different shards never
+ * wait for each other. Shards are padded to separate cache lines so that
+ * their locks do not contend through false sharing.
+ *
+ * Ordered traversal (ordered() and for_each) locks every shard, in shard
+ * order, and merges the shards by key, so it sees one consistent state.
+ *
+ * Example:
+ *   ShardedMap<string, int> counts;
+ *   counts.update("apple", [](int &n) { ++n; });  // any thread
+ *   std::optional<int> n = counts.find("apple");  // any thread
+ *   for (const auto &entry : counts.ordered()) { ... }  // all, by key
+ */
+
+#include "Map.hpp"
+#include <algorithm>  //push_heap, pop_heap
+#include <cstddef>    //size_t
+#include <cstdint>    //uint64_t
+#include <functional> //hash, less
+#include <iterator>   //input_iterator_tag
+#include <memory>     //unique_ptr
+#include <mutex>      //mutex, lock_guard, unique_lock
+#include <optional>   //optional
+#include <utility>    //pair
+#include <vector>
+
+template <typename Key_type, typename Value_type,
+          typename Key_compare=std::less<Key_type>,
+          typename Storage=TreeStorage,
+          typename Hash=std::hash<Key_type>
+         >
+class ShardedMap {
+
+  // OVERVIEW: A thread-safe map of unique keys to values, split into
+  //           independently locked shards. All member functions may be
+  //           called concurrently from any thread.
+
+public:
+  // Type alias for the Map that holds one shard
+  using Map_type = Map<Key_type, Value_type, Key_compare, Storage>;
+
+  static const size_t default_shard_count = 64;
+
+  // REQUIRES: shard_count > 0
+  // EFFECTS : Creates an empty map with the given number of shards.
+  explicit ShardedMap(size_t shard_count = default_shard_count)
+    : shards(new Shard[shard_count]), count(shard_count) { }
+
+  // A ShardedMap is shared by reference between threads.
+  ShardedMap(const ShardedMap &) = delete;
+  ShardedMap &operator=(const ShardedMap &) = delete;
+
+  // EFFECTS : Returns the number of shards.
+  size_t shard_count() const {
+    return count;
+  }
+
+  // EFFECTS : Returns the number of elements. Writes made while this runs
+  //           may or may not be counted.
+  size_t size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+      std::lock_guard<std::mutex> lock(shards[i].lock);
+      total += shards[i].contents.size();
+    }
+    return total;
+  }
+
+  // EFFECTS : Returns a copy of the value mapped to k, or an empty
+  //           optional if k is not present.
+  std::optional<Value_type> find(const Key_type &k) const {
+    const Shard &shard = shard_of(k);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    auto it = shard.contents.find(k);
+    if (it == shard.contents.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Inserts val if its key is not present. Returns whether it
+  //           was inserted.
+  bool insert(const std::pair<Key_type, Value_type> &val) {
+    Shard &shard = shard_of(val.first);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.contents.insert(val).second;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Maps k to v, replacing any value k had. Returns whether k
+  //           was newly inserted.
+  bool insert_or_assign(const Key_type &k, const Value_type &v) {
+    Shard &shard = shard_of(k);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    auto result = shard.contents.try_emplace(k, v);
+    if (!result.second) {
+      result.first->second = v;
+    }
+    return result.second;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Calls change(value) on the value mapped to k, first
+  //           inserting a value-initialized one if k is not present, as
+  //           operator[] on a Map would. The shard holding k stays locked
+  //           while change runs, so change must not use this map.
+  template <typename Change>
+  void update(const Key_type &k, Change &&change) {
+    Shard &shard = shard_of(k);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    change(shard.contents[k]);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the element with key k, if there is one. Returns the
+  //           number of elements removed (0 or 1).
+  size_t erase(const Key_type &k) {
+    Shard &shard = shard_of(k);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.contents.erase(k);
+  }
+
+  class Ordered_view;
+
+  // EFFECTS : Returns a view of every key-value pair in ascending key
+  //           order, which merges the shards as it is iterated. Every
+  //           shard stays locked until the view is destroyed, so it sees
+  //           one consistent state: other threads wait for it, and the
+  //           thread holding it must not use this map meanwhile.
+  Ordered_view ordered() const {
+    return Ordered_view(*this);
+  }
+
+  // EFFECTS : Calls visit(pair) on every key-value pair in ascending key
+  //           order. All shards stay locked while this runs, so visit
+  //           sees one consistent state and must not use this map.
+  template <typename Visit>
+  void for_each(Visit &&visit) const {
+    for (const auto &item : ordered()) {
+      visit(item);
+    }
+  }
+
+private:
+  // One partition of the map. Aligned to a cache line so that the locks of
+  // neighbouring shards do not share one.
+  struct alignas(64) Shard {
+    mutable std::mutex lock;
+    Map_type contents;
+  };
+
+  // The range of the next unvisited pair of a shard, during a merge
+  using Cursor = std::pair<typename Map_type::Const_iterator,
+                           typename Map_type::Const_iterator>;
+
+  std::unique_ptr<Shard[]> shards;
+  size_t count;
+
+  Hash hash;
+  Key_compare less;
+
+  // EFFECTS : Returns the shard that k belongs to. The hash is mixed by a
+  //           multiplicative step first, so that hashes that differ only
+  //           in their high bits (or identity hashes of strided integers)
+  //           still spread over the shards.
+  Shard &shard_of(const Key_type &k) const {
+    uint64_t mixed = static_cast<uint64_t>(hash(k)) * 0x9E3779B97F4A7C15ull;
+    return shards[(mixed >> 32) % count];
+  }
+
+}; // END of ShardedMap class
+
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Hash>
+class ShardedMap<Key_type, Value_type, Key_compare, Storage,
+                 Hash>::Ordered_view {
+
+  // OVERVIEW: The pairs of a ShardedMap in ascending key order, read by a
+  //           k-way merge of its shards through a heap of cursors. Holds
+  //           the lock of every shard while it lives. It can be iterated
+  //           once: advancing an iterator advances the merge.
+
+public:
+  using Pair_type = std::pair<Key_type, Value_type>;
+
+  class Iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Pair_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Pair_type *;
+    using reference = const Pair_type &;
+
+    // EFFECTS:  Returns the pair with the smallest key not yet passed.
+    const Pair_type &operator*() const {
+      return *view->heap.front().first;
+    }
+
+    const Pair_type *operator->() const {
+      return &**this;
+    }
+
+    // REQUIRES: this is not an end Iterator
+    // EFFECTS:  Moves to the pair with the next larger key in any shard.
+    Iterator &operator++() {
+      view->advance();
+      return *this;
+    }
+
+    // All Iterators of a view share its one position in the merge, so
+    // they differ only in whether they are at the end.
+    bool operator==(const Iterator &rhs) const {
+      return at_end() == rhs.at_end();
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return !(*this == rhs);
+    }
+
+  private:
+    friend class Ordered_view;
+
+    Ordered_view *view;
+
+    explicit Iterator(Ordered_view *view_in)
+      : view(view_in) { }
+
+    bool at_end() const {
+      return !view || view->heap.empty();
+    }
+
+  }; // Ordered_view::Iterator
+
+  Ordered_view(Ordered_view &&) = default;
+
+  // EFFECTS: Returns an Iterator to the pair with the smallest key not
+  //          yet passed by this view.
+  Iterator begin() {
+    return Iterator(this);
+  }
+
+  // EFFECTS: Returns an Iterator past the last pair.
+  Iterator end() {
+    return Iterator(nullptr);
+  }
+
+private:
+  friend class ShardedMap;
+
+  std::vector<std::unique_lock<std::mutex>> locks;
+  // The top of the heap is the cursor with the smallest key
+  std::vector<Cursor> heap;
+  Key_compare less;
+
+  // Locks every shard, in shard order so that two views cannot deadlock,
+  // and puts a cursor for every non-empty shard on the heap
+  explicit Ordered_view(const ShardedMap &map)
+    : less(map.less) {
+    locks.reserve(map.count);
+    for (size_t i = 0; i < map.count; ++i) {
+      const Map_type &contents = map.shards[i].contents;
+      locks.emplace_back(map.shards[i].lock);
+      if (!contents.empty()) {
+        heap.emplace_back(contents.cbegin(), contents.cend());
+      }
+    }
+    std::make_heap(heap.begin(), heap.end(), later());
+  }
+
+  // EFFECTS: Returns the heap order: the cursor at the larger key sorts
+  //          first, so that the smallest key rises to the top.
+  auto later() const {
+    return [this](const Cursor &a, const Cursor &b) {
+      return less(b.first->first, a.first->first);
+    };
+  }
+
+  // REQUIRES: the heap is not empty
+  // EFFECTS:  Steps past the pair at the top of the heap.
+  void advance() {
+    std::pop_heap(heap.begin(), heap.end(), later());
+    Cursor &next = heap.back();
+    if (++next.first == next.second) {
+      heap.pop_back();
+    }
+    else {
+      std::push_heap(heap.begin(), heap.end(), later());
+    }
+  }
+
+}; // END of ShardedMap::Ordered_view class
+
+#endif // SHARDED_MAP_HPP
@@ -0,0 +1,114 @@
+#include "ShardedMap.hpp"
+#include "unit_test_framework.hpp"
+// make ShardedMap_tests.exe
+// ./ShardedMap_tests.exe
+using namespace std;
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+TEST(single_thread_operations){
+    ShardedMap<string, int> map(4);
+    ASSERT_EQUAL(map.shard_count(), 4);
+    ASSERT_EQUAL(map.size(), 0);
+    ASSERT_TRUE(map.insert({ "apple", 1 }));
+    ASSERT_FALSE(map.insert({ "apple", 2 }));
+    ASSERT_EQUAL(*map.find("apple"), 1);
+    ASSERT_FALSE(map.insert_or_assign("apple", 3));
+    ASSERT_TRUE(map.insert_or_assign("banana", 4));
+    map.update("cherry", [](int &n) { n += 5; });
+    map.update("cherry", [](int &n) { n += 5; });
+    ASSERT_EQUAL(*map.find("apple"), 3);
+    ASSERT_EQUAL(*map.find("cherry"), 10);
+    ASSERT_EQUAL(map.size(), 3);
+    ASSERT_EQUAL(map.erase("banana"), 1);
+    ASSERT_EQUAL(map.erase("banana"), 0);
+    ASSERT_FALSE(map.find("banana").has_value());
+}
+
+TEST(for_each_merges_shards_in_order){
+    ShardedMap<int, int> map(7);
+    for (int i = 0; i < 1000; ++i) {
+        map.insert({ (i * 7919) % 1000, i });
+    }
+    vector<int> keys;
+    map.for_each([&](const pair<int, int> &entry) {
+        keys.push_back(entry.first);
+    });
+    ASSERT_EQUAL(keys.size(), 1000);
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQUAL(keys[i], i);
+    }
+}
+
+TEST(ordered_view_iterates_all_shards_by_key){
+    ShardedMap<string, int> map(5);
+    for (int i = 0; i < 100; ++i) {
+        map.insert({ to_string(i), i });
+    }
+    string prev;
+    int seen = 0;
+    for (const auto &entry : map.ordered()) {
+        ASSERT_TRUE(prev < entry.first);
+        ASSERT_EQUAL(stoi(entry.first), entry.second);
+        prev = entry.first;
+        ++seen;
+    }
+    ASSERT_EQUAL(seen, 100);
+    auto view = map.ordered();
+    auto it = view.begin();
+    ASSERT_EQUAL(it->first, "0");
+    ASSERT_EQUAL((++it)->first, "1");
+    ASSERT_TRUE(it != view.end());
+
+    ShardedMap<int, int> empty(3);
+    auto nothing = empty.ordered();
+    ASSERT_TRUE(nothing.begin() == nothing.end());
+}
+
+TEST(descending_comparator_and_btree_shards){
+    ShardedMap<int, int, greater<int>, BTreeStorage> map(3);
+    for (int i = 0; i < 100; ++i) {
+        map.insert_or_assign(i, i);
+    }
+    int expected = 99;
+    map.for_each([&](const pair<int, int> &entry) {
+        ASSERT_EQUAL(entry.first, expected--);
+    });
+    ASSERT_EQUAL(expected, -1);
+}
+
+// Many threads count occurrences of overlapping keys and insert and erase
+// keys of their own. The totals must match a sequential run exactly.
+TEST(concurrent_writers_lose_no_updates){
+    const int threads = 8;
+    const int rounds = 2000;
+    ShardedMap<int, int> map(16);
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i < rounds; ++i) {
+                map.update(i % 100, [](int &n) { ++n; });
+                int own = 1000 + t * rounds + i;
+                map.insert({ own, t });
+                if (i % 2) {
+                    map.erase(own);
+                }
+            }
+        });
+    }
+    for (thread &worker : workers) {
+        worker.join();
+    }
+    ASSERT_EQUAL(map.size(), 100 + threads * rounds / 2);
+    int total = 0;
+    map.for_each([&](const pair<int, int> &entry) {
+        if (entry.first < 100) {
+            total += entry.second;
+        }
+    });
+    ASSERT_EQUAL(total, threads * rounds);
+}
+
+TEST_MAIN()
@@ -17,8 +17,8 @@ static const char* const c_leaf_branch_special = "/\\";
  * value held by a particular tree node or one of / or \ to improve
  * readability of the printed tree.
  */
-template <typename U, typename C>
-class BinarySearchTree<U, C>::Tree_grid_square {
+template <typename U, typename C, typename B, typename A>
+class BinarySearchTree<U, C, B, A>::Tree_grid_square {
 public:
   template<typename T>
   Tree_grid_square(int x_, int y_, T value_) : x(x_), y(y_) {
@@ -72,8 +72,8 @@ private:
 /*
  * Container to build and hold a set of Tree_grid_squares.
  */
-template <typename U, typename C>
-class BinarySearchTree<U, C>::Tree_grid {
+template <typename U, typename C, typename B, typename A>
+class BinarySearchTree<U, C, B, A>::Tree_grid {
 public:
 
   Tree_grid(const BinarySearchTree& tree) :
@@ -191,8 +191,8 @@ private:
  * Returns an (actually) human-readable string representation of the
  * tree
  */
-template <typename U, typename C>
-std::string BinarySearchTree<U, C>::to_string() const {
+template <typename U, typename C, typename B, typename A>
+std::string BinarySearchTree<U, C, B, A>::to_string() const {
     if (!root) {
         return "( )";
     }
@@ -240,8 +240,8 @@ static const int c_min_elt_width = 2;
 /*
  * Returns the width of the widest elt in this tree.
  */
-template <typename U, typename C>
-int BinarySearchTree<U, C>::get_max_elt_width() const {
+template <typename U, typename C, typename B, typename A>
+int BinarySearchTree<U, C, B, A>::get_max_elt_width() const {
     int current_max = c_min_elt_width;
     std::stack<Node*> nodes;
     nodes.push(root);
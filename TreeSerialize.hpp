@@ -0,0 +1,355 @@
+#ifndef TREE_SERIALIZE_HPP
+#define TREE_SERIALIZE_HPP
+/* TreeSerialize.hpp
+ *
+ * A versioned binary snapshot format for BinarySearchTree and Map.
+ *
+ * A snapshot is a fixed 48-byte header followed by the elements of the
+ * tree in sorted order, each written by the Binary_codec for its type.
+ * The header records the format version, the byte order of the machine
+ * that wrote it, the encoded size of one element (0 if it varies), the
+ * number of elements and the length and checksum of the payload, and
+ * ends with a checksum of its own fields. Numbers are written in the
+ * writer's byte order; a snapshot written on a machine of the other byte
+ * order is rejected rather than converted.
+ *
+ * Codecs are provided for arithmetic and enum types, std::string and
+ * std::pair of encodable types. Other types are made encodable by
+ * specializing Binary_codec, for example:
+ *
+ *   template <>
+ *   struct Binary_codec<Point> {
+ *     static const size_t fixed_size = 2 * sizeof(int);
+ *     static size_t size(const Point &) { return fixed_size; }
+ *     static char *encode(const Point &p, char *out) {
+ *       out = Binary_codec<int>::encode(p.x, out);
+ *       return Binary_codec<int>::encode(p.y, out);
+ *     }
+ *     static Point decode(Byte_reader &in) {
+ *       int x = Binary_codec<int>::decode(in);
+ *       return Point{ x, Binary_codec<int>::decode(in) };
+ *     }
+ *   };
+ *
+ * Example:
+ *   std::ofstream out("map.bin", std::ios::binary);
+ *   map.save(out);
+ *   ...
+ *   std::ifstream in("map.bin", std::ios::binary);
+ *   if (!map.load(in)) { ... not a valid snapshot ... }
+ */
+
+#include <algorithm>   //max, min
+#include <cstddef>     //size_t
+#include <cstdint>     //uint32_t, uint64_t
+#include <cstring>     //memcpy, memcmp
+#include <iostream>    //istream, ostream
+#include <limits>      //numeric_limits
+#include <memory>      //unique_ptr
+#include <string>
+#include <type_traits> //enable_if_t, is_arithmetic, is_enum, remove_const_t
+#include <utility>     //pair, move
+
+// Reads the payload of a snapshot, which is in memory, from front to back.
+class Byte_reader {
+public:
+  Byte_reader(const char *first, const char *last)
+    : next(first), end(last) { }
+
+  // MODIFIES: this
+  // EFFECTS : Returns the next n bytes and moves past them, or returns
+  //           null and marks the payload as truncated if fewer remain.
+  const char *take(size_t n) {
+    if (static_cast<size_t>(end - next) < n) {
+      next = end;
+      truncated = true;
+      return nullptr;
+    }
+    const char *bytes = next;
+    next += n;
+    return bytes;
+  }
+
+  // EFFECTS: Returns whether every byte was read and no read ran past
+  //          the end.
+  bool finished() const {
+    return !truncated && next == end;
+  }
+
+private:
+  const char *next;
+  const char *end;
+  bool truncated = false;
+};
+
+// How values of type T are written to and read back from a snapshot.
+//
+// A specialization provides
+//   static const size_t fixed_size;  encoded size of every value, or 0 if
+//                                    it depends on the value
+//   static const size_t min_size;    only if fixed_size is 0: the fewest
+//                                    bytes any value encodes to
+//   static size_t size(const T &);   encoded size of one value
+//   static char *encode(const T &, char *out);
+//                                    writes exactly size() bytes to out and
+//                                    returns the end of what it wrote
+//   static T decode(Byte_reader &);  reads back one value; on a truncated
+//                                    payload it may return any value, as
+//                                    the whole snapshot is then rejected
+//
+// The primary template is left undefined, so saving a tree of a type with
+// no codec fails to compile.
+template <typename T, typename Enable = void>
+struct Binary_codec;
+
+// EFFECTS: Returns the fewest bytes Binary_codec<T> encodes any value to.
+template <typename T>
+constexpr size_t min_encoded_size() {
+  if constexpr (Binary_codec<T>::fixed_size != 0) {
+    return Binary_codec<T>::fixed_size;
+  } else {
+    return Binary_codec<T>::min_size;
+  }
+}
+
+// Arithmetic and enum types are written as the bytes they are in memory.
+template <typename T>
+struct Binary_codec<T, std::enable_if_t<std::is_arithmetic<T>::value ||
+                                        std::is_enum<T>::value>> {
+  static const size_t fixed_size = sizeof(T);
+
+  static size_t size(const T &) {
+    return sizeof(T);
+  }
+
+  static char *encode(const T &value, char *out) {
+    std::memcpy(out, &value, sizeof(T));
+    return out + sizeof(T);
+  }
+
+  static T decode(Byte_reader &in) {
+    T value = T();
+    const char *bytes = in.take(sizeof(T));
+    if (bytes) {
+      std::memcpy(&value, bytes, sizeof(T));
+    }
+    return value;
+  }
+};
+
+// A string is written as its length, as a uint64_t, then its characters.
+template <>
+struct Binary_codec<std::string> {
+  static const size_t fixed_size = 0;
+  static const size_t min_size = sizeof(uint64_t);
+
+  static size_t size(const std::string &value) {
+    return sizeof(uint64_t) + value.size();
+  }
+
+  static char *encode(const std::string &value, char *out) {
+    out = Binary_codec<uint64_t>::encode(value.size(), out);
+    std::memcpy(out, value.data(), value.size());
+    return out + value.size();
+  }
+
+  static std::string decode(Byte_reader &in) {
+    uint64_t length = Binary_codec<uint64_t>::decode(in);
+    const char *bytes = in.take(length);
+    return bytes ? std::string(bytes, length) : std::string();
+  }
+};
+
+// A pair is written as its first member followed by its second.
+template <typename A, typename B>
+struct Binary_codec<std::pair<A, B>> {
+  using First = Binary_codec<std::remove_const_t<A>>;
+  using Second = Binary_codec<std::remove_const_t<B>>;
+
+  static const size_t fixed_size = First::fixed_size && Second::fixed_size
+                                   ? First::fixed_size + Second::fixed_size
+                                   : 0;
+  static const size_t min_size = min_encoded_size<std::remove_const_t<A>>()
+                                 + min_encoded_size<std::remove_const_t<B>>();
+
+  static size_t size(const std::pair<A, B> &value) {
+    return First::size(value.first) + Second::size(value.second);
+  }
+
+  static char *encode(const std::pair<A, B> &value, char *out) {
+    return Second::encode(value.second, First::encode(value.first, out));
+  }
+
+  static std::pair<A, B> decode(Byte_reader &in) {
+    std::remove_const_t<A> first = First::decode(in);
+    return std::pair<A, B>(std::move(first), Second::decode(in));
+  }
+};
+
+// The fixed part of a snapshot, written as these bytes in this order.
+struct Snapshot_header {
+  static const uint32_t current_version = 1;
+  // Written as the number 0x01020304, so that a reader of the other byte
+  // order reads it as 0x04030201
+  static const uint32_t byte_order_mark = 0x01020304;
+
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t element_size;
+  uint64_t count;
+  uint64_t payload_bytes;
+  uint64_t payload_checksum;
+  // Checksum of all the fields above
+  uint64_t header_checksum;
+};
+
+static_assert(sizeof(Snapshot_header) == 48,
+              "Snapshot_header must have no padding");
+
+// EFFECTS: Returns a 64-bit checksum of the n bytes at 'bytes'. Any change
+//          to a single 8-byte word changes the result. It guards against
+//          truncated and damaged files, not against deliberate tampering.
+// NOTE:    The payload is consumed eight bytes at a time with one multiply
+//          each, so checking it does not slow loading down noticeably.
+inline uint64_t snapshot_checksum(const char *bytes, size_t n) {
+  const uint64_t prime = 0x100000001b3;
+  uint64_t sum = 0xcbf29ce484222325 ^ n;
+  for(; n >= 8; n -= 8, bytes += 8){
+    uint64_t word;
+    std::memcpy(&word, bytes, 8);
+    sum = (sum ^ word) * prime;
+    sum ^= sum >> 32;
+  }
+  for(; n > 0; --n, ++bytes){
+    sum = (sum ^ static_cast<unsigned char>(*bytes)) * prime;
+  }
+  return sum;
+}
+
+// EFFECTS: Returns the header for a payload of 'count' elements of type T
+//          that is 'payload_bytes' long and starts at 'payload'.
+template <typename T>
+Snapshot_header make_snapshot_header(size_t count, const char *payload,
+                                     size_t payload_bytes) {
+  Snapshot_header header;
+  std::memcpy(header.magic, "BSTS", 4);
+  header.version = Snapshot_header::current_version;
+  header.byte_order = Snapshot_header::byte_order_mark;
+  header.element_size = static_cast<uint32_t>(Binary_codec<T>::fixed_size);
+  header.count = count;
+  header.payload_bytes = payload_bytes;
+  header.payload_checksum = snapshot_checksum(payload, payload_bytes);
+  header.header_checksum = snapshot_checksum(
+      reinterpret_cast<const char *>(&header),
+      offsetof(Snapshot_header, header_checksum));
+  return header;
+}
+
+// EFFECTS: Returns whether 'header' is intact and describes a snapshot of
+//          elements of type T that this build can read.
+// NOTE:    The count is checked against the payload length by division,
+//          so no count, however large, can overflow its way past the check
+//          and make load() build more nodes than the payload can describe.
+template <typename T>
+bool is_readable_snapshot_header(const Snapshot_header &header) {
+  const uint64_t least = std::max<uint64_t>(1, min_encoded_size<T>());
+  return std::memcmp(header.magic, "BSTS", 4) == 0
+         && header.header_checksum == snapshot_checksum(
+                reinterpret_cast<const char *>(&header),
+                offsetof(Snapshot_header, header_checksum))
+         && header.version == Snapshot_header::current_version
+         && header.byte_order == Snapshot_header::byte_order_mark
+         && header.element_size == Binary_codec<T>::fixed_size
+         && header.count <= header.payload_bytes / least
+         && (!Binary_codec<T>::fixed_size
+             || (header.payload_bytes % least == 0
+                 && header.count == header.payload_bytes / least))
+         && header.payload_bytes <= std::numeric_limits<size_t>::max();
+}
+
+// A snapshot read into memory and checked, ready to be decoded.
+template <typename T>
+class Snapshot_payload {
+public:
+  // MODIFIES: is
+  // EFFECTS : Reads a header and its payload from 'is'. The payload is
+  //           usable only if both are intact and describe elements of
+  //           type T.
+  explicit Snapshot_payload(std::istream &is) {
+    if (!is.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || !is_readable_snapshot_header<T>(header)) {
+      return;
+    }
+    if (!read_payload(is, header.payload_bytes)) {
+      return;
+    }
+    usable = header.payload_checksum
+             == snapshot_checksum(bytes.get(), header.payload_bytes);
+  }
+
+  bool valid() const {
+    return usable;
+  }
+
+  size_t count() const {
+    return header.count;
+  }
+
+  Byte_reader reader() const {
+    return Byte_reader(bytes.get(), bytes.get() + header.payload_bytes);
+  }
+
+private:
+  // Payloads are read this many bytes at a time, at first
+  static constexpr size_t first_chunk = size_t(1) << 20;
+
+  // MODIFIES: is, bytes
+  // EFFECTS : Reads n bytes from 'is' into bytes and returns whether they
+  //           were all there. The buffer doubles only as bytes arrive, so a
+  //           header claiming more than the stream holds costs at most
+  //           twice what the stream really holds, not what it claims.
+  bool read_payload(std::istream &is, size_t n) {
+    size_t capacity = std::min(n, first_chunk);
+    bytes.reset(new char[capacity]);
+    for(size_t have = 0; have < n;){
+      if(have == capacity){
+        capacity = std::min(n, 2 * capacity);
+        std::unique_ptr<char[]> bigger(new char[capacity]);
+        std::memcpy(bigger.get(), bytes.get(), have);
+        bytes = std::move(bigger);
+      }
+      if(!is.read(bytes.get() + have, capacity - have)){
+        return false;
+      }
+      have = capacity;
+    }
+    return true;
+  }
+
+  Snapshot_header header;
+  std::unique_ptr<char[]> bytes;
+  bool usable = false;
+};
+
+// An input iterator over the elements encoded in a payload. Dereferencing
+// it decodes the element at its position, so each position must be
+// dereferenced exactly once, before the iterator is incremented.
+template <typename T>
+class Decoding_iterator {
+public:
+  explicit Decoding_iterator(Byte_reader &in_in) : in(&in_in) { }
+
+  T operator*() const {
+    return Binary_codec<T>::decode(*in);
+  }
+
+  Decoding_iterator &operator++() {
+    return *this;
+  }
+
+private:
+  Byte_reader *in;
+};
+
+#endif // TREE_SERIALIZE_HPP
@@ -0,0 +1,181 @@
+#ifndef TREE_STATS_HPP
+#define TREE_STATS_HPP
+/* TreeStats.hpp
+ *
+ * Optional counters for the searches a BinarySearchTree makes.
+ *
+ * Compile with -DTREE_STATS=1 to have every descent from the root (find,
+ * insert, erase by key, lower_bound, rank, ...) count the comparisons it
+ * makes and the nodes it visits. A slow lookup can then be told apart as
+ * a deep tree (many nodes visited) or an expensive comparator (many
+ * comparisons per node). With TREE_STATS=0, the default, searches use
+ * the tree's comparator directly and no counting code is generated.
+ *
+ * Example:
+ *   Search_stats s = tree.stats();
+ *   std::cout << s.comparisons / s.searches << " compares per search, "
+ *             << s.mean_depth() << " nodes deep" << std::endl;
+ */
+
+#include <atomic>  //atomic, memory_order_relaxed
+#include <cstddef> //size_t
+
+#ifndef TREE_STATS
+#define TREE_STATS 0
+#endif
+
+// A snapshot of the counters of one tree.
+struct Search_stats {
+  // Searches that visited 'd' nodes are counted in depths[d]; the last
+  // entry also counts all deeper searches.
+  static const size_t max_depth = 64;
+
+  size_t searches = 0;
+  size_t comparisons = 0;
+  size_t nodes_visited = 0;
+  size_t depths[max_depth] = { };
+
+  // EFFECTS: Returns the average number of nodes a search visited.
+  double mean_depth() const {
+    return searches ? static_cast<double>(nodes_visited) / searches : 0;
+  }
+};
+
+// The counters a tree keeps if 'enabled', or none.
+template <bool enabled>
+class Search_counters {
+public:
+  // EFFECTS: Returns all-zero stats.
+  Search_stats snapshot() const {
+    return Search_stats();
+  }
+
+  void reset() { }
+};
+
+template <>
+class Search_counters<true> {
+
+  // OVERVIEW: Running totals of the searches of one tree. Searches of a
+  //           tree that is only read may run on several threads at once,
+  //           so the totals are atomic; each search adds to them once,
+  //           when it finishes. Copying or moving a tree does not carry
+  //           its counts along.
+
+public:
+  Search_counters() = default;
+
+  Search_counters(const Search_counters &) { }
+
+  Search_counters &operator=(const Search_counters &) {
+    return *this;
+  }
+
+  // EFFECTS: Adds one search that made 'comparisons' comparisons and
+  //          visited 'depth' nodes.
+  void record(size_t comparisons, size_t depth) {
+    searches.fetch_add(1, std::memory_order_relaxed);
+    compared.fetch_add(comparisons, std::memory_order_relaxed);
+    visited.fetch_add(depth, std::memory_order_relaxed);
+    size_t bucket = depth < Search_stats::max_depth
+                    ? depth : Search_stats::max_depth - 1;
+    depths[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // EFFECTS: Returns the totals so far.
+  Search_stats snapshot() const {
+    Search_stats stats;
+    stats.searches = searches.load(std::memory_order_relaxed);
+    stats.comparisons = compared.load(std::memory_order_relaxed);
+    stats.nodes_visited = visited.load(std::memory_order_relaxed);
+    for (size_t d = 0; d < Search_stats::max_depth; ++d) {
+      stats.depths[d] = depths[d].load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Sets all totals back to zero.
+  void reset() {
+    searches.store(0, std::memory_order_relaxed);
+    compared.store(0, std::memory_order_relaxed);
+    visited.store(0, std::memory_order_relaxed);
+    for (std::atomic<size_t> &count : depths) {
+      count.store(0, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  std::atomic<size_t> searches{0};
+  std::atomic<size_t> compared{0};
+  std::atomic<size_t> visited{0};
+  std::atomic<size_t> depths[Search_stats::max_depth] = { };
+
+}; // END of Search_counters class
+
+// A comparator that counts its calls, for one search at a time. Searches
+// take it by value, so each has its own count, which Search_trace adds to
+// the tree's counters when the search finishes.
+template <typename Compare>
+struct Counting_compare {
+  Compare compare;
+  Search_counters<true> *counters;
+  mutable size_t calls;
+
+  template <typename A, typename B>
+  bool operator()(const A &a, const B &b) const {
+    ++calls;
+    return compare(a, b);
+  }
+};
+
+// Follows one search made with the comparator type Compare. For plain
+// comparators it does nothing and compiles away.
+template <typename Compare>
+class Search_trace {
+public:
+  explicit Search_trace(const Compare &) { }
+
+  // EFFECTS: Notes that the search reached one more node.
+  void visit() { }
+};
+
+template <typename Compare>
+class Search_trace<Counting_compare<Compare>> {
+public:
+  explicit Search_trace(const Counting_compare<Compare> &less_in)
+    : less(less_in) { }
+
+  Search_trace(const Search_trace &) = delete;
+  Search_trace &operator=(const Search_trace &) = delete;
+
+  // EFFECTS: Records the search in the counters of its tree.
+  ~Search_trace() {
+    less.counters->record(less.calls, depth);
+  }
+
+  // EFFECTS: Notes that the search reached one more node.
+  void visit() {
+    ++depth;
+  }
+
+private:
+  const Counting_compare<Compare> &less;
+  size_t depth = 0;
+};
+
+// EFFECTS: Returns the comparator for one search of a tree whose counters
+//          are 'counters': 'less' itself if counting is off, or otherwise
+//          a Counting_compare that wraps it.
+template <typename Compare>
+const Compare &search_compare(const Compare &less, Search_counters<false> &) {
+  return less;
+}
+
+template <typename Compare>
+Counting_compare<Compare> search_compare(const Compare &less,
+                                         Search_counters<true> &counters) {
+  return Counting_compare<Compare>{ less, &counters, 0 };
+}
+
+#endif // TREE_STATS_HPP